@@ -1,26 +1,695 @@
 #include "i2c.h"
+#include "i2c_port.h"
+#include "i2c_stats.h"
+#include "i2c_trace.h"
 
+#include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
 
-status_t i2c_read(
+#define QUEUE_MASK (I2C_QUEUE_CAPACITY - 1)
+
+#if (I2C_QUEUE_CAPACITY & QUEUE_MASK) != 0
+#error "I2C_QUEUE_CAPACITY must be a power of two"
+#endif
+
+static status_t stub_start(i2c_transaction_t *transaction);
+
+static const i2c_port_t stub_port = {
+    .start = stub_start,
+};
+
+/*
+ * Per-controller queue state. `head` is only advanced by dispatch, `tail`
+ * only by submission, both under the port's critical section.
+ */
+typedef struct {
+    const i2c_port_t *port;
+    i2c_transaction_t *queue[I2C_QUEUE_CAPACITY];
+    volatile uint16_t queue_head;
+    volatile uint16_t queue_tail;
+
+    /* The transaction currently owned by the controller, if any */
+    i2c_transaction_t *volatile active;
+
+    /* Set while dispatch() is running, so completions from `start` don't recurse */
+    volatile int dispatching;
+
+    /* When the active transaction was handed to the port, for statistics */
+    uint32_t start_us;
+
+    /* Task-level ownership, see i2c_bus_acquire */
+    const i2c_lock_ops_t *lock_ops;
+    void *mutex;
+    void *owner;
+    uint32_t depth;
+} bus_state_t;
+
+static bus_state_t buses[I2C_BUS_COUNT];
+
+static i2c_time_source_t time_source;
+
+static const i2c_port_t *port_of(bus_state_t *bus)
+{
+    return bus->port != NULL ? bus->port : &stub_port;
+}
+
+static void enter_critical(bus_state_t *bus)
+{
+    const i2c_port_t *port = port_of(bus);
+
+    if (port->enter_critical != NULL) {
+        port->enter_critical();
+    }
+}
+
+static void exit_critical(bus_state_t *bus)
+{
+    const i2c_port_t *port = port_of(bus);
+
+    if (port->exit_critical != NULL) {
+        port->exit_critical();
+    }
+}
+
+#if I2C_TRACE
+static void trace(i2c_transaction_t *transaction, status_t status)
+{
+    if (transaction->direction == I2C_DIRECTION_CHAIN) {
+        for (size_t i = 0; i < transaction->msg_count; ++i) {
+            I2C_TRACE_SEGMENT(transaction->bus, &transaction->msgs[i], status);
+        }
+    } else {
+        const i2c_msg_t segment = {
+            .direction = transaction->direction,
+            .bus_address = transaction->bus_address,
+            .register_address = transaction->register_address,
+            .length = transaction->length,
+            .buffer = transaction->buffer,
+        };
+        I2C_TRACE_SEGMENT(transaction->bus, &segment, status);
+    }
+}
+#else
+#define trace(transaction, status) ((void)0)
+#endif
+
+/*
+ * Complete `transaction`. `started` tells whether it reached the controller,
+ * in which case the bus time since `start_us` is accounted.
+ */
+static void finish(
+    bus_state_t *bus,
+    i2c_transaction_t *transaction,
+    status_t status,
+    bool started)
+{
+    trace(transaction, status);
+#if I2C_STATS
+    I2C_STATS_RECORD(
+        transaction,
+        status,
+        started,
+        started ? i2c_time_us() - bus->start_us : 0);
+#else
+    (void)bus;
+    (void)started;
+#endif
+    transaction->status = status;
+    if (transaction->callback != NULL) {
+        transaction->callback(transaction);
+    }
+}
+
+/* Start queued transactions until the controller is busy or the queue empty */
+static void dispatch(bus_state_t *bus)
+{
+    enter_critical(bus);
+    if (bus->dispatching) {
+        exit_critical(bus);
+        return;
+    }
+    bus->dispatching = 1;
+
+    while (bus->active == NULL && bus->queue_head != bus->queue_tail) {
+        i2c_transaction_t *transaction =
+            bus->queue[bus->queue_head & QUEUE_MASK];
+        bus->queue_head++;
+        if (transaction == NULL) {
+            continue; /* Cancelled while queued */
+        }
+        bus->active = transaction;
+#if I2C_STATS
+        bus->start_us = i2c_time_us();
+#endif
+
+        exit_critical(bus);
+        status_t status = port_of(bus)->start(transaction);
+        enter_critical(bus);
+
+        if (status != STATUS_OK && bus->active == transaction) {
+            bus->active = NULL;
+            exit_critical(bus);
+            finish(bus, transaction, status, true);
+            enter_critical(bus);
+        }
+    }
+
+    bus->dispatching = 0;
+    exit_critical(bus);
+}
+
+void i2c_port_complete_bus(uint8_t bus_index, status_t status)
+{
+    if (bus_index >= I2C_BUS_COUNT) {
+        return;
+    }
+
+    bus_state_t *bus = &buses[bus_index];
+    i2c_transaction_t *transaction = bus->active;
+
+    if (transaction == NULL) {
+        return;
+    }
+    bus->active = NULL;
+    finish(bus, transaction, status, true);
+    dispatch(bus);
+}
+
+void i2c_port_complete(status_t status)
+{
+    i2c_port_complete_bus(0, status);
+}
+
+void i2c_set_bus_port(uint8_t bus_index, const i2c_port_t *port)
+{
+    if (bus_index < I2C_BUS_COUNT) {
+        buses[bus_index].port = port;
+    }
+}
+
+void i2c_port_enter_critical(uint8_t bus_index)
+{
+    if (bus_index < I2C_BUS_COUNT) {
+        enter_critical(&buses[bus_index]);
+    }
+}
+
+void i2c_port_exit_critical(uint8_t bus_index)
+{
+    if (bus_index < I2C_BUS_COUNT) {
+        exit_critical(&buses[bus_index]);
+    }
+}
+
+void i2c_set_port(const i2c_port_t *port)
+{
+    i2c_set_bus_port(0, port);
+}
+
+void i2c_set_bus_lock(
+    uint8_t bus_index,
+    const i2c_lock_ops_t *ops,
+    void *mutex)
+{
+    if (bus_index < I2C_BUS_COUNT) {
+        buses[bus_index].lock_ops = ops;
+        buses[bus_index].mutex = mutex;
+        buses[bus_index].owner = NULL;
+        buses[bus_index].depth = 0;
+    }
+}
+
+status_t i2c_bus_acquire(uint8_t bus_index)
+{
+    if (bus_index >= I2C_BUS_COUNT) {
+        return STATUS_ERROR;
+    }
+
+    bus_state_t *bus = &buses[bus_index];
+    const i2c_lock_ops_t *ops = bus->lock_ops;
+
+    if (ops == NULL) {
+        return STATUS_OK;
+    }
+
+    /* Only the owner can observe itself in `owner`, so no race here */
+    void *task = ops->current_task();
+    if (bus->depth > 0 && bus->owner == task) {
+        bus->depth++;
+        return STATUS_OK;
+    }
+
+    ops->lock(bus->mutex);
+    bus->owner = task;
+    bus->depth = 1;
+    return STATUS_OK;
+}
+
+void i2c_bus_release(uint8_t bus_index)
+{
+    if (bus_index >= I2C_BUS_COUNT) {
+        return;
+    }
+
+    bus_state_t *bus = &buses[bus_index];
+
+    const i2c_lock_ops_t *ops = bus->lock_ops;
+
+    /* A task that does not own the bus has nothing to release */
+    if (ops == NULL || bus->depth == 0 || bus->owner != ops->current_task()) {
+        return;
+    }
+
+    if (--bus->depth == 0) {
+        bus->owner = NULL;
+        ops->unlock(bus->mutex);
+    }
+}
+
+static status_t submit(i2c_transaction_t *transaction)
+{
+    if (transaction->bus >= I2C_BUS_COUNT) {
+        return STATUS_ERROR;
+    }
+
+    bus_state_t *bus = &buses[transaction->bus];
+
+    enter_critical(bus);
+    if ((uint16_t)(bus->queue_tail - bus->queue_head) == I2C_QUEUE_CAPACITY) {
+        exit_critical(bus);
+        return STATUS_BUSY;
+    }
+    transaction->status = STATUS_PENDING;
+    bus->queue[bus->queue_tail & QUEUE_MASK] = transaction;
+    bus->queue_tail++;
+    exit_critical(bus);
+
+    dispatch(bus);
+    return STATUS_OK;
+}
+
+void i2c_set_time_source(i2c_time_source_t source)
+{
+    time_source = source;
+}
+
+uint32_t i2c_time_us(void)
+{
+    return time_source != NULL ? time_source() : 0;
+}
+
+uint32_t i2c_deadline_in(uint32_t timeout_us)
+{
+    return i2c_time_us() + timeout_us;
+}
+
+static bool deadline_passed(uint32_t deadline_us)
+{
+    return (int32_t)(time_source() - deadline_us) >= 0;
+}
+
+void i2c_cancel(i2c_transaction_t *transaction, status_t status)
+{
+    if (transaction->bus >= I2C_BUS_COUNT) {
+        return;
+    }
+
+    bus_state_t *bus = &buses[transaction->bus];
+    const i2c_port_t *port = port_of(bus);
+    bool found = false;
+    bool started = false;
+
+    enter_critical(bus);
+    if (transaction->status != STATUS_PENDING) {
+        /* Completed in the meantime */
+        exit_critical(bus);
+        return;
+    }
+
+    if (bus->active == transaction) {
+        if (port->abort != NULL) {
+            port->abort(transaction);
+        }
+        bus->active = NULL;
+        found = true;
+        started = true;
+    } else {
+        for (uint16_t i = bus->queue_head; i != bus->queue_tail; ++i) {
+            if (bus->queue[i & QUEUE_MASK] == transaction) {
+                bus->queue[i & QUEUE_MASK] = NULL;
+                found = true;
+                break;
+            }
+        }
+    }
+    exit_critical(bus);
+
+    if (found) {
+        finish(bus, transaction, status, started);
+        dispatch(bus);
+    }
+}
+
+/*
+ * Abort the active transaction and run the port's recovery sequence. With
+ * `own` set this happens only if `own` is the transaction on the wire;
+ * otherwise `own` is just withdrawn, leaving other targets' transfers alone.
+ */
+static status_t recover(
+    bus_state_t *bus,
+    i2c_transaction_t *own)
+{
+    const i2c_port_t *port = port_of(bus);
+    status_t status = STATUS_OK;
+
+    /* Hold off dispatch so nothing is started on the bus being recovered */
+    enter_critical(bus);
+    i2c_transaction_t *active = bus->active;
+    if (own != NULL && active != own) {
+        exit_critical(bus);
+        i2c_cancel(own, STATUS_TIMEOUT);
+        return STATUS_OK;
+    }
+    if (active != NULL && port->abort != NULL) {
+        port->abort(active);
+    }
+    bus->active = NULL;
+
+    /* Reached from a completion inside dispatch(), leave that one running */
+    int dispatching = bus->dispatching;
+    bus->dispatching = 1;
+    exit_critical(bus);
+
+    if (port->recover != NULL) {
+        status = port->recover();
+    }
+
+    if (active != NULL) {
+        finish(bus, active, STATUS_TIMEOUT, true);
+    }
+
+    bus->dispatching = dispatching;
+    if (!dispatching) {
+        dispatch(bus);
+    }
+    return status;
+}
+
+status_t i2c_bus_recover(uint8_t bus_index)
+{
+    if (bus_index >= I2C_BUS_COUNT) {
+        return STATUS_ERROR;
+    }
+    return recover(&buses[bus_index], NULL);
+}
+
+/* What a blocking call does about its deadline */
+typedef enum {
+    WAIT_UNBOUNDED,
+    WAIT_DEADLINE, /* Cancel at the deadline */
+    WAIT_RECOVER   /* Cancel, recovering the bus if it is on the wire */
+} wait_t;
+
+/*
+ * Run `transaction` through `start` and block until it has completed, or
+ * until `deadline_us` unless `wait` is WAIT_UNBOUNDED, after which it is
+ * ended with STATUS_TIMEOUT. Holds the bus for the duration.
+ */
+static status_t run_blocking(
+    i2c_transaction_t *transaction,
+    status_t (*start)(i2c_transaction_t *transaction),
+    wait_t wait,
+    uint32_t deadline_us)
+{
+    bool bounded = wait != WAIT_UNBOUNDED;
+
+    if (bounded && time_source == NULL) {
+        return STATUS_ERROR;
+    }
+    if (transaction->bus >= I2C_BUS_COUNT) {
+        return STATUS_ERROR;
+    }
+
+    /* Queued behind the dispatch this was called from, it could never start */
+    if (buses[transaction->bus].dispatching) {
+        return STATUS_BUSY;
+    }
+
+    status_t status = i2c_bus_acquire(transaction->bus);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    status = start(transaction);
+    if (status == STATUS_OK) {
+        while (transaction->status == STATUS_PENDING) {
+            if (!bounded || !deadline_passed(deadline_us)) {
+                continue;
+            }
+            if (wait == WAIT_RECOVER) {
+                recover(&buses[transaction->bus], transaction);
+            } else {
+                i2c_cancel(transaction, STATUS_TIMEOUT);
+            }
+        }
+        status = transaction->status;
+    }
+
+    i2c_bus_release(transaction->bus);
+    return status;
+}
+
+status_t i2c_recover_bitbang(const i2c_gpio_ops_t *gpio)
+{
+    gpio->set_sda(1);
+    for (int i = 0; i < 9 && !gpio->get_sda(); ++i) {
+        gpio->set_scl(0);
+        gpio->delay_half_period();
+        gpio->set_scl(1);
+        gpio->delay_half_period();
+    }
+    if (!gpio->get_sda()) {
+        return STATUS_ERROR;
+    }
+
+    /* STOP: SDA rises while SCL is high */
+    gpio->set_scl(0);
+    gpio->delay_half_period();
+    gpio->set_sda(0);
+    gpio->delay_half_period();
+    gpio->set_scl(1);
+    gpio->delay_half_period();
+    gpio->set_sda(1);
+    gpio->delay_half_period();
+    return STATUS_OK;
+}
+
+/*
+ * The stub backend completes in line; a real port completes from its ISR.
+ * Reads return 0xff and writes are discarded; build with I2C_TRACE to see
+ * the traffic.
+ */
+static status_t stub_start(i2c_transaction_t *transaction)
+{
+    const i2c_msg_t single = {
+        .direction = transaction->direction,
+        .bus_address = transaction->bus_address,
+        .register_address = transaction->register_address,
+        .length = transaction->length,
+        .buffer = transaction->buffer,
+    };
+    const i2c_msg_t *msgs = &single;
+    size_t count = 1;
+
+    if (transaction->direction == I2C_DIRECTION_CHAIN) {
+        msgs = transaction->msgs;
+        count = transaction->msg_count;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (msgs[i].direction != I2C_DIRECTION_READ) {
+            continue;
+        }
+
+        /* Setting the output to some arbitrary value */
+        for (size_t b = 0; b < msgs[i].length; ++b) {
+            msgs[i].buffer[b] = 0xff;
+        }
+    }
+
+    i2c_port_complete_bus(transaction->bus, STATUS_OK);
+    return STATUS_OK;
+}
+
+status_t i2c_read_async(i2c_transaction_t *transaction)
+{
+    transaction->direction = I2C_DIRECTION_READ;
+    return submit(transaction);
+}
+
+status_t i2c_write_async(i2c_transaction_t *transaction)
+{
+    transaction->direction = I2C_DIRECTION_WRITE;
+    return submit(transaction);
+}
+
+status_t i2c_transfer_async(i2c_transaction_t *transaction)
+{
+    for (size_t i = 0; i < transaction->msg_count; ++i) {
+        if (transaction->msgs[i].direction == I2C_DIRECTION_CHAIN) {
+            return STATUS_ERROR;
+        }
+    }
+
+    transaction->direction = I2C_DIRECTION_CHAIN;
+    return submit(transaction);
+}
+
+status_t i2c_bus_read_deadline(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer,
+    uint32_t deadline_us)
+{
+    i2c_transaction_t transaction = {
+        .bus = bus,
+        .bus_address = bus_address,
+        .register_address = register_address,
+        .length = length,
+        .buffer = buffer,
+    };
+
+    return run_blocking(
+        &transaction,
+        i2c_read_async,
+        WAIT_DEADLINE,
+        deadline_us);
+}
+
+status_t i2c_bus_read_deadline_recover(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer,
+    uint32_t deadline_us)
+{
+    i2c_transaction_t transaction = {
+        .bus = bus,
+        .bus_address = bus_address,
+        .register_address = register_address,
+        .length = length,
+        .buffer = buffer,
+    };
+
+    return run_blocking(
+        &transaction,
+        i2c_read_async,
+        WAIT_RECOVER,
+        deadline_us);
+}
+
+status_t i2c_bus_write_deadline(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer,
+    uint32_t deadline_us)
+{
+    i2c_transaction_t transaction = {
+        .bus = bus,
+        .bus_address = bus_address,
+        .register_address = register_address,
+        .length = length,
+        .buffer = buffer,
+    };
+
+    return run_blocking(
+        &transaction,
+        i2c_write_async,
+        WAIT_DEADLINE,
+        deadline_us);
+}
+
+status_t i2c_bus_transfer_deadline(
+    uint8_t bus,
+    const i2c_msg_t *msgs,
+    size_t count,
+    uint32_t deadline_us)
+{
+    i2c_transaction_t transaction = {
+        .bus = bus,
+        .msgs = msgs,
+        .msg_count = count,
+    };
+
+    return run_blocking(
+        &transaction,
+        i2c_transfer_async,
+        WAIT_DEADLINE,
+        deadline_us);
+}
+
+status_t i2c_bus_read(
+    uint8_t bus,
     uint8_t bus_address,
     uint8_t register_address,
     uint16_t length,
     uint8_t *buffer)
 {
-    printf(
-        "read [%d] bytes from bus [%d] for register [%d]\n",
-        length,
-        bus_address,
-        register_address);
+    i2c_transaction_t transaction = {
+        .bus = bus,
+        .bus_address = bus_address,
+        .register_address = register_address,
+        .length = length,
+        .buffer = buffer,
+    };
 
-    /* Setting the output to some arbitrary value */
-    for (size_t i = 0; i < length; ++i) {
-        buffer[i] = 0xff;
-    }
+    return run_blocking(&transaction, i2c_read_async, WAIT_UNBOUNDED, 0);
+}
 
-    return STATUS_OK;
+status_t i2c_bus_write(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer)
+{
+    i2c_transaction_t transaction = {
+        .bus = bus,
+        .bus_address = bus_address,
+        .register_address = register_address,
+        .length = length,
+        .buffer = buffer,
+    };
+
+    return run_blocking(&transaction, i2c_write_async, WAIT_UNBOUNDED, 0);
+}
+
+status_t i2c_bus_transfer(
+    uint8_t bus,
+    const i2c_msg_t *msgs,
+    size_t count)
+{
+    i2c_transaction_t transaction = {
+        .bus = bus,
+        .msgs = msgs,
+        .msg_count = count,
+    };
+
+    return run_blocking(&transaction, i2c_transfer_async, WAIT_UNBOUNDED, 0);
+}
+
+status_t i2c_read(
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer)
+{
+    return i2c_bus_read(0, bus_address, register_address, length, buffer);
 }
 
 status_t i2c_write(
@@ -29,15 +698,10 @@ status_t i2c_write(
     uint16_t length,
     uint8_t *buffer)
 {
-    printf(
-        "write [%d] bytes to bus [%d] for register [%d]\n\t",
-        length,
-        bus_address,
-        register_address);
+    return i2c_bus_write(0, bus_address, register_address, length, buffer);
+}
 
-    for (size_t i = 0; i < length; ++i) {
-        printf("%p", buffer);
-    }
-    printf("\n");
-    return STATUS_OK;
+status_t i2c_transfer(const i2c_msg_t *msgs, size_t count)
+{
+    return i2c_bus_transfer(0, msgs, count);
 }
@@ -1,13 +1,118 @@
 #ifndef I2C_HEADER_H
 #define I2C_HEADER_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum {
     STATUS_OK,
-    STATUS_ERROR
+    STATUS_ERROR,
+    STATUS_BUSY,    /* The controller cannot accept the request right now */
+    STATUS_PENDING, /* The transaction has been accepted but not completed */
+    STATUS_TIMEOUT, /* The deadline passed; the transfer was aborted */
+    STATUS_NACK,    /* The target did not acknowledge its address or data */
+    STATUS_ARB_LOST /* Another controller won arbitration */
 } status_t;
 
+/* Number of independent I2C controllers */
+#ifndef I2C_BUS_COUNT
+#define I2C_BUS_COUNT 1
+#endif
+
+/* Capacity of each controller's transaction queue, must be a power of two */
+#ifndef I2C_QUEUE_CAPACITY
+#define I2C_QUEUE_CAPACITY 16
+#endif
+
+typedef enum {
+    I2C_DIRECTION_READ,
+    I2C_DIRECTION_WRITE,
+    I2C_DIRECTION_CHAIN /* A sequence of i2c_msg_t segments */
+} i2c_direction_t;
+
+/*
+ * One segment of a combined transfer: select `register_address` on
+ * `bus_address` and read or write `length` bytes.
+ */
+typedef struct {
+    i2c_direction_t direction; /* I2C_DIRECTION_READ or I2C_DIRECTION_WRITE */
+    uint8_t bus_address;
+    uint8_t register_address;
+    uint16_t length;
+    uint8_t *buffer;
+} i2c_msg_t;
+
+typedef struct i2c_transaction i2c_transaction_t;
+
+/* Called once the transaction has completed, possibly from interrupt context */
+typedef void (*i2c_callback_t)(i2c_transaction_t *transaction);
+
+/*
+ * Descriptor for an asynchronous transfer. The descriptor and the buffer it
+ * points to must stay valid until the callback has run. `status` reads
+ * STATUS_PENDING while the transfer is in flight and holds the result once
+ * it has completed.
+ */
+struct i2c_transaction {
+    i2c_direction_t direction; /* Set by i2c_read_async/i2c_write_async */
+    uint8_t bus;               /* Controller index, below I2C_BUS_COUNT */
+    uint8_t bus_address;
+    uint8_t register_address;
+    uint16_t length;
+    uint8_t *buffer;
+    i2c_callback_t callback;
+    void *context;
+    volatile status_t status;
+
+    /* Segments of an I2C_DIRECTION_CHAIN transaction */
+    const i2c_msg_t *msgs;
+    size_t msg_count;
+};
+
+/*
+ * Task-level bus ownership for RTOS use. Blocking calls take ownership of
+ * their controller for the duration of the transfer; a task can also hold
+ * it across several calls with i2c_bus_acquire()/i2c_bus_release(), which
+ * nest. A release from a task that does not own the bus does nothing.
+ * Interrupt-driven asynchronous submissions never take the lock, so a
+ * DRDY-driven sample reader is not held off by a task that owns the bus;
+ * use i2c_transfer() where segments must be contiguous on the wire.
+ *
+ * `lock` must block on a mutex with priority inheritance (e.g. a FreeRTOS
+ * mutex, not a binary semaphore) so a low-priority owner is boosted while a
+ * higher-priority task waits. A bus without lock operations takes no lock
+ * at all, which is the fast path for a bus used by a single task.
+ */
+typedef struct {
+    void (*lock)(void *mutex);
+    void (*unlock)(void *mutex);
+    void *(*current_task)(void);
+} i2c_lock_ops_t;
+
+/* Install `ops` and `mutex` for controller `bus`; NULL `ops` removes them */
+void i2c_set_bus_lock(
+    uint8_t bus,
+    const i2c_lock_ops_t *ops,
+    void *mutex);
+
+status_t i2c_bus_acquire(uint8_t bus);
+
+void i2c_bus_release(uint8_t bus);
+
+/*
+ * Blocking calls wait for their own transfer to complete. The calls without
+ * a `bus` parameter operate on controller 0. A completion callback that
+ * runs while the controller is dispatching, which is the case whenever a
+ * port completes in line from `start`, cannot wait for a transfer on that
+ * controller: it would be queued behind the dispatch it is called from and
+ * never start. Blocking calls, deadline variants included, return
+ * STATUS_BUSY there without queuing anything; use the asynchronous calls
+ * from completion callbacks.
+ */
 status_t i2c_read(
     uint8_t bus_address,
     uint8_t register_address,
@@ -20,4 +125,120 @@ status_t i2c_write(
     uint16_t length,
     uint8_t *buffer);
 
+status_t i2c_bus_read(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer);
+
+status_t i2c_bus_write(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer);
+
+/*
+ * Queue a transfer on controller `transaction->bus` and return immediately.
+ * Queued transactions are started back to back from the completion
+ * interrupt, in submission order. Each controller has its own queue, so
+ * different buses run in parallel. Returns STATUS_OK once the transaction
+ * has been accepted, after which the callback (if any) is guaranteed to
+ * run, or STATUS_BUSY if the queue is full.
+ */
+status_t i2c_read_async(i2c_transaction_t *transaction);
+
+status_t i2c_write_async(i2c_transaction_t *transaction);
+
+/*
+ * Run `count` segments as one bus operation: a single START, a repeated
+ * START between segments and one STOP at the end, with no other queued
+ * transaction in between. Stops at the first failing segment.
+ */
+status_t i2c_transfer(const i2c_msg_t *msgs, size_t count);
+
+status_t i2c_bus_transfer(
+    uint8_t bus,
+    const i2c_msg_t *msgs,
+    size_t count);
+
+/*
+ * Deadlines. Time is read from a monotonic microsecond source installed
+ * with i2c_set_time_source(); deadlines are absolute times on that clock and
+ * are compared modulo 2^32. A deadline variant returns STATUS_TIMEOUT, with
+ * the transfer aborted, once its deadline has passed, so the caller's worst
+ * case is the deadline itself plus the port's abort time. Without a time
+ * source the deadline variants return STATUS_ERROR.
+ */
+typedef uint32_t (*i2c_time_source_t)(void);
+
+void i2c_set_time_source(i2c_time_source_t source);
+
+/* Current time on the installed source, 0 without one */
+uint32_t i2c_time_us(void);
+
+/* The deadline `timeout_us` from now */
+uint32_t i2c_deadline_in(uint32_t timeout_us);
+
+status_t i2c_bus_read_deadline(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer,
+    uint32_t deadline_us);
+
+/*
+ * As i2c_bus_read_deadline, but a read still on the wire at the deadline is
+ * ended through i2c_bus_recover(), freeing a target that holds SDA low. A
+ * read still queued behind other transfers is only withdrawn, so their
+ * targets are left alone.
+ */
+status_t i2c_bus_read_deadline_recover(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer,
+    uint32_t deadline_us);
+
+status_t i2c_bus_write_deadline(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint8_t register_address,
+    uint16_t length,
+    uint8_t *buffer,
+    uint32_t deadline_us);
+
+status_t i2c_bus_transfer_deadline(
+    uint8_t bus,
+    const i2c_msg_t *msgs,
+    size_t count,
+    uint32_t deadline_us);
+
+/*
+ * Withdraw a pending transaction, aborting it if it is on the wire, and
+ * complete it with `status`. Does nothing if it has already completed.
+ */
+void i2c_cancel(i2c_transaction_t *transaction, status_t status);
+
+/*
+ * Abort whatever controller `bus` is doing, completing it with
+ * STATUS_TIMEOUT, and run the port's recovery sequence to free a target
+ * that holds SDA low. Queued transactions start again afterwards, or once
+ * the dispatch in progress resumes when called from a completion callback.
+ */
+status_t i2c_bus_recover(uint8_t bus);
+
+/*
+ * Queue `transaction->msgs` as one combined transfer, as i2c_transfer. The
+ * address, register, length and buffer fields of `transaction` are unused.
+ */
+status_t i2c_transfer_async(i2c_transaction_t *transaction);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
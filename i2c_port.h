@@ -0,0 +1,92 @@
+#ifndef I2C_PORT_HEADER_H
+#define I2C_PORT_HEADER_H
+
+#include "i2c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Controller backend for the I2C transaction queue. A port starts one
+ * transfer at a time (typically by programming DMA) and reports its end by
+ * calling i2c_port_complete(), usually from the transfer-complete ISR. The
+ * queue then starts the next transfer from that same call, so consecutive
+ * transactions need no thread-level involvement.
+ */
+typedef struct {
+    /*
+     * Begin `transaction` and return. Returning anything other than
+     * STATUS_OK fails the transaction without i2c_port_complete(). For
+     * I2C_DIRECTION_CHAIN the port runs every segment in `msgs` with a
+     * repeated START between them and completes once, after the STOP.
+     */
+    status_t (*start)(i2c_transaction_t *transaction);
+
+    /*
+     * Stop the transfer in progress. After it returns the port must not
+     * call i2c_port_complete() for `transaction`. May be NULL if transfers
+     * cannot hang.
+     */
+    void (*abort)(i2c_transaction_t *transaction);
+
+    /*
+     * Free a stuck bus, typically with i2c_recover_bitbang() on the pins
+     * muxed as GPIO. May be NULL.
+     */
+    status_t (*recover)(void);
+
+    /*
+     * Mask and unmask the completion interrupt around queue updates made
+     * from thread context. May be NULL when completion never preempts
+     * submission, as with the stub backend.
+     */
+    void (*enter_critical)(void);
+    void (*exit_critical)(void);
+} i2c_port_t;
+
+/*
+ * Transfers end with i2c_port_complete_bus(), passing STATUS_OK,
+ * STATUS_NACK when the target did not acknowledge, STATUS_ARB_LOST when
+ * another controller won arbitration, or STATUS_ERROR for anything else.
+ */
+
+/* Replace the backend of controller `bus`; NULL restores the stub backend */
+void i2c_set_bus_port(uint8_t bus, const i2c_port_t *port);
+
+/* Report completion of the transfer most recently started on `bus` */
+void i2c_port_complete_bus(uint8_t bus, status_t status);
+
+/*
+ * Run the enter_critical and exit_critical hooks of the port of `bus`, for
+ * state outside the queue that completions also update, such as
+ * i2c_stats.
+ */
+void i2c_port_enter_critical(uint8_t bus);
+void i2c_port_exit_critical(uint8_t bus);
+
+/* Controller 0 shorthands for single-bus systems */
+void i2c_set_port(const i2c_port_t *port);
+
+void i2c_port_complete(status_t status);
+
+/* Pin access for i2c_recover_bitbang(); levels are 0 or 1, 1 = released */
+typedef struct {
+    void (*set_scl)(int level);
+    void (*set_sda)(int level);
+    int (*get_sda)(void);
+    void (*delay_half_period)(void);
+} i2c_gpio_ops_t;
+
+/*
+ * Standard bus recovery: clock SCL up to nine times until the target
+ * releases SDA, then generate a STOP. Returns STATUS_ERROR if SDA is still
+ * held low.
+ */
+status_t i2c_recover_bitbang(const i2c_gpio_ops_t *gpio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+#include "i2c_stats.h"
+#include "i2c_port.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if I2C_STATS
+
+static i2c_bus_stats_t stats[I2C_BUS_COUNT];
+static uint32_t window_last[I2C_BUS_COUNT];
+
+/* Add the time since the last update to the window of `bus` */
+static void advance_window(uint8_t bus)
+{
+    uint32_t now = i2c_time_us();
+
+    stats[bus].window_us += (uint32_t)(now - window_last[bus]);
+    window_last[bus] = now;
+}
+
+static uint8_t latency_bucket(uint32_t us)
+{
+    uint8_t bucket = 0;
+
+    while (us != 0 && bucket < I2C_STATS_LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+static void record_segment(i2c_bus_stats_t *bus, const i2c_msg_t *segment)
+{
+    uint8_t address = segment->bus_address & (I2C_STATS_ADDRESSES - 1);
+
+    bus->bytes += segment->length;
+    bus->per_register[segment->register_address & (I2C_STATS_REGISTERS - 1)]++;
+    bus->per_address[address]++;
+    bus->bytes_per_address[address] += segment->length;
+}
+
+void i2c_stats_record(
+    const i2c_transaction_t *transaction,
+    status_t status,
+    bool started,
+    uint32_t bus_time_us)
+{
+    i2c_bus_stats_t *bus = &stats[transaction->bus];
+
+    advance_window(transaction->bus);
+    bus->transactions++;
+    bus->by_status[status]++;
+    if (started) {
+        bus->latency[latency_bucket(bus_time_us)]++;
+        bus->busy_us += bus_time_us;
+    }
+
+    if (transaction->direction == I2C_DIRECTION_CHAIN) {
+        for (size_t i = 0; i < transaction->msg_count; ++i) {
+            record_segment(bus, &transaction->msgs[i]);
+        }
+    } else {
+        const i2c_msg_t segment = {
+            .bus_address = transaction->bus_address,
+            .register_address = transaction->register_address,
+            .length = transaction->length,
+        };
+        record_segment(bus, &segment);
+    }
+}
+
+void i2c_get_bus_stats(uint8_t bus, i2c_bus_stats_t *out)
+{
+    if (bus >= I2C_BUS_COUNT) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    i2c_port_enter_critical(bus);
+    advance_window(bus);
+    *out = stats[bus];
+    i2c_port_exit_critical(bus);
+}
+
+void i2c_get_address_stats(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint32_t *segments,
+    uint32_t *bytes)
+{
+    uint8_t address = bus_address & (I2C_STATS_ADDRESSES - 1);
+
+    if (bus >= I2C_BUS_COUNT) {
+        *segments = 0;
+        *bytes = 0;
+        return;
+    }
+
+    *segments = stats[bus].per_address[address];
+    *bytes = stats[bus].bytes_per_address[address];
+}
+
+void i2c_reset_bus_stats(uint8_t bus)
+{
+    if (bus < I2C_BUS_COUNT) {
+        i2c_port_enter_critical(bus);
+        memset(&stats[bus], 0, sizeof(stats[bus]));
+        window_last[bus] = i2c_time_us();
+        i2c_port_exit_critical(bus);
+    }
+}
+
+#else
+
+void i2c_get_bus_stats(uint8_t bus, i2c_bus_stats_t *out)
+{
+    (void)bus;
+    memset(out, 0, sizeof(*out));
+}
+
+void i2c_get_address_stats(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint32_t *segments,
+    uint32_t *bytes)
+{
+    (void)bus;
+    (void)bus_address;
+    *segments = 0;
+    *bytes = 0;
+}
+
+void i2c_reset_bus_stats(uint8_t bus)
+{
+    (void)bus;
+}
+
+#endif
+
+float i2c_stats_utilisation(const i2c_bus_stats_t *stats)
+{
+    if (stats->window_us == 0) {
+        return 0.0f;
+    }
+    return 100.0f * (float)stats->busy_us / (float)stats->window_us;
+}
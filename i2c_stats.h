@@ -0,0 +1,95 @@
+#ifndef I2C_STATS_HEADER_H
+#define I2C_STATS_HEADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "i2c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Per-controller transaction statistics. Build with -DI2C_STATS=1 to
+ * enable; without it the hooks compile to nothing and snapshots read zero.
+ * Recording is a handful of counter increments at completion, taken from
+ * the completion context. i2c_get_bus_stats() copies the counters inside
+ * the port's critical section, so a snapshot never holds half of a
+ * transfer; the per-target counts of i2c_get_address_stats() are read
+ * without it and may be a transfer apart.
+ */
+#ifndef I2C_STATS
+#define I2C_STATS 0
+#endif
+
+#define I2C_STATUS_COUNT (STATUS_ARB_LOST + 1)
+
+/*
+ * Bus time histogram: bucket 0 counts transfers under 1 us, bucket b those
+ * in [2^(b-1), 2^b) us, and the last bucket everything longer.
+ */
+#define I2C_STATS_LATENCY_BUCKETS 16
+
+/* Register and target address spaces, with the auto-increment bit stripped */
+#define I2C_STATS_REGISTERS 128
+#define I2C_STATS_ADDRESSES 128
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t by_status[I2C_STATUS_COUNT];
+    uint32_t latency[I2C_STATS_LATENCY_BUCKETS];
+
+    /*
+     * Time the controller spent on transfers, and since the last reset.
+     * The window is accumulated from the 32-bit time source at each
+     * transfer and snapshot, so it keeps counting past the source's wrap
+     * as long as one of those comes at least every 2^32 us (71 minutes).
+     */
+    uint64_t busy_us;
+    uint64_t window_us;
+
+    uint32_t per_register[I2C_STATS_REGISTERS]; /* Segments starting there */
+    uint32_t per_address[I2C_STATS_ADDRESSES];  /* Segments per target */
+    uint32_t bytes_per_address[I2C_STATS_ADDRESSES];
+} i2c_bus_stats_t;
+
+#if I2C_STATS
+
+void i2c_stats_record(
+    const i2c_transaction_t *transaction,
+    status_t status,
+    bool started,
+    uint32_t bus_time_us);
+
+#define I2C_STATS_RECORD(transaction, status, started, bus_time_us) \
+    i2c_stats_record((transaction), (status), (started), (bus_time_us))
+
+#else
+
+#define I2C_STATS_RECORD(transaction, status, started, bus_time_us) ((void)0)
+
+#endif
+
+/* Copy the statistics of controller `bus` into `stats` */
+void i2c_get_bus_stats(uint8_t bus, i2c_bus_stats_t *stats);
+
+/* Segment and byte counts for one target, without copying the whole set */
+void i2c_get_address_stats(
+    uint8_t bus,
+    uint8_t bus_address,
+    uint32_t *segments,
+    uint32_t *bytes);
+
+/* Bus utilisation over the snapshot window, in percent */
+float i2c_stats_utilisation(const i2c_bus_stats_t *stats);
+
+/* Zero the statistics of controller `bus` and restart its window */
+void i2c_reset_bus_stats(uint8_t bus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,116 @@
+#include "i2c_trace.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if I2C_TRACE
+
+#define TRACE_MASK (I2C_TRACE_CAPACITY - 1)
+
+#if (I2C_TRACE_CAPACITY & TRACE_MASK) != 0
+#error "I2C_TRACE_CAPACITY must be a power of two"
+#endif
+
+static i2c_trace_record_t records[I2C_TRACE_CAPACITY];
+
+/* Total records ever written; completions on several buses may race */
+static atomic_uint_least32_t written;
+
+void i2c_trace_segment(
+    uint8_t bus,
+    const i2c_msg_t *segment,
+    status_t status)
+{
+    uint32_t index = atomic_fetch_add_explicit(&written, 1, memory_order_relaxed);
+    i2c_trace_record_t *record = &records[index & TRACE_MASK];
+    uint8_t data_length = segment->length < I2C_TRACE_DATA_BYTES
+        ? (uint8_t)segment->length
+        : I2C_TRACE_DATA_BYTES;
+
+    record->timestamp = i2c_time_us();
+    record->bus = bus;
+    record->bus_address = segment->bus_address;
+    record->register_address = segment->register_address;
+    record->direction = (uint8_t)segment->direction;
+    record->length = segment->length;
+    record->status = (uint8_t)status;
+    record->data_length = data_length;
+    for (uint8_t i = 0; i < data_length; ++i) {
+        record->data[i] = segment->buffer[i];
+    }
+}
+
+void i2c_trace_clear(void)
+{
+    atomic_store_explicit(&written, 0, memory_order_relaxed);
+}
+
+static uint8_t *put_le16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    return out + 2;
+}
+
+static uint8_t *put_le32(uint8_t *out, uint32_t value)
+{
+    out = put_le16(out, (uint16_t)value);
+    return put_le16(out, (uint16_t)(value >> 16));
+}
+
+size_t i2c_trace_export(uint8_t *buffer, size_t size)
+{
+    uint32_t total = atomic_load_explicit(&written, memory_order_relaxed);
+    uint32_t count = total < I2C_TRACE_CAPACITY ? total : I2C_TRACE_CAPACITY;
+    uint32_t first = total - count;
+    uint8_t *out = buffer;
+
+    if (size < I2C_TRACE_HEADER_SIZE) {
+        return 0;
+    }
+    if (count > (size - I2C_TRACE_HEADER_SIZE) / I2C_TRACE_RECORD_SIZE) {
+        count = (uint32_t)((size - I2C_TRACE_HEADER_SIZE) / I2C_TRACE_RECORD_SIZE);
+    }
+
+    for (size_t i = 0; i < 4; ++i) {
+        *out++ = (uint8_t)I2C_TRACE_MAGIC[i];
+    }
+    *out++ = I2C_TRACE_VERSION;
+    *out++ = I2C_TRACE_RECORD_SIZE;
+    out = put_le16(out, (uint16_t)count);
+    out = put_le32(out, first);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const i2c_trace_record_t *record = &records[(first + i) & TRACE_MASK];
+
+        out = put_le32(out, record->timestamp);
+        *out++ = record->bus;
+        *out++ = record->bus_address;
+        *out++ = record->register_address;
+        *out++ = record->direction;
+        out = put_le16(out, record->length);
+        *out++ = record->status;
+        *out++ = record->data_length;
+        for (size_t b = 0; b < I2C_TRACE_DATA_BYTES; ++b) {
+            *out++ = record->data[b];
+        }
+    }
+
+    return (size_t)(out - buffer);
+}
+
+#else
+
+void i2c_trace_clear(void)
+{
+}
+
+size_t i2c_trace_export(uint8_t *buffer, size_t size)
+{
+    (void)buffer;
+    (void)size;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef I2C_TRACE_HEADER_H
+#define I2C_TRACE_HEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary transaction trace. Build with -DI2C_TRACE=1 to record every
+ * completed segment into a fixed-size ring; without it the hooks compile
+ * to nothing. Recording copies one 16-byte record and never formats text,
+ * so tracing can stay enabled under load. Dump the ring with
+ * i2c_trace_export() and decode it offline with tools/i2c_trace_decode.c.
+ */
+#ifndef I2C_TRACE
+#define I2C_TRACE 0
+#endif
+
+/* Records kept, must be a power of two; older records are overwritten */
+#ifndef I2C_TRACE_CAPACITY
+#define I2C_TRACE_CAPACITY 256
+#endif
+
+/* Leading payload bytes captured per record */
+#define I2C_TRACE_DATA_BYTES 4
+
+typedef struct {
+    uint32_t timestamp; /* i2c_time_us() at completion */
+    uint8_t bus;
+    uint8_t bus_address;
+    uint8_t register_address;
+    uint8_t direction;  /* I2C_DIRECTION_READ or I2C_DIRECTION_WRITE */
+    uint16_t length;
+    uint8_t status;     /* status_t */
+    uint8_t data_length; /* Valid bytes in `data` */
+    uint8_t data[I2C_TRACE_DATA_BYTES];
+} i2c_trace_record_t;
+
+/*
+ * Export format, all fields little-endian:
+ *
+ *     header  "I2CT", version (1 byte), record size (1 byte),
+ *             record count (2 bytes), records dropped before the oldest
+ *             exported one (4 bytes)
+ *     records timestamp (4), bus, address, register, direction (1 each),
+ *             length (2), status, data length (1 each), data (4)
+ *
+ * Records are exported oldest first.
+ */
+#define I2C_TRACE_MAGIC        "I2CT"
+#define I2C_TRACE_VERSION      1
+#define I2C_TRACE_HEADER_SIZE  12
+#define I2C_TRACE_RECORD_SIZE  16
+
+#if I2C_TRACE
+
+void i2c_trace_segment(
+    uint8_t bus,
+    const i2c_msg_t *segment,
+    status_t status);
+
+#define I2C_TRACE_SEGMENT(bus, segment, status) \
+    i2c_trace_segment((bus), (segment), (status))
+
+#else
+
+#define I2C_TRACE_SEGMENT(bus, segment, status) ((void)0)
+
+#endif
+
+/* Discard all records */
+void i2c_trace_clear(void);
+
+/*
+ * Serialise the ring into `buffer`, newest records dropped first if it is
+ * too small. Returns the number of bytes written, or 0 if not even the
+ * header fits or tracing is compiled out.
+ */
+size_t i2c_trace_export(uint8_t *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1825 @@
+#include "lis3mdl.h"
+
+#include "i2c_stats.h"
+#include "lis3mdl_convert.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Convert output register pairs to host int16_t, little-endian unless BLE
+ * is set. Each word is read as bytes before it is written, so `bytes` may
+ * alias `words` for an in-place decode.
+ */
+static int16_t out16(const uint8_t *bytes, bool big_endian)
+{
+    return big_endian
+        ? (int16_t)(uint16_t)((bytes[0] << 8) | bytes[1])
+        : (int16_t)(uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static void decode_out16(
+    const uint8_t *bytes,
+    int16_t *words,
+    size_t count,
+    bool big_endian)
+{
+    for (size_t i = 0; i < count; ++i) {
+        words[i] = out16(&bytes[2 * i], big_endian);
+    }
+}
+
+/*
+ * Expand FAST_READ high bytes to int16_t with a zero low byte. The loop runs
+ * backwards so `bytes` may alias the start of `words`.
+ */
+static void expand_high_bytes(
+    const uint8_t *bytes,
+    int16_t *words,
+    size_t count)
+{
+    for (size_t i = count; i-- > 0;) {
+        words[i] = (int16_t)(uint16_t)(bytes[i] << 8);
+    }
+}
+
+/*
+ * Write `value` to a shadowed register and update the shadow on success.
+ * The write is elided when the register already holds `value`.
+ */
+static status_t write_shadowed(
+    lis3mdl_dev_t *dev,
+    uint8_t register_address,
+    uint8_t *shadow,
+    uint8_t value)
+{
+    if (*shadow == value) {
+        return STATUS_OK;
+    }
+
+    status_t status = i2c_bus_write(
+        dev->bus,
+        dev->bus_address,
+        register_address,
+        1,
+        &value);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    *shadow = value;
+    return STATUS_OK;
+}
+
+static uint8_t *ctrl_shadow(lis3mdl_dev_t *dev, uint8_t register_address)
+{
+    return &dev->shadow.ctrl[register_address - LIS3MDL_REG_CTRL_REG1];
+}
+
+static bool fast_read_enabled(lis3mdl_dev_t *dev)
+{
+    return (*ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG5)
+        & LIS3MDL_CTRL_REG5_FAST_READ) != 0;
+}
+
+static bool big_endian_output(lis3mdl_dev_t *dev)
+{
+    return (*ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG4)
+        & LIS3MDL_CTRL_REG4_BLE) != 0;
+}
+
+static void bind(lis3mdl_dev_t *dev, uint8_t bus, uint8_t bus_address)
+{
+    dev->bus = bus;
+    dev->bus_address = bus_address;
+    dev->transaction.status = STATUS_OK;
+    dev->acquisition = LIS3MDL_ACQUISITION_OFF;
+    dev->worst_read_us = 0;
+    dev->samples = 0;
+    dev->read_errors = 0;
+    dev->clock_ns = NULL;
+    dev->timing = NULL;
+    dev->sequence = 0;
+    dev->self_test_transaction.status = STATUS_OK;
+}
+
+status_t lis3mdl_init(
+    lis3mdl_dev_t *dev,
+    uint8_t bus_address)
+{
+    return lis3mdl_init_on_bus(dev, 0, bus_address);
+}
+
+status_t lis3mdl_init_on_bus(
+    lis3mdl_dev_t *dev,
+    uint8_t bus,
+    uint8_t bus_address)
+{
+    bind(dev, bus, bus_address);
+    return lis3mdl_resync(dev);
+}
+
+status_t lis3mdl_init_with_image(
+    lis3mdl_dev_t *dev,
+    uint8_t bus,
+    uint8_t bus_address,
+    const uint8_t image[LIS3MDL_CTRL_REG_COUNT])
+{
+    uint8_t ctrl[LIS3MDL_CTRL_REG_COUNT];
+    uint8_t int_window[4]; /* INT_CFG, INT_SRC, INT_THS_L, INT_THS_H */
+
+    for (size_t i = 0; i < LIS3MDL_CTRL_REG_COUNT; ++i) {
+        ctrl[i] = image[i];
+    }
+
+    bind(dev, bus, bus_address);
+
+    const i2c_msg_t msgs[] = {
+        {
+            .direction = I2C_DIRECTION_WRITE,
+            .bus_address = bus_address,
+            .register_address = LIS3MDL_REG_CTRL_REG1 | LIS3MDL_AUTO_INCREMENT,
+            .length = LIS3MDL_CTRL_REG_COUNT,
+            .buffer = ctrl,
+        },
+        {
+            .direction = I2C_DIRECTION_READ,
+            .bus_address = bus_address,
+            .register_address = LIS3MDL_REG_INT_CFG | LIS3MDL_AUTO_INCREMENT,
+            .length = sizeof(int_window),
+            .buffer = int_window,
+        },
+    };
+
+    status_t status = i2c_bus_transfer(
+        dev->bus,
+        msgs,
+        sizeof(msgs) / sizeof(msgs[0]));
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    for (size_t i = 0; i < LIS3MDL_CTRL_REG_COUNT; ++i) {
+        dev->shadow.ctrl[i] = ctrl[i];
+    }
+    dev->shadow.int_cfg = int_window[0];
+    dev->shadow.int_ths[0] = int_window[2];
+    dev->shadow.int_ths[1] = int_window[3];
+    return STATUS_OK;
+}
+
+status_t lis3mdl_resync(lis3mdl_dev_t *dev)
+{
+    lis3mdl_shadow_t shadow;
+    uint8_t int_window[4]; /* INT_CFG, INT_SRC, INT_THS_L, INT_THS_H */
+
+    /*
+     * Reading through INT_SRC clears a latched interrupt, which is what we
+     * want after a reset anyway, and keeps INT_CFG..INT_THS one segment.
+     */
+    const i2c_msg_t msgs[] = {
+        {
+            .direction = I2C_DIRECTION_READ,
+            .bus_address = dev->bus_address,
+            .register_address = LIS3MDL_REG_CTRL_REG1 | LIS3MDL_AUTO_INCREMENT,
+            .length = LIS3MDL_CTRL_REG_COUNT,
+            .buffer = shadow.ctrl,
+        },
+        {
+            .direction = I2C_DIRECTION_READ,
+            .bus_address = dev->bus_address,
+            .register_address = LIS3MDL_REG_INT_CFG | LIS3MDL_AUTO_INCREMENT,
+            .length = sizeof(int_window),
+            .buffer = int_window,
+        },
+    };
+
+    status_t status = i2c_bus_transfer(
+        dev->bus,
+        msgs,
+        sizeof(msgs) / sizeof(msgs[0]));
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    shadow.int_cfg = int_window[0];
+    shadow.int_ths[0] = int_window[2];
+    shadow.int_ths[1] = int_window[3];
+
+    dev->shadow = shadow;
+    return STATUS_OK;
+}
+
+/*
+ * Write the range of CTRL_REG1..CTRL_REG5 where `image` differs from the
+ * shadow as one auto-increment transaction, or nothing if it does not.
+ */
+static status_t write_ctrl_image(
+    lis3mdl_dev_t *dev,
+    const uint8_t image[LIS3MDL_CTRL_REG_COUNT])
+{
+    uint8_t ctrl[LIS3MDL_CTRL_REG_COUNT];
+    size_t first = 0;
+    size_t last = LIS3MDL_CTRL_REG_COUNT;
+
+    while (first < LIS3MDL_CTRL_REG_COUNT
+        && image[first] == dev->shadow.ctrl[first]) {
+        ++first;
+    }
+    if (first == LIS3MDL_CTRL_REG_COUNT) {
+        return STATUS_OK;
+    }
+    while (image[last - 1] == dev->shadow.ctrl[last - 1]) {
+        --last;
+    }
+    for (size_t i = first; i < last; ++i) {
+        ctrl[i] = image[i];
+    }
+
+    status_t status = i2c_bus_write(
+        dev->bus,
+        dev->bus_address,
+        (uint8_t)((LIS3MDL_REG_CTRL_REG1 + first) | LIS3MDL_AUTO_INCREMENT),
+        (uint16_t)(last - first),
+        &ctrl[first]);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    for (size_t i = first; i < last; ++i) {
+        dev->shadow.ctrl[i] = image[i];
+    }
+    return STATUS_OK;
+}
+
+/* CTRL_REG1..CTRL_REG5 after power-on, SOFT_RST or REBOOT */
+static const uint8_t power_on_ctrl[LIS3MDL_CTRL_REG_COUNT] = {
+    0x10, 0x00, 0x03, 0x00, 0x00,
+};
+
+static bool ctrl_equal(
+    const uint8_t *a,
+    const uint8_t *b)
+{
+    for (size_t i = 0; i < LIS3MDL_CTRL_REG_COUNT; ++i) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* FNV-1a over everything in the record but the hash itself */
+static uint32_t retained_hash(const lis3mdl_retained_t *retained)
+{
+    const uint8_t bytes[] = {
+        retained->bus,
+        retained->bus_address,
+        retained->shadow.ctrl[0],
+        retained->shadow.ctrl[1],
+        retained->shadow.ctrl[2],
+        retained->shadow.ctrl[3],
+        retained->shadow.ctrl[4],
+        retained->shadow.int_cfg,
+        retained->shadow.int_ths[0],
+        retained->shadow.int_ths[1],
+    };
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void lis3mdl_retain(
+    const lis3mdl_dev_t *dev,
+    lis3mdl_retained_t *retained)
+{
+    retained->bus = dev->bus;
+    retained->bus_address = dev->bus_address;
+    retained->shadow = dev->shadow;
+    retained->hash = retained_hash(retained);
+}
+
+/* Whether `retained` vouches for `image` on this device */
+static bool retained_valid(
+    const lis3mdl_dev_t *dev,
+    const uint8_t image[LIS3MDL_CTRL_REG_COUNT],
+    const lis3mdl_retained_t *retained)
+{
+    return retained != NULL
+        && retained->hash == retained_hash(retained)
+        && retained->bus == dev->bus
+        && retained->bus_address == dev->bus_address
+        && ctrl_equal(retained->shadow.ctrl, image)
+        && !ctrl_equal(image, power_on_ctrl);
+}
+
+status_t lis3mdl_warm_start(
+    lis3mdl_dev_t *dev,
+    uint8_t bus,
+    uint8_t bus_address,
+    const uint8_t image[LIS3MDL_CTRL_REG_COUNT],
+    const lis3mdl_retained_t *retained)
+{
+    uint8_t who_am_i;
+    uint8_t ctrl[LIS3MDL_CTRL_REG_COUNT];
+    uint8_t int_window[4]; /* INT_CFG, INT_SRC, INT_THS_L, INT_THS_H */
+    status_t status;
+
+    bind(dev, bus, bus_address);
+
+    if (retained_valid(dev, image, retained)) {
+        status = i2c_bus_read(
+            dev->bus,
+            dev->bus_address,
+            LIS3MDL_REG_CTRL_REG1 | LIS3MDL_AUTO_INCREMENT,
+            LIS3MDL_CTRL_REG_COUNT,
+            ctrl);
+        if (status != STATUS_OK) {
+            return status;
+        }
+        if (ctrl_equal(ctrl, image)) {
+            dev->shadow = retained->shadow;
+            return STATUS_OK;
+        }
+    }
+
+    const i2c_msg_t msgs[] = {
+        {
+            .direction = I2C_DIRECTION_READ,
+            .bus_address = bus_address,
+            .register_address = LIS3MDL_REG_WHO_AM_I,
+            .length = 1,
+            .buffer = &who_am_i,
+        },
+        {
+            .direction = I2C_DIRECTION_READ,
+            .bus_address = bus_address,
+            .register_address = LIS3MDL_REG_CTRL_REG1 | LIS3MDL_AUTO_INCREMENT,
+            .length = LIS3MDL_CTRL_REG_COUNT,
+            .buffer = ctrl,
+        },
+        {
+            .direction = I2C_DIRECTION_READ,
+            .bus_address = bus_address,
+            .register_address = LIS3MDL_REG_INT_CFG | LIS3MDL_AUTO_INCREMENT,
+            .length = sizeof(int_window),
+            .buffer = int_window,
+        },
+    };
+
+    status = i2c_bus_transfer(
+        dev->bus,
+        msgs,
+        sizeof(msgs) / sizeof(msgs[0]));
+    if (status != STATUS_OK) {
+        return status;
+    }
+    if (who_am_i != LIS3MDL_WHO_AM_I_VALUE) {
+        return STATUS_ERROR;
+    }
+
+    for (size_t i = 0; i < LIS3MDL_CTRL_REG_COUNT; ++i) {
+        dev->shadow.ctrl[i] = ctrl[i];
+    }
+    dev->shadow.int_cfg = int_window[0];
+    dev->shadow.int_ths[0] = int_window[2];
+    dev->shadow.int_ths[1] = int_window[3];
+
+    return write_ctrl_image(dev, image);
+}
+
+static uint8_t replace_bits(uint8_t value, uint8_t mask, uint8_t bits)
+{
+    return (uint8_t)((value & ~mask) | (bits & mask));
+}
+
+static uint8_t odr_bits(lis3mdl_odr_t odr)
+{
+    if (odr == LIS3MDL_ODR_FAST) {
+        return LIS3MDL_CTRL_REG1_FAST_ODR;
+    }
+    return (uint8_t)(odr << LIS3MDL_CTRL_REG1_DO_SHIFT);
+}
+
+static void encode_config(
+    const uint8_t current[LIS3MDL_CTRL_REG_COUNT],
+    const lis3mdl_config_t *config,
+    uint8_t image[LIS3MDL_CTRL_REG_COUNT])
+{
+    image[0] = replace_bits(
+        current[0],
+        LIS3MDL_CTRL_REG1_TEMP_EN | LIS3MDL_CTRL_REG1_OM_MASK
+            | LIS3MDL_CTRL_REG1_DO_MASK | LIS3MDL_CTRL_REG1_FAST_ODR,
+        (uint8_t)((config->temperature_enable ? LIS3MDL_CTRL_REG1_TEMP_EN : 0)
+            | (config->xy_mode << LIS3MDL_CTRL_REG1_OM_SHIFT)
+            | odr_bits(config->odr)));
+
+    /* REBOOT and SOFT_RST are commands, never part of a configuration */
+    image[1] = replace_bits(
+        current[1],
+        LIS3MDL_CTRL_REG2_FS_MASK | LIS3MDL_CTRL_REG2_REBOOT
+            | LIS3MDL_CTRL_REG2_SOFT_RST,
+        (uint8_t)(config->full_scale << LIS3MDL_CTRL_REG2_FS_SHIFT));
+
+    image[2] = replace_bits(
+        current[2],
+        LIS3MDL_CTRL_REG3_LP | LIS3MDL_CTRL_REG3_MD_MASK,
+        (uint8_t)((config->low_power ? LIS3MDL_CTRL_REG3_LP : 0)
+            | (config->measurement_mode << LIS3MDL_CTRL_REG3_MD_SHIFT)));
+
+    image[3] = replace_bits(
+        current[3],
+        LIS3MDL_CTRL_REG4_OMZ_MASK,
+        (uint8_t)(config->z_mode << LIS3MDL_CTRL_REG4_OMZ_SHIFT));
+
+    image[4] = replace_bits(
+        current[4],
+        LIS3MDL_CTRL_REG5_FAST_READ | LIS3MDL_CTRL_REG5_BDU,
+        (uint8_t)((config->fast_read ? LIS3MDL_CTRL_REG5_FAST_READ : 0)
+            | (config->block_data_update ? LIS3MDL_CTRL_REG5_BDU : 0)));
+}
+
+status_t lis3mdl_apply_config(
+    lis3mdl_dev_t *dev,
+    const lis3mdl_config_t *config)
+{
+    uint8_t image[LIS3MDL_CTRL_REG_COUNT];
+
+    if (config->odr > LIS3MDL_ODR_FAST
+        || config->full_scale > LIS3MDL_FULL_SCALE_16_GAUSS
+        || config->xy_mode > LIS3MDL_OP_MODE_ULTRA_HIGH_PERFORMANCE
+        || config->z_mode > LIS3MDL_OP_MODE_ULTRA_HIGH_PERFORMANCE
+        || config->measurement_mode > LIS3MDL_MEASUREMENT_POWER_DOWN) {
+        return STATUS_ERROR;
+    }
+
+    encode_config(dev->shadow.ctrl, config, image);
+    return write_ctrl_image(dev, image);
+}
+
+status_t lis3mdl_get_config(
+    lis3mdl_dev_t *dev,
+    lis3mdl_config_t *config)
+{
+    const uint8_t *ctrl = dev->shadow.ctrl;
+    uint8_t md =
+        (ctrl[2] & LIS3MDL_CTRL_REG3_MD_MASK) >> LIS3MDL_CTRL_REG3_MD_SHIFT;
+
+    lis3mdl_get_odr(dev, &config->odr);
+    lis3mdl_get_full_scale(dev, &config->full_scale);
+    config->xy_mode = (lis3mdl_op_mode_t)(
+        (ctrl[0] & LIS3MDL_CTRL_REG1_OM_MASK) >> LIS3MDL_CTRL_REG1_OM_SHIFT);
+    config->z_mode = (lis3mdl_op_mode_t)(
+        (ctrl[3] & LIS3MDL_CTRL_REG4_OMZ_MASK) >> LIS3MDL_CTRL_REG4_OMZ_SHIFT);
+    /* MD = 11 is power-down as well */
+    config->measurement_mode = md > LIS3MDL_MEASUREMENT_POWER_DOWN
+        ? LIS3MDL_MEASUREMENT_POWER_DOWN
+        : (lis3mdl_measurement_mode_t)md;
+    config->temperature_enable = (ctrl[0] & LIS3MDL_CTRL_REG1_TEMP_EN) != 0;
+    config->low_power = (ctrl[2] & LIS3MDL_CTRL_REG3_LP) != 0;
+    config->block_data_update = (ctrl[4] & LIS3MDL_CTRL_REG5_BDU) != 0;
+    config->fast_read = (ctrl[4] & LIS3MDL_CTRL_REG5_FAST_READ) != 0;
+    return STATUS_OK;
+}
+
+status_t lis3mdl_get_full_scale(
+    lis3mdl_dev_t *dev,
+    lis3mdl_full_scale_t *full_scale)
+{
+    uint8_t value = *ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG2);
+
+    *full_scale = (lis3mdl_full_scale_t)(
+        (value & LIS3MDL_CTRL_REG2_FS_MASK) >> LIS3MDL_CTRL_REG2_FS_SHIFT);
+    return STATUS_OK;
+}
+
+status_t lis3mdl_get_odr(
+    lis3mdl_dev_t *dev,
+    lis3mdl_odr_t *odr)
+{
+    uint8_t value = *ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG1);
+
+    if (value & LIS3MDL_CTRL_REG1_FAST_ODR) {
+        *odr = LIS3MDL_ODR_FAST;
+    } else {
+        *odr = (lis3mdl_odr_t)(
+            (value & LIS3MDL_CTRL_REG1_DO_MASK) >> LIS3MDL_CTRL_REG1_DO_SHIFT);
+    }
+    return STATUS_OK;
+}
+
+status_t lis3mdl_get_output_period_ns(
+    lis3mdl_dev_t *dev,
+    uint32_t *period_ns)
+{
+    /* Datasheet rates in mHz: DO settings, then FAST_ODR by OM */
+    static const uint32_t odr_mhz[] = {
+        625, 1250, 2500, 5000, 10000, 20000, 40000, 80000};
+    static const uint32_t fast_odr_mhz[] = {1000000, 560000, 300000, 155000};
+    const uint8_t *ctrl = dev->shadow.ctrl;
+    uint32_t mhz;
+
+    if ((ctrl[2] & LIS3MDL_CTRL_REG3_MD_MASK)
+        != LIS3MDL_MEASUREMENT_CONTINUOUS << LIS3MDL_CTRL_REG3_MD_SHIFT) {
+        *period_ns = 0;
+        return STATUS_OK;
+    }
+
+    if (ctrl[2] & LIS3MDL_CTRL_REG3_LP) {
+        mhz = odr_mhz[LIS3MDL_ODR_0_625_HZ];
+    } else if (ctrl[0] & LIS3MDL_CTRL_REG1_FAST_ODR) {
+        mhz = fast_odr_mhz[(ctrl[0] & LIS3MDL_CTRL_REG1_OM_MASK)
+                           >> LIS3MDL_CTRL_REG1_OM_SHIFT];
+    } else {
+        mhz = odr_mhz[(ctrl[0] & LIS3MDL_CTRL_REG1_DO_MASK)
+                      >> LIS3MDL_CTRL_REG1_DO_SHIFT];
+    }
+    *period_ns = (uint32_t)(1000000000000ull / mhz);
+    return STATUS_OK;
+}
+
+status_t lis3mdl_set_odr(
+    lis3mdl_dev_t *dev,
+    lis3mdl_odr_t odr)
+{
+    uint8_t *shadow = ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG1);
+
+    if (odr > LIS3MDL_ODR_FAST) {
+        return STATUS_ERROR;
+    }
+
+    return write_shadowed(
+        dev,
+        LIS3MDL_REG_CTRL_REG1,
+        shadow,
+        replace_bits(
+            *shadow,
+            LIS3MDL_CTRL_REG1_DO_MASK | LIS3MDL_CTRL_REG1_FAST_ODR,
+            odr_bits(odr)));
+}
+
+status_t lis3mdl_get_interrupt_enable(
+    lis3mdl_dev_t *dev,
+    bool *enabled)
+{
+    *enabled = (dev->shadow.int_cfg & LIS3MDL_INT_CFG_IEN) != 0;
+    return STATUS_OK;
+}
+
+status_t lis3mdl_set_interrupt_enable(
+    lis3mdl_dev_t *dev,
+    bool enabled)
+{
+    return write_shadowed(
+        dev,
+        LIS3MDL_REG_INT_CFG,
+        &dev->shadow.int_cfg,
+        replace_bits(
+            dev->shadow.int_cfg,
+            LIS3MDL_INT_CFG_IEN,
+            enabled ? LIS3MDL_INT_CFG_IEN : 0));
+}
+
+status_t lis3mdl_set_sampling(
+    lis3mdl_dev_t *dev,
+    lis3mdl_sampling_t sampling)
+{
+    uint8_t *shadow = ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG5);
+
+    uint8_t bits = 0;
+
+    switch (sampling) {
+    case LIS3MDL_SAMPLING_STANDARD:
+        break;
+    case LIS3MDL_SAMPLING_COHERENT:
+        bits = LIS3MDL_CTRL_REG5_BDU;
+        break;
+    case LIS3MDL_SAMPLING_FAST_READ:
+        bits = LIS3MDL_CTRL_REG5_FAST_READ;
+        break;
+    default:
+        return STATUS_ERROR;
+    }
+
+    return write_shadowed(
+        dev,
+        LIS3MDL_REG_CTRL_REG5,
+        shadow,
+        replace_bits(
+            *shadow,
+            LIS3MDL_CTRL_REG5_BDU | LIS3MDL_CTRL_REG5_FAST_READ,
+            bits));
+}
+
+status_t lis3mdl_get_sampling(
+    lis3mdl_dev_t *dev,
+    lis3mdl_sampling_t *sampling)
+{
+    uint8_t value = *ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG5);
+
+    if (value & LIS3MDL_CTRL_REG5_FAST_READ) {
+        *sampling = LIS3MDL_SAMPLING_FAST_READ;
+    } else if (value & LIS3MDL_CTRL_REG5_BDU) {
+        *sampling = LIS3MDL_SAMPLING_COHERENT;
+    } else {
+        *sampling = LIS3MDL_SAMPLING_STANDARD;
+    }
+    return STATUS_OK;
+}
+
+status_t lis3mdl_read_axis(
+    lis3mdl_dev_t *dev,
+    lis3mdl_axis_t axis,
+    int16_t *value)
+{
+    if (axis > LIS3MDL_AXIS_Z) {
+        return STATUS_ERROR;
+    }
+
+    status_t status = i2c_bus_read(
+        dev->bus,
+        dev->bus_address,
+        (uint8_t)((LIS3MDL_REG_OUT_X_L + 2 * axis) | LIS3MDL_AUTO_INCREMENT),
+        2,
+        (uint8_t *)value);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    decode_out16((const uint8_t *)value, value, 1, big_endian_output(dev));
+    return STATUS_OK;
+}
+
+status_t lis3mdl_read_xyz(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3])
+{
+    status_t status = i2c_bus_read(
+        dev->bus,
+        dev->bus_address,
+        LIS3MDL_REG_OUT_X_L | LIS3MDL_AUTO_INCREMENT,
+        6,
+        (uint8_t *)xyz);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    decode_out16((const uint8_t *)xyz, xyz, 3, big_endian_output(dev));
+    return STATUS_OK;
+}
+
+status_t lis3mdl_read_xyz_fast(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3])
+{
+    status_t status = lis3mdl_set_sampling(dev, LIS3MDL_SAMPLING_FAST_READ);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    status = i2c_bus_read(
+        dev->bus,
+        dev->bus_address,
+        LIS3MDL_REG_OUT_X_H | LIS3MDL_AUTO_INCREMENT,
+        3,
+        (uint8_t *)xyz);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    expand_high_bytes((const uint8_t *)xyz, xyz, 3);
+    return STATUS_OK;
+}
+
+static void read_xyz_complete(i2c_transaction_t *transaction)
+{
+    lis3mdl_dev_t *dev = transaction->context;
+    int16_t *xyz = (int16_t *)transaction->buffer;
+
+    if (transaction->status == STATUS_OK) {
+        if (transaction->length == 3) {
+            expand_high_bytes((const uint8_t *)xyz, xyz, 3);
+        } else {
+            decode_out16(
+                (const uint8_t *)xyz,
+                xyz,
+                3,
+                big_endian_output(dev));
+        }
+        dev->samples++;
+    } else {
+        dev->read_errors++;
+    }
+    if (dev->xyz_callback != NULL) {
+        dev->xyz_callback(dev, transaction->status, xyz, dev->xyz_context);
+    }
+}
+
+status_t lis3mdl_read_xyz_async(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3],
+    lis3mdl_xyz_callback_t callback,
+    void *context)
+{
+    i2c_transaction_t *transaction = &dev->transaction;
+
+    if (transaction->status == STATUS_PENDING) {
+        return STATUS_BUSY;
+    }
+
+    dev->xyz_callback = callback;
+    dev->xyz_context = context;
+
+    transaction->bus = dev->bus;
+    transaction->bus_address = dev->bus_address;
+    if (fast_read_enabled(dev)) {
+        transaction->register_address =
+            LIS3MDL_REG_OUT_X_H | LIS3MDL_AUTO_INCREMENT;
+        transaction->length = 3;
+    } else {
+        transaction->register_address =
+            LIS3MDL_REG_OUT_X_L | LIS3MDL_AUTO_INCREMENT;
+        transaction->length = 6;
+    }
+    transaction->buffer = (uint8_t *)xyz;
+    transaction->callback = read_xyz_complete;
+    transaction->context = dev;
+
+    return i2c_read_async(transaction);
+}
+
+/* Restart the output clock fit from the rate the shadow is set to */
+static void restart_timing(lis3mdl_dev_t *dev)
+{
+    uint32_t period_ns;
+
+    dev->timing_ctrl[0] =
+        (uint8_t)(dev->shadow.ctrl[0] & ~LIS3MDL_CTRL_REG1_ST);
+    dev->timing_ctrl[1] = (uint8_t)(dev->shadow.ctrl[2]
+        & (LIS3MDL_CTRL_REG3_LP | LIS3MDL_CTRL_REG3_MD_MASK));
+    lis3mdl_get_output_period_ns(dev, &period_ns);
+    lis3mdl_timing_restart(dev->timing, period_ns);
+}
+
+void lis3mdl_set_timing(
+    lis3mdl_dev_t *dev,
+    lis3mdl_clock_ns_t clock,
+    lis3mdl_timing_t *timing)
+{
+    dev->timing = NULL;
+    if (timing == NULL || clock == NULL) {
+        return;
+    }
+
+    lis3mdl_timing_init(timing, 0);
+    dev->clock_ns = clock;
+    dev->timing = timing;
+    restart_timing(dev);
+}
+
+static void self_test_complete(i2c_transaction_t *transaction)
+{
+    lis3mdl_dev_t *dev = transaction->context;
+    uint32_t sequence = dev->sequence;
+
+    if (transaction->status == STATUS_OK) {
+        *ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG1) = dev->self_test_ctrl1;
+    }
+    if (dev->self_test_callback != NULL) {
+        dev->self_test_callback(
+            dev,
+            transaction->status,
+            sequence,
+            dev->self_test_context);
+    }
+}
+
+status_t lis3mdl_set_self_test_async(
+    lis3mdl_dev_t *dev,
+    bool enable,
+    lis3mdl_self_test_callback_t callback,
+    void *context)
+{
+    i2c_transaction_t *transaction = &dev->self_test_transaction;
+    uint8_t ctrl1 = *ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG1);
+
+    if (transaction->status == STATUS_PENDING) {
+        return STATUS_BUSY;
+    }
+
+    dev->self_test_ctrl1 = replace_bits(
+        ctrl1,
+        LIS3MDL_CTRL_REG1_ST,
+        enable ? LIS3MDL_CTRL_REG1_ST : 0);
+    if (dev->self_test_ctrl1 == ctrl1) {
+        if (callback != NULL) {
+            callback(dev, STATUS_OK, dev->sequence, context);
+        }
+        return STATUS_OK;
+    }
+
+    dev->self_test_callback = callback;
+    dev->self_test_context = context;
+
+    transaction->bus = dev->bus;
+    transaction->bus_address = dev->bus_address;
+    transaction->register_address = LIS3MDL_REG_CTRL_REG1;
+    transaction->length = 1;
+    transaction->buffer = &dev->self_test_ctrl1;
+    transaction->callback = self_test_complete;
+    transaction->context = dev;
+
+    return i2c_write_async(transaction);
+}
+
+static status_t configure_acquisition(lis3mdl_dev_t *dev, int16_t xyz[3])
+{
+    uint8_t *shadow = ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG3);
+
+    status_t status = write_shadowed(
+        dev,
+        LIS3MDL_REG_CTRL_REG3,
+        shadow,
+        replace_bits(
+            *shadow,
+            LIS3MDL_CTRL_REG3_MD_MASK,
+            LIS3MDL_MEASUREMENT_CONTINUOUS << LIS3MDL_CTRL_REG3_MD_SHIFT));
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    dev->overruns = (lis3mdl_overruns_t){0};
+    dev->sequence = UINT32_MAX; /* The first sample is numbered 0 */
+    dev->rx_active = 0;
+    dev->ready_pending = false;
+    dev->batch_stamped = false;
+    dev->batch_length = 0;
+    if (dev->timing != NULL) {
+        restart_timing(dev);
+    }
+
+    /*
+     * DRDY stays high until the output registers are read, so a sample
+     * produced before the ISR was armed would otherwise never raise an edge.
+     */
+    if (fast_read_enabled(dev)) {
+        return lis3mdl_read_xyz_fast(dev, xyz);
+    }
+    return lis3mdl_read_xyz(dev, xyz);
+}
+
+/*
+ * Common set-up for the acquisition modes; see lis3mdl_start_acquisition.
+ * The bus is held so the mode change and the priming read are not split
+ * by another task.
+ */
+static status_t arm_acquisition(lis3mdl_dev_t *dev, int16_t xyz[3])
+{
+    status_t status = i2c_bus_acquire(dev->bus);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    status = configure_acquisition(dev, xyz);
+    i2c_bus_release(dev->bus);
+    return status;
+}
+
+status_t lis3mdl_start_acquisition(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3],
+    lis3mdl_xyz_callback_t callback,
+    void *context)
+{
+    status_t status = arm_acquisition(dev, xyz);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    dev->acquisition_buffer = xyz;
+    dev->xyz_callback = callback;
+    dev->xyz_context = context;
+    dev->acquisition = LIS3MDL_ACQUISITION_CALLBACK;
+    return STATUS_OK;
+}
+
+status_t lis3mdl_start_ring_acquisition(
+    lis3mdl_dev_t *dev,
+    lis3mdl_clock_t clock)
+{
+    int16_t discard[3];
+
+    status_t status = arm_acquisition(dev, discard);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    lis3mdl_ring_reset(&dev->ring);
+    dev->clock = clock;
+    dev->acquisition = LIS3MDL_ACQUISITION_RING;
+    return STATUS_OK;
+}
+
+status_t lis3mdl_start_soa_acquisition(
+    lis3mdl_dev_t *dev,
+    lis3mdl_soa_buffer_t *buffer,
+    lis3mdl_clock_t clock)
+{
+    int16_t discard[3];
+
+    status_t status = arm_acquisition(dev, discard);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    lis3mdl_soa_reset(buffer);
+    dev->soa_buffer = buffer;
+    dev->clock = clock;
+    dev->acquisition = LIS3MDL_ACQUISITION_SOA;
+    return STATUS_OK;
+}
+
+void lis3mdl_stop_acquisition(lis3mdl_dev_t *dev)
+{
+    dev->acquisition = LIS3MDL_ACQUISITION_OFF;
+}
+
+void lis3mdl_get_overruns(
+    lis3mdl_dev_t *dev,
+    lis3mdl_overruns_t *overruns)
+{
+    *overruns = dev->overruns;
+}
+
+/* Decode the sample in `buffer` straight into its destination */
+static void decode_sample(
+    const lis3mdl_rx_buffer_t *buffer,
+    bool fast,
+    bool big_endian,
+    int16_t *x,
+    int16_t *y,
+    int16_t *z,
+    uint16_t *sequence,
+    uint32_t *timestamp)
+{
+    const uint8_t *bytes = buffer->bytes;
+
+    if (fast) {
+        *x = (int16_t)(uint16_t)(bytes[2] << 8);
+        *y = (int16_t)(uint16_t)(bytes[3] << 8);
+        *z = (int16_t)(uint16_t)(bytes[4] << 8);
+    } else {
+        *x = out16(&bytes[2], big_endian);
+        *y = out16(&bytes[4], big_endian);
+        *z = out16(&bytes[6], big_endian);
+    }
+    *sequence = (uint16_t)buffer->sequence;
+    *timestamp = buffer->timestamp;
+}
+
+void lis3mdl_get_stats(
+    lis3mdl_dev_t *dev,
+    lis3mdl_stats_t *stats)
+{
+    i2c_get_address_stats(
+        dev->bus,
+        dev->bus_address,
+        &stats->segments,
+        &stats->bytes);
+    stats->samples = dev->samples;
+    stats->read_errors = dev->read_errors;
+    stats->worst_read_us = dev->worst_read_us;
+}
+
+static void sample_read_complete(i2c_transaction_t *transaction);
+
+/* Timestamp a data-ready into `buffer` and number its conversion */
+static void stamp_data_ready(
+    lis3mdl_dev_t *dev,
+    lis3mdl_rx_buffer_t *buffer)
+{
+    dev->data_ready_timestamp = dev->clock != NULL ? dev->clock() : 0;
+
+    if (dev->timing == NULL) {
+        dev->sequence++;
+    } else {
+        if ((dev->shadow.ctrl[0] & ~LIS3MDL_CTRL_REG1_ST)
+                != dev->timing_ctrl[0]
+            || (dev->shadow.ctrl[2]
+                   & (LIS3MDL_CTRL_REG3_LP | LIS3MDL_CTRL_REG3_MD_MASK))
+                != dev->timing_ctrl[1]) {
+            restart_timing(dev);
+        }
+        dev->sequence = lis3mdl_timing_update(dev->timing, dev->clock_ns());
+    }
+
+    buffer->timestamp = dev->data_ready_timestamp;
+    buffer->sequence = dev->sequence;
+}
+
+static status_t submit_sample_read(
+    lis3mdl_dev_t *dev,
+    lis3mdl_rx_buffer_t *buffer)
+{
+    i2c_transaction_t *transaction = &dev->transaction;
+
+    transaction->bus = dev->bus;
+    transaction->bus_address = dev->bus_address;
+    if (fast_read_enabled(dev)) {
+        transaction->register_address =
+            LIS3MDL_REG_OUT_X_H | LIS3MDL_AUTO_INCREMENT;
+        transaction->length = 3;
+        transaction->buffer = &buffer->bytes[2];
+    } else {
+        transaction->register_address =
+            LIS3MDL_REG_STATUS_REG | LIS3MDL_AUTO_INCREMENT;
+        transaction->length = 7;
+        transaction->buffer = &buffer->bytes[1];
+    }
+    transaction->callback = sample_read_complete;
+    transaction->context = dev;
+
+    return i2c_read_async(transaction);
+}
+
+static bool acquiring_samples(lis3mdl_dev_t *dev)
+{
+    return dev->acquisition == LIS3MDL_ACQUISITION_RING
+        || dev->acquisition == LIS3MDL_ACQUISITION_SOA;
+}
+
+/* Start the read of a data-ready that arrived while the buffer was busy */
+static void start_deferred_read(lis3mdl_dev_t *dev)
+{
+    if (!dev->ready_pending) {
+        return;
+    }
+
+    dev->ready_pending = false;
+    dev->rx_active ^= 1;
+    if (acquiring_samples(dev)
+        && submit_sample_read(dev, &dev->rx_buffers[dev->rx_active])
+            != STATUS_OK) {
+        dev->overruns.missed_data_ready++;
+    }
+}
+
+/*
+ * Produce the sample in `done` into the ring or SoA buffer. `status` points
+ * at the STATUS_REG byte read with it, if any.
+ */
+static void deliver_sample(
+    lis3mdl_dev_t *dev,
+    const lis3mdl_rx_buffer_t *done,
+    bool fast,
+    const uint8_t *status)
+{
+    if (status != NULL) {
+        if (*status & LIS3MDL_STATUS_ZYXOR) {
+            dev->overruns.sensor_overruns++;
+        }
+        /* A deferred or polled read can find no new sample */
+        if (!(*status & LIS3MDL_STATUS_ZYXDA)) {
+            return;
+        }
+    }
+
+    bool big_endian = big_endian_output(dev);
+
+    if (dev->acquisition == LIS3MDL_ACQUISITION_SOA) {
+        size_t index;
+        lis3mdl_soa_block_t *block =
+            lis3mdl_soa_reserve(dev->soa_buffer, &index);
+        if (block == NULL) {
+            dev->overruns.ring_full++;
+            return;
+        }
+
+        decode_sample(
+            done,
+            fast,
+            big_endian,
+            &block->x[index],
+            &block->y[index],
+            &block->z[index],
+            &block->sequence[index],
+            &block->timestamp[index]);
+        lis3mdl_soa_commit(dev->soa_buffer);
+        dev->samples++;
+    } else {
+        lis3mdl_sample_t *slot = lis3mdl_ring_reserve(&dev->ring);
+        if (slot == NULL) {
+            dev->overruns.ring_full++;
+            return;
+        }
+
+        decode_sample(
+            done,
+            fast,
+            big_endian,
+            &slot->x,
+            &slot->y,
+            &slot->z,
+            &slot->sequence,
+            &slot->timestamp);
+        lis3mdl_ring_commit(&dev->ring);
+        dev->samples++;
+    }
+}
+
+static void sample_read_complete(i2c_transaction_t *transaction)
+{
+    lis3mdl_dev_t *dev = transaction->context;
+    const lis3mdl_rx_buffer_t *done = &dev->rx_buffers[dev->rx_active];
+    status_t status = transaction->status;
+    bool fast = transaction->length == 3;
+
+    /* Keep the bus busy: the deferred read goes out before this decode */
+    start_deferred_read(dev);
+
+    if (status != STATUS_OK) {
+        dev->read_errors++;
+        return;
+    }
+    deliver_sample(dev, done, fast, fast ? NULL : &done->bytes[1]);
+}
+
+static status_t read_sample(lis3mdl_dev_t *dev)
+{
+    if (dev->transaction.status == STATUS_PENDING || dev->batch_length != 0) {
+        if (dev->ready_pending) {
+            return STATUS_BUSY;
+        }
+        stamp_data_ready(dev, &dev->rx_buffers[dev->rx_active ^ 1]);
+        dev->ready_pending = true;
+        return STATUS_OK;
+    }
+
+    stamp_data_ready(dev, &dev->rx_buffers[dev->rx_active]);
+    return submit_sample_read(dev, &dev->rx_buffers[dev->rx_active]);
+}
+
+void lis3mdl_batch_data_ready(lis3mdl_dev_t *dev)
+{
+    lis3mdl_rx_buffer_t *buffer = &dev->rx_buffers[dev->rx_active];
+
+    if (dev->batch_stamped) {
+        dev->overruns.missed_data_ready++;
+        return;
+    }
+    /* The chain in flight reads into the active buffer: stamp the other */
+    if (dev->batch_length != 0) {
+        if (dev->ready_pending) {
+            dev->overruns.missed_data_ready++;
+            return;
+        }
+        buffer = &dev->rx_buffers[dev->rx_active ^ 1];
+        dev->ready_pending = true;
+    }
+    stamp_data_ready(dev, buffer);
+    dev->batch_stamped = true;
+}
+
+status_t lis3mdl_batch_prepare(
+    lis3mdl_dev_t *dev,
+    i2c_msg_t *msg)
+{
+    lis3mdl_rx_buffer_t *buffer = &dev->rx_buffers[dev->rx_active];
+
+    if (!acquiring_samples(dev)) {
+        return STATUS_ERROR;
+    }
+    if (dev->transaction.status == STATUS_PENDING || dev->batch_length != 0) {
+        return STATUS_BUSY;
+    }
+
+    if (!dev->batch_stamped) {
+        stamp_data_ready(dev, buffer);
+    }
+    dev->batch_stamped = false;
+
+    /*
+     * FAST_READ only skips the low bytes after OUT_X_H, so its window is
+     * STATUS_REG, OUT_X_L and the three high bytes, read into bytes[0..4]
+     * to leave the high bytes where the FAST_READ decode expects them.
+     */
+    bool fast = fast_read_enabled(dev);
+    dev->batch_length = fast ? 5 : 7;
+    *msg = (i2c_msg_t){
+        .direction = I2C_DIRECTION_READ,
+        .bus_address = dev->bus_address,
+        .register_address = LIS3MDL_REG_STATUS_REG | LIS3MDL_AUTO_INCREMENT,
+        .length = dev->batch_length,
+        .buffer = &buffer->bytes[fast ? 0 : 1],
+    };
+    return STATUS_OK;
+}
+
+void lis3mdl_batch_complete(
+    lis3mdl_dev_t *dev,
+    status_t status)
+{
+    const lis3mdl_rx_buffer_t *done = &dev->rx_buffers[dev->rx_active];
+    bool fast = dev->batch_length == 5;
+
+    if (dev->batch_length == 0) {
+        return;
+    }
+    dev->batch_length = 0;
+    if (dev->ready_pending && dev->batch_stamped) {
+        /* Stamped during the chain: the next chain reads the other buffer */
+        dev->ready_pending = false;
+        dev->rx_active ^= 1;
+    } else {
+        start_deferred_read(dev);
+    }
+
+    if (status != STATUS_OK) {
+        dev->read_errors++;
+        return;
+    }
+    deliver_sample(dev, done, fast, &done->bytes[fast ? 0 : 1]);
+}
+
+void lis3mdl_batch_cancel(lis3mdl_dev_t *dev)
+{
+    if (dev->batch_length == 0) {
+        return;
+    }
+    dev->batch_length = 0;
+    if (dev->ready_pending && dev->batch_stamped) {
+        /* Two stamps, one sample left in the device: keep the newer */
+        dev->ready_pending = false;
+        dev->rx_active ^= 1;
+        dev->overruns.missed_data_ready++;
+    } else {
+        start_deferred_read(dev);
+    }
+    dev->batch_stamped = true;
+}
+
+static void trigger_complete(i2c_transaction_t *transaction)
+{
+    lis3mdl_dev_t *dev = transaction->context;
+    status_t status = transaction->status;
+
+    if (status != STATUS_OK) {
+        dev->read_errors++;
+        if (transaction->msgs[transaction->msg_count - 1].direction
+            == I2C_DIRECTION_WRITE) {
+            dev->converting = false;
+        }
+    }
+    if (transaction->msgs[0].direction != I2C_DIRECTION_READ) {
+        return;
+    }
+
+    lis3mdl_triggered_sample_t result = {
+        .sample.timestamp = dev->read_triggered_at,
+        .conversion_us = dev->read_conversion_us,
+    };
+
+    if (status == STATUS_OK && !(dev->rx[1] & LIS3MDL_STATUS_ZYXDA)) {
+        status = STATUS_BUSY; /* Read before the conversion finished */
+    }
+    if (status == STATUS_OK) {
+        bool big_endian = big_endian_output(dev);
+
+        result.sample.x = out16(&dev->rx[2], big_endian);
+        result.sample.y = out16(&dev->rx[4], big_endian);
+        result.sample.z = out16(&dev->rx[6], big_endian);
+        dev->samples++;
+    }
+    result.latency_us =
+        (dev->clock != NULL ? dev->clock() : 0) - dev->read_triggered_at;
+
+    if (dev->trigger_callback != NULL) {
+        dev->trigger_callback(dev, status, &result, dev->trigger_context);
+    }
+}
+
+/* Queue the STATUS_REG..OUT_Z_H read of a finished conversion as msgs[0] */
+static i2c_msg_t *claim_result(lis3mdl_dev_t *dev)
+{
+    dev->read_triggered_at = dev->triggered_at;
+    dev->read_conversion_us =
+        dev->drdy_seen ? dev->drdy_at - dev->triggered_at : 0;
+    dev->converting = false;
+
+    dev->msgs[0] = (i2c_msg_t){
+        .direction = I2C_DIRECTION_READ,
+        .bus_address = dev->bus_address,
+        .register_address = LIS3MDL_REG_STATUS_REG | LIS3MDL_AUTO_INCREMENT,
+        .length = 7,
+        .buffer = &dev->rx[1],
+    };
+    return &dev->msgs[0];
+}
+
+static status_t submit_trigger_chain(
+    lis3mdl_dev_t *dev,
+    size_t count)
+{
+    i2c_transaction_t *transaction = &dev->transaction;
+
+    transaction->bus = dev->bus;
+    transaction->msgs = dev->msgs;
+    transaction->msg_count = count;
+    transaction->callback = trigger_complete;
+    transaction->context = dev;
+    return i2c_transfer_async(transaction);
+}
+
+static status_t read_triggered(lis3mdl_dev_t *dev)
+{
+    if (dev->transaction.status == STATUS_PENDING) {
+        return STATUS_BUSY;
+    }
+
+    claim_result(dev);
+    return submit_trigger_chain(dev, 1);
+}
+
+void lis3mdl_on_data_ready(lis3mdl_dev_t *dev)
+{
+    status_t status;
+
+    switch (dev->acquisition) {
+    case LIS3MDL_ACQUISITION_CALLBACK:
+        status = lis3mdl_read_xyz_async(
+            dev,
+            dev->acquisition_buffer,
+            dev->xyz_callback,
+            dev->xyz_context);
+        break;
+    case LIS3MDL_ACQUISITION_RING:
+    case LIS3MDL_ACQUISITION_SOA:
+        status = read_sample(dev);
+        break;
+    case LIS3MDL_ACQUISITION_TRIGGERED:
+        dev->drdy_at = dev->clock != NULL ? dev->clock() : 0;
+        dev->drdy_seen = true;
+        if (dev->pipelined || !dev->converting) {
+            return;
+        }
+        status = read_triggered(dev);
+        break;
+    default:
+        return;
+    }
+
+    if (status != STATUS_OK) {
+        dev->overruns.missed_data_ready++;
+    }
+}
+
+/* Polls of STATUS_REG per sample before lis3mdl_capture_window gives up */
+#define CAPTURE_POLL_LIMIT 4096
+
+status_t lis3mdl_set_interrupt_threshold(
+    lis3mdl_dev_t *dev,
+    float threshold_gauss)
+{
+    lis3mdl_full_scale_t full_scale;
+    float lsb;
+    uint16_t threshold;
+
+    lis3mdl_get_full_scale(dev, &full_scale);
+    lsb = threshold_gauss * (float)lis3mdl_lsb_per_gauss(full_scale);
+    if (!(lsb >= 0.0f)) {
+        return STATUS_ERROR;
+    }
+    threshold = lsb >= (float)LIS3MDL_INT_THS_MAX
+        ? LIS3MDL_INT_THS_MAX
+        : (uint16_t)(lsb + 0.5f);
+
+    uint8_t value[2] = {(uint8_t)threshold, (uint8_t)(threshold >> 8)};
+    if (value[0] == dev->shadow.int_ths[0]
+        && value[1] == dev->shadow.int_ths[1]) {
+        return STATUS_OK;
+    }
+
+    status_t status = i2c_bus_write(
+        dev->bus,
+        dev->bus_address,
+        LIS3MDL_REG_INT_THS_L | LIS3MDL_AUTO_INCREMENT,
+        2,
+        value);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    dev->shadow.int_ths[0] = value[0];
+    dev->shadow.int_ths[1] = value[1];
+    return STATUS_OK;
+}
+
+status_t lis3mdl_set_offset(
+    lis3mdl_dev_t *dev,
+    const int16_t offset[3])
+{
+    uint8_t value[6];
+
+    for (size_t axis = 0; axis < 3; ++axis) {
+        value[2 * axis] = (uint8_t)(uint16_t)offset[axis];
+        value[2 * axis + 1] = (uint8_t)((uint16_t)offset[axis] >> 8);
+    }
+
+    return i2c_bus_write(
+        dev->bus,
+        dev->bus_address,
+        LIS3MDL_REG_OFFSET_X_L | LIS3MDL_AUTO_INCREMENT,
+        sizeof(value),
+        value);
+}
+
+/* Low-power continuous conversion, threshold and INT_CFG from dev->wake */
+static status_t configure_wake(lis3mdl_dev_t *dev)
+{
+    const lis3mdl_wake_config_t *wake = &dev->wake;
+    lis3mdl_config_t config;
+    uint8_t source;
+
+    lis3mdl_get_config(dev, &config);
+    config.odr = wake->odr;
+    config.xy_mode = LIS3MDL_OP_MODE_LOW_POWER;
+    config.z_mode = LIS3MDL_OP_MODE_LOW_POWER;
+    config.measurement_mode = LIS3MDL_MEASUREMENT_CONTINUOUS;
+
+    status_t status = lis3mdl_apply_config(dev, &config);
+    if (status == STATUS_OK) {
+        status = lis3mdl_set_interrupt_threshold(dev, wake->threshold_gauss);
+    }
+    if (status == STATUS_OK) {
+        status = write_shadowed(
+            dev,
+            LIS3MDL_REG_INT_CFG,
+            &dev->shadow.int_cfg,
+            (uint8_t)(wake->axes | LIS3MDL_INT_CFG_FIXED
+                | (wake->active_high ? LIS3MDL_INT_CFG_IEA : 0)
+                | (wake->latched ? LIS3MDL_INT_CFG_LIR : 0)
+                | LIS3MDL_INT_CFG_IEN));
+    }
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    /* Clear a latched interrupt so the next crossing raises a fresh edge */
+    return i2c_bus_read(
+        dev->bus,
+        dev->bus_address,
+        LIS3MDL_REG_INT_SRC,
+        1,
+        &source);
+}
+
+static status_t arm_wake(lis3mdl_dev_t *dev)
+{
+    status_t status = i2c_bus_acquire(dev->bus);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    status = configure_wake(dev);
+    i2c_bus_release(dev->bus);
+    return status;
+}
+
+status_t lis3mdl_start_wake(
+    lis3mdl_dev_t *dev,
+    const lis3mdl_wake_config_t *config,
+    lis3mdl_clock_t clock,
+    lis3mdl_wake_callback_t callback,
+    void *context)
+{
+    const uint8_t axes =
+        LIS3MDL_INT_CFG_XIEN | LIS3MDL_INT_CFG_YIEN | LIS3MDL_INT_CFG_ZIEN;
+
+    if (config->axes == 0 || (config->axes & ~axes)
+        || config->odr > LIS3MDL_ODR_FAST
+        || config->capture_odr > LIS3MDL_ODR_FAST
+        || config->capture_mode > LIS3MDL_OP_MODE_ULTRA_HIGH_PERFORMANCE) {
+        return STATUS_ERROR;
+    }
+    if (dev->acquisition != LIS3MDL_ACQUISITION_OFF) {
+        return STATUS_BUSY;
+    }
+
+    dev->wake = *config;
+    status_t status = arm_wake(dev);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    dev->overruns = (lis3mdl_overruns_t){0};
+    dev->clock = clock;
+    dev->wake_callback = callback;
+    dev->wake_context = context;
+    dev->acquisition = LIS3MDL_ACQUISITION_WAKE;
+    return STATUS_OK;
+}
+
+static void wake_read_complete(i2c_transaction_t *transaction)
+{
+    lis3mdl_dev_t *dev = transaction->context;
+    lis3mdl_wake_event_t event = {
+        .source = dev->rx[0],
+        .status = dev->rx[1],
+        .timestamp = dev->data_ready_timestamp,
+    };
+
+    if (transaction->status == STATUS_OK) {
+        decode_out16(&dev->rx[2], event.xyz, 3, big_endian_output(dev));
+    } else {
+        dev->read_errors++;
+    }
+    if (dev->wake_callback != NULL) {
+        dev->wake_callback(dev, transaction->status, &event, dev->wake_context);
+    }
+}
+
+void lis3mdl_on_interrupt(lis3mdl_dev_t *dev)
+{
+    i2c_transaction_t *transaction = &dev->transaction;
+
+    if (dev->acquisition != LIS3MDL_ACQUISITION_WAKE) {
+        return;
+    }
+    if (transaction->status == STATUS_PENDING) {
+        dev->overruns.missed_data_ready++;
+        return;
+    }
+
+    dev->data_ready_timestamp = dev->clock != NULL ? dev->clock() : 0;
+
+    dev->msgs[0] = (i2c_msg_t){
+        .direction = I2C_DIRECTION_READ,
+        .bus_address = dev->bus_address,
+        .register_address = LIS3MDL_REG_STATUS_REG | LIS3MDL_AUTO_INCREMENT,
+        .length = 7,
+        .buffer = &dev->rx[1],
+    };
+    dev->msgs[1] = (i2c_msg_t){
+        .direction = I2C_DIRECTION_READ,
+        .bus_address = dev->bus_address,
+        .register_address = LIS3MDL_REG_INT_SRC,
+        .length = 1,
+        .buffer = &dev->rx[0],
+    };
+
+    transaction->bus = dev->bus;
+    transaction->msgs = dev->msgs;
+    transaction->msg_count = 2;
+    transaction->callback = wake_read_complete;
+    transaction->context = dev;
+
+    if (i2c_transfer_async(transaction) != STATUS_OK) {
+        dev->overruns.missed_data_ready++;
+    }
+}
+
+static status_t capture_samples(
+    lis3mdl_dev_t *dev,
+    lis3mdl_sample_t *samples,
+    size_t count)
+{
+    bool big_endian = big_endian_output(dev);
+    status_t status = STATUS_OK;
+
+    for (size_t i = 0; i < count && status == STATUS_OK; ++i) {
+        uint8_t window[7]; /* STATUS_REG, OUT_X_L..OUT_Z_H */
+        uint32_t polls = 0;
+
+        do {
+            if (++polls > CAPTURE_POLL_LIMIT) {
+                return STATUS_TIMEOUT;
+            }
+            status = i2c_bus_read(
+                dev->bus,
+                dev->bus_address,
+                LIS3MDL_REG_STATUS_REG | LIS3MDL_AUTO_INCREMENT,
+                sizeof(window),
+                window);
+        } while (status == STATUS_OK && !(window[0] & LIS3MDL_STATUS_ZYXDA));
+
+        if (status == STATUS_OK) {
+            samples[i].x = out16(&window[1], big_endian);
+            samples[i].y = out16(&window[3], big_endian);
+            samples[i].z = out16(&window[5], big_endian);
+            samples[i].sequence = (uint16_t)i;
+            samples[i].timestamp = dev->clock != NULL ? dev->clock() : 0;
+        }
+    }
+    return status;
+}
+
+status_t lis3mdl_capture_window(
+    lis3mdl_dev_t *dev,
+    lis3mdl_sample_t *samples,
+    size_t count)
+{
+    lis3mdl_config_t saved;
+    lis3mdl_config_t config;
+
+    if (dev->acquisition != LIS3MDL_ACQUISITION_WAKE) {
+        return STATUS_ERROR;
+    }
+
+    status_t status = i2c_bus_acquire(dev->bus);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    /* Interrupts raised by the capture itself are not events */
+    dev->acquisition = LIS3MDL_ACQUISITION_OFF;
+
+    lis3mdl_get_config(dev, &saved);
+    config = saved;
+    config.odr = dev->wake.capture_odr;
+    config.xy_mode = dev->wake.capture_mode;
+    config.z_mode = dev->wake.capture_mode;
+    config.block_data_update = true;
+    config.fast_read = false;
+
+    status = lis3mdl_apply_config(dev, &config);
+    if (status == STATUS_OK) {
+        status = capture_samples(dev, samples, count);
+    }
+
+    status_t restore = lis3mdl_apply_config(dev, &saved);
+    if (restore == STATUS_OK) {
+        restore = configure_wake(dev);
+    }
+    i2c_bus_release(dev->bus);
+
+    if (restore == STATUS_OK) {
+        dev->acquisition = LIS3MDL_ACQUISITION_WAKE;
+    }
+    return status != STATUS_OK ? status : restore;
+}
+
+/* Single-conversion mode is only defined at the DO rates, up to 80 Hz */
+static bool single_conversion_allowed(lis3mdl_dev_t *dev)
+{
+    return !(*ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG1)
+             & LIS3MDL_CTRL_REG1_FAST_ODR);
+}
+
+status_t lis3mdl_start_triggered(
+    lis3mdl_dev_t *dev,
+    bool pipelined,
+    lis3mdl_clock_t clock,
+    lis3mdl_trigger_callback_t callback,
+    void *context)
+{
+    uint8_t *shadow = ctrl_shadow(dev, LIS3MDL_REG_CTRL_REG3);
+    uint8_t window[7];
+
+    if (dev->acquisition != LIS3MDL_ACQUISITION_OFF) {
+        return STATUS_BUSY;
+    }
+    if (!single_conversion_allowed(dev)) {
+        return STATUS_ERROR;
+    }
+
+    status_t status = i2c_bus_acquire(dev->bus);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    /* Idle in power-down (MD = 11, which single mode also returns to) */
+    status = write_shadowed(
+        dev,
+        LIS3MDL_REG_CTRL_REG3,
+        shadow,
+        replace_bits(
+            *shadow,
+            LIS3MDL_CTRL_REG3_MD_MASK,
+            LIS3MDL_CTRL_REG3_MD_MASK));
+
+    /* Consume any stale sample so the first conversion raises DRDY */
+    if (status == STATUS_OK) {
+        status = i2c_bus_read(
+            dev->bus,
+            dev->bus_address,
+            LIS3MDL_REG_STATUS_REG | LIS3MDL_AUTO_INCREMENT,
+            sizeof(window),
+            window);
+    }
+    i2c_bus_release(dev->bus);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    dev->overruns = (lis3mdl_overruns_t){0};
+    dev->clock = clock;
+    dev->trigger_callback = callback;
+    dev->trigger_context = context;
+    dev->pipelined = pipelined;
+    dev->converting = false;
+    dev->drdy_seen = false;
+    dev->acquisition = LIS3MDL_ACQUISITION_TRIGGERED;
+    return STATUS_OK;
+}
+
+status_t lis3mdl_trigger(lis3mdl_dev_t *dev)
+{
+    size_t count = 0;
+
+    if (dev->acquisition != LIS3MDL_ACQUISITION_TRIGGERED
+        || !single_conversion_allowed(dev)) {
+        return STATUS_ERROR;
+    }
+    if (dev->transaction.status == STATUS_PENDING) {
+        dev->overruns.missed_data_ready++;
+        return STATUS_BUSY;
+    }
+
+    /* A result still on the device is fetched ahead of the new trigger */
+    if (dev->converting) {
+        claim_result(dev);
+        count++;
+    }
+
+    /* The shadow keeps the idle MD = 11; only the trigger write carries 01 */
+    dev->trigger_ctrl3 = replace_bits(
+        dev->shadow.ctrl[2],
+        LIS3MDL_CTRL_REG3_MD_MASK,
+        LIS3MDL_MEASUREMENT_SINGLE << LIS3MDL_CTRL_REG3_MD_SHIFT);
+    dev->msgs[count++] = (i2c_msg_t){
+        .direction = I2C_DIRECTION_WRITE,
+        .bus_address = dev->bus_address,
+        .register_address = LIS3MDL_REG_CTRL_REG3,
+        .length = 1,
+        .buffer = &dev->trigger_ctrl3,
+    };
+
+    dev->triggered_at = dev->clock != NULL ? dev->clock() : 0;
+    dev->drdy_seen = false;
+    dev->converting = true;
+
+    status_t status = submit_trigger_chain(dev, count);
+    if (status != STATUS_OK) {
+        dev->converting = false;
+    }
+    return status;
+}
+
+status_t lis3mdl_read_xyz_deadline(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3],
+    uint32_t deadline_us)
+{
+    uint32_t start = i2c_time_us();
+
+    /* Recovery only ever aborts this read, not another device's transfer */
+    status_t status = i2c_bus_read_deadline_recover(
+        dev->bus,
+        dev->bus_address,
+        LIS3MDL_REG_OUT_X_L | LIS3MDL_AUTO_INCREMENT,
+        6,
+        (uint8_t *)xyz,
+        deadline_us);
+
+    uint32_t elapsed = i2c_time_us() - start;
+    if (elapsed > dev->worst_read_us) {
+        dev->worst_read_us = elapsed;
+    }
+
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    decode_out16((const uint8_t *)xyz, xyz, 3, big_endian_output(dev));
+    return STATUS_OK;
+}
+
+status_t lis3mdl_recover(lis3mdl_dev_t *dev)
+{
+    status_t status = i2c_bus_recover(dev->bus);
+    if (status != STATUS_OK) {
+        return status;
+    }
+    return lis3mdl_resync(dev);
+}
+
+status_t lis3mdl_read_xyz_temp(
+    lis3mdl_dev_t *dev,
+    int16_t xyzt[4])
+{
+    status_t status = i2c_bus_read(
+        dev->bus,
+        dev->bus_address,
+        LIS3MDL_REG_OUT_X_L | LIS3MDL_AUTO_INCREMENT,
+        8,
+        (uint8_t *)xyzt);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    decode_out16((const uint8_t *)xyzt, xyzt, 4, big_endian_output(dev));
+    return STATUS_OK;
+}
@@ -0,0 +1,779 @@
+#ifndef LIS3MDL_HEADER_H
+#define LIS3MDL_HEADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "i2c.h"
+#include "lis3mdl_ring.h"
+#include "lis3mdl_soa.h"
+#include "lis3mdl_timing.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 7-bit bus addresses, selected by the SA1 pin */
+#define LIS3MDL_ADDRESS_SA1_LOW  0x1C
+#define LIS3MDL_ADDRESS_SA1_HIGH 0x1E
+
+/* Register map */
+#define LIS3MDL_REG_OFFSET_X_L 0x05
+#define LIS3MDL_REG_WHO_AM_I   0x0F
+#define LIS3MDL_REG_CTRL_REG1  0x20
+#define LIS3MDL_REG_CTRL_REG2  0x21
+#define LIS3MDL_REG_CTRL_REG3  0x22
+#define LIS3MDL_REG_CTRL_REG4  0x23
+#define LIS3MDL_REG_CTRL_REG5  0x24
+#define LIS3MDL_REG_STATUS_REG 0x27
+#define LIS3MDL_REG_OUT_X_L    0x28
+#define LIS3MDL_REG_OUT_X_H    0x29
+#define LIS3MDL_REG_OUT_Y_L    0x2A
+#define LIS3MDL_REG_OUT_Y_H    0x2B
+#define LIS3MDL_REG_OUT_Z_L    0x2C
+#define LIS3MDL_REG_OUT_Z_H    0x2D
+#define LIS3MDL_REG_TEMP_OUT_L 0x2E
+#define LIS3MDL_REG_TEMP_OUT_H 0x2F
+#define LIS3MDL_REG_INT_CFG    0x30
+#define LIS3MDL_REG_INT_SRC    0x31
+#define LIS3MDL_REG_INT_THS_L  0x32
+#define LIS3MDL_REG_INT_THS_H  0x33
+
+#define LIS3MDL_WHO_AM_I_VALUE 0x3D
+
+/* Setting the MSB of the register address enables address auto-increment */
+#define LIS3MDL_AUTO_INCREMENT 0x80
+
+/* CTRL_REG1 */
+#define LIS3MDL_CTRL_REG1_TEMP_EN  0x80
+#define LIS3MDL_CTRL_REG1_OM_MASK  0x60
+#define LIS3MDL_CTRL_REG1_OM_SHIFT 5
+#define LIS3MDL_CTRL_REG1_DO_MASK  0x1C
+#define LIS3MDL_CTRL_REG1_DO_SHIFT 2
+#define LIS3MDL_CTRL_REG1_FAST_ODR 0x02
+#define LIS3MDL_CTRL_REG1_ST       0x01
+
+/* CTRL_REG2 */
+#define LIS3MDL_CTRL_REG2_FS_MASK  0x60
+#define LIS3MDL_CTRL_REG2_FS_SHIFT 5
+#define LIS3MDL_CTRL_REG2_REBOOT   0x08
+#define LIS3MDL_CTRL_REG2_SOFT_RST 0x04
+
+/* CTRL_REG3 */
+#define LIS3MDL_CTRL_REG3_LP       0x20
+#define LIS3MDL_CTRL_REG3_SIM      0x04
+#define LIS3MDL_CTRL_REG3_MD_MASK  0x03
+#define LIS3MDL_CTRL_REG3_MD_SHIFT 0
+
+/* CTRL_REG4 */
+#define LIS3MDL_CTRL_REG4_OMZ_MASK  0x0C
+#define LIS3MDL_CTRL_REG4_OMZ_SHIFT 2
+#define LIS3MDL_CTRL_REG4_BLE       0x02
+
+/* CTRL_REG5 */
+#define LIS3MDL_CTRL_REG5_FAST_READ 0x80
+#define LIS3MDL_CTRL_REG5_BDU       0x40
+
+/* STATUS_REG */
+#define LIS3MDL_STATUS_ZYXOR 0x80
+#define LIS3MDL_STATUS_ZYXDA 0x08
+
+/* INT_CFG; bit 3 reads as 1 and must be written as 1 */
+#define LIS3MDL_INT_CFG_XIEN  0x80
+#define LIS3MDL_INT_CFG_YIEN  0x40
+#define LIS3MDL_INT_CFG_ZIEN  0x20
+#define LIS3MDL_INT_CFG_FIXED 0x08
+#define LIS3MDL_INT_CFG_IEA   0x04
+#define LIS3MDL_INT_CFG_LIR   0x02
+#define LIS3MDL_INT_CFG_IEN   0x01
+
+/* INT_SRC */
+#define LIS3MDL_INT_SRC_PTH_X 0x80
+#define LIS3MDL_INT_SRC_PTH_Y 0x40
+#define LIS3MDL_INT_SRC_PTH_Z 0x20
+#define LIS3MDL_INT_SRC_NTH_X 0x10
+#define LIS3MDL_INT_SRC_NTH_Y 0x08
+#define LIS3MDL_INT_SRC_NTH_Z 0x04
+#define LIS3MDL_INT_SRC_MROI  0x02
+#define LIS3MDL_INT_SRC_INT   0x01
+
+/* INT_THS is a 15-bit magnitude */
+#define LIS3MDL_INT_THS_MAX 0x7FFF
+
+typedef enum {
+    LIS3MDL_AXIS_X,
+    LIS3MDL_AXIS_Y,
+    LIS3MDL_AXIS_Z
+} lis3mdl_axis_t;
+
+typedef enum {
+    LIS3MDL_FULL_SCALE_4_GAUSS,
+    LIS3MDL_FULL_SCALE_8_GAUSS,
+    LIS3MDL_FULL_SCALE_12_GAUSS,
+    LIS3MDL_FULL_SCALE_16_GAUSS
+} lis3mdl_full_scale_t;
+
+/*
+ * The first eight values match the DO bits of CTRL_REG1. LIS3MDL_ODR_FAST
+ * selects FAST_ODR, whose actual rate depends on the operating mode.
+ */
+typedef enum {
+    LIS3MDL_ODR_0_625_HZ,
+    LIS3MDL_ODR_1_25_HZ,
+    LIS3MDL_ODR_2_5_HZ,
+    LIS3MDL_ODR_5_HZ,
+    LIS3MDL_ODR_10_HZ,
+    LIS3MDL_ODR_20_HZ,
+    LIS3MDL_ODR_40_HZ,
+    LIS3MDL_ODR_80_HZ,
+    LIS3MDL_ODR_FAST
+} lis3mdl_odr_t;
+
+/* OM bits of CTRL_REG1 (X/Y) and OMZ bits of CTRL_REG4 (Z) */
+typedef enum {
+    LIS3MDL_OP_MODE_LOW_POWER,
+    LIS3MDL_OP_MODE_MEDIUM_PERFORMANCE,
+    LIS3MDL_OP_MODE_HIGH_PERFORMANCE,
+    LIS3MDL_OP_MODE_ULTRA_HIGH_PERFORMANCE
+} lis3mdl_op_mode_t;
+
+/* MD bits of CTRL_REG3 */
+typedef enum {
+    LIS3MDL_MEASUREMENT_CONTINUOUS,
+    LIS3MDL_MEASUREMENT_SINGLE,
+    LIS3MDL_MEASUREMENT_POWER_DOWN
+} lis3mdl_measurement_mode_t;
+
+/*
+ * How the output registers are sampled.
+ *
+ * LIS3MDL_SAMPLING_STANDARD leaves BDU clear: the output registers update
+ * as soon as a conversion completes, so a read that straddles a conversion
+ * may combine the L and H bytes of two different samples.
+ *
+ * LIS3MDL_SAMPLING_COHERENT sets BDU, which freezes the output registers
+ * from the first byte read until both bytes of every axis have been read.
+ * Because the driver always fetches all six bytes in one auto-increment
+ * burst, each transaction yields one coherent sample with no retry path and
+ * no extra bus traffic. The cost is latency: a conversion that completes
+ * during the burst is held back until the burst ends, and if the host is
+ * more than a full output period late the intermediate sample is lost
+ * (ZYXOR). Throughput is unchanged at six bytes per sample; FAST_READ
+ * halves that at the price of resolution.
+ *
+ * LIS3MDL_SAMPLING_FAST_READ sets FAST_READ so that auto-increment visits
+ * only OUT_X_H, OUT_Y_H and OUT_Z_H: three bytes per sample, 8-bit
+ * resolution. Samples keep the int16_t scale of the full-resolution path
+ * with the low byte zero, so rings and callbacks are shared. Ring
+ * acquisition skips STATUS_REG in this mode, so ZYXOR is not reported.
+ */
+typedef enum {
+    LIS3MDL_SAMPLING_STANDARD,
+    LIS3MDL_SAMPLING_COHERENT,
+    LIS3MDL_SAMPLING_FAST_READ
+} lis3mdl_sampling_t;
+
+/*
+ * Desired device configuration for lis3mdl_apply_config(). Register bits
+ * not represented here (ST, SIM, BLE) keep their current value.
+ */
+typedef struct {
+    lis3mdl_odr_t odr;
+    lis3mdl_full_scale_t full_scale;
+    lis3mdl_op_mode_t xy_mode;
+    lis3mdl_op_mode_t z_mode;
+    lis3mdl_measurement_mode_t measurement_mode;
+    bool temperature_enable;
+    bool low_power;
+    bool block_data_update;
+    bool fast_read;
+} lis3mdl_config_t;
+
+#define LIS3MDL_CTRL_REG_COUNT 5
+
+/*
+ * RAM copy of the configuration registers. Getters answer from here and
+ * every setter keeps it coherent with the device. Setters compute the new
+ * register value from the shadow and skip the write when it is unchanged.
+ */
+typedef struct {
+    uint8_t ctrl[LIS3MDL_CTRL_REG_COUNT]; /* CTRL_REG1..CTRL_REG5 */
+    uint8_t int_cfg;
+    uint8_t int_ths[2];                   /* INT_THS_L, INT_THS_H */
+} lis3mdl_shadow_t;
+
+typedef struct lis3mdl_dev lis3mdl_dev_t;
+
+/*
+ * Receive buffer of ring and SoA acquisition, stamped at the data-ready
+ * whose read lands in it: STATUS_REG..OUT_Z_H at bytes[1..7], or the three
+ * high bytes at bytes[2..4] in FAST_READ mode (with STATUS_REG at bytes[0]
+ * for a batched read).
+ */
+typedef struct {
+    uint8_t bytes[8];
+    uint32_t timestamp;
+    uint32_t sequence;
+} lis3mdl_rx_buffer_t;
+
+/*
+ * Per-device counters for lis3mdl_get_stats(). The bus figures come from
+ * the I2C layer and read zero unless it is built with I2C_STATS.
+ */
+typedef struct {
+    uint32_t segments;       /* Bus segments addressed to this device */
+    uint32_t bytes;          /* Payload bytes moved for this device */
+    uint32_t samples;        /* Delivered by acquisition or async reads */
+    uint32_t read_errors;    /* Failed asynchronous sample reads */
+    uint32_t worst_read_us;
+} lis3mdl_stats_t;
+
+/* Monotonic clock used to timestamp samples on data-ready */
+typedef uint32_t (*lis3mdl_clock_t)(void);
+
+/* Monotonic nanosecond clock feeding the output clock estimator */
+typedef uint64_t (*lis3mdl_clock_ns_t)(void);
+
+typedef enum {
+    LIS3MDL_ACQUISITION_OFF,
+    LIS3MDL_ACQUISITION_CALLBACK,
+    LIS3MDL_ACQUISITION_RING,
+    LIS3MDL_ACQUISITION_SOA,
+    LIS3MDL_ACQUISITION_WAKE,
+    LIS3MDL_ACQUISITION_TRIGGERED
+} lis3mdl_acquisition_t;
+
+/*
+ * Threshold wake mode. The sensor converts at `odr` in low-power mode and
+ * raises INT when an enabled axis exceeds +threshold or falls below
+ * -threshold. The comparison is per axis, so it approximates a |B|
+ * threshold with a cube.
+ */
+typedef struct {
+    float threshold_gauss;
+    uint8_t axes;              /* LIS3MDL_INT_CFG_XIEN/YIEN/ZIEN */
+    bool active_high;          /* IEA */
+    bool latched;              /* LIR: hold INT until INT_SRC is read */
+    lis3mdl_odr_t odr;
+
+    /* Rate and mode of lis3mdl_capture_window() */
+    lis3mdl_odr_t capture_odr;
+    lis3mdl_op_mode_t capture_mode;
+} lis3mdl_wake_config_t;
+
+typedef struct {
+    uint8_t source;   /* INT_SRC */
+    uint8_t status;   /* STATUS_REG */
+    int16_t xyz[3];   /* Output registers when the interrupt was served */
+    uint32_t timestamp;
+} lis3mdl_wake_event_t;
+
+/* One single-conversion sample and how long it took */
+typedef struct {
+    lis3mdl_sample_t sample;    /* Timestamped at the trigger */
+    uint32_t conversion_us;     /* Trigger to DRDY; 0 if DRDY is not wired */
+    uint32_t latency_us;        /* Trigger to the sample being available */
+} lis3mdl_triggered_sample_t;
+
+typedef void (*lis3mdl_trigger_callback_t)(
+    lis3mdl_dev_t *dev,
+    status_t status,
+    const lis3mdl_triggered_sample_t *sample,
+    void *context);
+
+/* Completion of the read issued by lis3mdl_on_interrupt() */
+typedef void (*lis3mdl_wake_callback_t)(
+    lis3mdl_dev_t *dev,
+    status_t status,
+    const lis3mdl_wake_event_t *event,
+    void *context);
+
+/* Samples lost during ring acquisition, by cause */
+typedef struct {
+    uint32_t sensor_overruns; /* ZYXOR: the sensor overwrote an unread sample */
+    uint32_t ring_full;       /* The consumer had not drained the ring/blocks */
+    uint32_t missed_data_ready; /* DRDY or INT during the previous read */
+} lis3mdl_overruns_t;
+
+/*
+ * Completion of lis3mdl_set_self_test_async(). `sequence` numbers the last
+ * data-ready stamped before the write completed, so conversions after it
+ * can be told apart from those before.
+ */
+typedef void (*lis3mdl_self_test_callback_t)(
+    lis3mdl_dev_t *dev,
+    status_t status,
+    uint32_t sequence,
+    void *context);
+
+/* Completion of lis3mdl_read_xyz_async(); `xyz` is only valid on STATUS_OK */
+typedef void (*lis3mdl_xyz_callback_t)(
+    lis3mdl_dev_t *dev,
+    status_t status,
+    int16_t xyz[3],
+    void *context);
+
+/*
+ * Per-device handle. A device is identified by its controller index `bus`
+ * and its 7-bit `bus_address`, so several sensors can share one bus and the
+ * same address can be reused on different buses.
+ */
+struct lis3mdl_dev {
+    uint8_t bus;
+    uint8_t bus_address;
+    lis3mdl_shadow_t shadow;
+
+    /* In-flight asynchronous sample read */
+    i2c_transaction_t transaction;
+    lis3mdl_xyz_callback_t xyz_callback;
+    void *xyz_context;
+
+    /* Data-ready driven acquisition */
+    volatile lis3mdl_acquisition_t acquisition;
+    int16_t *acquisition_buffer;
+    lis3mdl_overruns_t overruns;
+
+    /*
+     * Ring and SoA acquisition read into rx_buffers[rx_active] and decode
+     * from there into the destination. A data-ready during a read stamps
+     * the other buffer and sets `ready_pending`; the completion starts that
+     * read before decoding its own.
+     */
+    lis3mdl_rx_buffer_t rx_buffers[2];
+    uint8_t rx_active;
+    volatile bool ready_pending;
+
+    /* Batched read: data-ready stamped, and the window length in flight */
+    volatile bool batch_stamped;
+    uint8_t batch_length;
+    lis3mdl_ring_t ring;
+    lis3mdl_soa_buffer_t *soa_buffer;
+    lis3mdl_clock_t clock;
+    uint32_t data_ready_timestamp;
+
+    /*
+     * Output clock tracking: `sequence` numbers the latest data-ready,
+     * from `timing` when one is attached, else counting reads. The fit
+     * restarts when CTRL_REG1 or the LP and MD bits change.
+     */
+    lis3mdl_clock_ns_t clock_ns;
+    lis3mdl_timing_t *timing;
+    uint8_t timing_ctrl[2];
+    uint32_t sequence;
+
+    /* Longest lis3mdl_read_xyz_deadline() seen, in microseconds */
+    uint32_t worst_read_us;
+
+    uint32_t samples;
+    uint32_t read_errors;
+
+    /* Wake mode: STATUS_REG..OUT_Z_H into rx[1..7], then INT_SRC into rx[0] */
+    lis3mdl_wake_config_t wake;
+    lis3mdl_wake_callback_t wake_callback;
+    void *wake_context;
+
+    /*
+     * Triggered mode. `converting` is set from the trigger until its result
+     * is read; the *_at times belong to that conversion, the read_* ones to
+     * the result being fetched.
+     */
+    lis3mdl_trigger_callback_t trigger_callback;
+    void *trigger_context;
+    bool pipelined;
+    bool converting;
+    bool drdy_seen;
+    uint32_t triggered_at;
+    uint32_t drdy_at;
+    uint32_t read_triggered_at;
+    uint32_t read_conversion_us;
+    uint8_t trigger_ctrl3;
+
+    /* CTRL_REG1 write of lis3mdl_set_self_test_async() */
+    i2c_transaction_t self_test_transaction;
+    uint8_t self_test_ctrl1;
+    lis3mdl_self_test_callback_t self_test_callback;
+    void *self_test_context;
+
+    /* Segments of the chained wake and trigger transactions */
+    i2c_msg_t msgs[2];
+
+    uint8_t rx[8];
+};
+
+/* Bind `dev` to `bus_address` and fill the register shadow from the device */
+status_t lis3mdl_init(
+    lis3mdl_dev_t *dev,
+    uint8_t bus_address);
+
+/* As lis3mdl_init, for a device on I2C controller `bus` */
+status_t lis3mdl_init_on_bus(
+    lis3mdl_dev_t *dev,
+    uint8_t bus,
+    uint8_t bus_address);
+
+/*
+ * Bind `dev` to `bus_address` on `bus` and program CTRL_REG1..CTRL_REG5 from a
+ * precomputed `image`. The image write and the INT_CFG..INT_THS read that
+ * completes the shadow are combined into one bus operation.
+ */
+status_t lis3mdl_init_with_image(
+    lis3mdl_dev_t *dev,
+    uint8_t bus,
+    uint8_t bus_address,
+    const uint8_t image[LIS3MDL_CTRL_REG_COUNT]);
+
+/*
+ * Shadow of a configured device kept across warm resets, e.g. in a RAM
+ * section the startup code does not clear. `hash` covers the other fields,
+ * so a record left over from a cold boot reads as stale.
+ */
+typedef struct {
+    uint8_t bus;
+    uint8_t bus_address;
+    lis3mdl_shadow_t shadow;
+    uint32_t hash;
+} lis3mdl_retained_t;
+
+/* Record `dev`'s shadow once it is configured, for lis3mdl_warm_start() */
+void lis3mdl_retain(
+    const lis3mdl_dev_t *dev,
+    lis3mdl_retained_t *retained);
+
+/*
+ * As lis3mdl_init_with_image, for a device that may still be configured
+ * from before a warm reset. WHO_AM_I, CTRL_REG1..CTRL_REG5 and
+ * INT_CFG..INT_THS are read in one bus operation, then only the range of
+ * CTRL registers that differ from `image` is written, if any. Returns
+ * STATUS_ERROR if WHO_AM_I does not match.
+ *
+ * With a valid `retained` record for this device and image, the check is a
+ * single read of CTRL_REG1..CTRL_REG5 and the rest of the shadow comes from
+ * the record. A mismatch, e.g. after a power cycle, falls back to the full
+ * path. Records of the power-on image are not trusted, as a power cycle
+ * cannot be told from them. `retained` may be NULL.
+ */
+status_t lis3mdl_warm_start(
+    lis3mdl_dev_t *dev,
+    uint8_t bus,
+    uint8_t bus_address,
+    const uint8_t image[LIS3MDL_CTRL_REG_COUNT],
+    const lis3mdl_retained_t *retained);
+
+/*
+ * Refresh the register shadow from the device. Call after REBOOT or
+ * SOFT_RST, or anything else that changes registers behind the driver.
+ */
+status_t lis3mdl_resync(lis3mdl_dev_t *dev);
+
+/*
+ * Bring CTRL_REG1..CTRL_REG5 in line with `config`. Only the range of
+ * registers that differ from the shadow is written, as one auto-increment
+ * transaction; nothing is written if the device is already configured.
+ */
+status_t lis3mdl_apply_config(
+    lis3mdl_dev_t *dev,
+    const lis3mdl_config_t *config);
+
+/* The configuration currently in force, decoded from the shadow */
+status_t lis3mdl_get_config(
+    lis3mdl_dev_t *dev,
+    lis3mdl_config_t *config);
+
+/* The getters below answer from the register shadow without bus traffic */
+status_t lis3mdl_get_full_scale(
+    lis3mdl_dev_t *dev,
+    lis3mdl_full_scale_t *full_scale);
+
+status_t lis3mdl_get_odr(
+    lis3mdl_dev_t *dev,
+    lis3mdl_odr_t *odr);
+
+status_t lis3mdl_set_odr(
+    lis3mdl_dev_t *dev,
+    lis3mdl_odr_t odr);
+
+status_t lis3mdl_get_interrupt_enable(
+    lis3mdl_dev_t *dev,
+    bool *enabled);
+
+status_t lis3mdl_set_interrupt_enable(
+    lis3mdl_dev_t *dev,
+    bool enabled);
+
+/* Select the sampling mode, writing CTRL_REG5 only if it changes */
+status_t lis3mdl_set_sampling(
+    lis3mdl_dev_t *dev,
+    lis3mdl_sampling_t sampling);
+
+status_t lis3mdl_get_sampling(
+    lis3mdl_dev_t *dev,
+    lis3mdl_sampling_t *sampling);
+
+status_t lis3mdl_read_axis(
+    lis3mdl_dev_t *dev,
+    lis3mdl_axis_t axis,
+    int16_t *value);
+
+/*
+ * Read OUT_X_L..OUT_Z_H in a single auto-increment transaction. The raw
+ * bytes land directly in `xyz` and are decoded in place.
+ */
+status_t lis3mdl_read_xyz(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3]);
+
+/*
+ * Switch to LIS3MDL_SAMPLING_FAST_READ if needed and read the three high
+ * bytes in one transaction, expanded in place to the int16_t scale.
+ */
+status_t lis3mdl_read_xyz_fast(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3]);
+
+/*
+ * Start the burst read for the current sampling mode (as lis3mdl_read_xyz,
+ * or lis3mdl_read_xyz_fast in FAST_READ mode) and return immediately.
+ * `callback` runs with the decoded sample once the transfer completes. Only
+ * one asynchronous read per device may be in flight; a second request
+ * returns STATUS_BUSY.
+ */
+status_t lis3mdl_read_xyz_async(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3],
+    lis3mdl_xyz_callback_t callback,
+    void *context);
+
+/*
+ * Data-ready driven acquisition. lis3mdl_start_acquisition() selects
+ * continuous conversion and issues one read to deassert DRDY, so the next
+ * conversion produces a fresh rising edge. From then on the platform's DRDY
+ * ISR calls lis3mdl_on_data_ready(), which queues exactly one burst read
+ * into `xyz` per sample and reports it through `callback`; STATUS_REG is
+ * never polled.
+ *
+ * An edge that arrives while the previous read is still in flight is
+ * counted in `overruns.missed_data_ready` instead of being queued. Do not
+ * mix lis3mdl_read_xyz_async() with a running acquisition.
+ */
+status_t lis3mdl_start_acquisition(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3],
+    lis3mdl_xyz_callback_t callback,
+    void *context);
+
+/*
+ * As lis3mdl_start_acquisition, but samples are timestamped from `clock`
+ * (which may be NULL) when DRDY fires and produced into `dev->ring`. Each
+ * full-resolution read also covers STATUS_REG so sensor overruns (ZYXOR)
+ * are detected in the same transaction. A consumer task drains the ring with
+ * lis3mdl_ring_pop() without locks.
+ *
+ * Reads are double-buffered: a data-ready that arrives while a read is in
+ * flight is stamped and its read is started from the completion, ahead of
+ * the decode of the finished one, so the bus never waits on decoding. Only
+ * an edge arriving while both buffers are busy is counted as missed. Each
+ * sample is decoded once, straight from the receive buffer into its ring
+ * slot or block channels, in the byte order BLE selects. FAST_READ returns
+ * the OUT_*_H registers, which hold the high bytes only with BLE clear.
+ */
+status_t lis3mdl_start_ring_acquisition(
+    lis3mdl_dev_t *dev,
+    lis3mdl_clock_t clock);
+
+/*
+ * As lis3mdl_start_ring_acquisition, but samples are decoded straight into
+ * the X, Y, Z and timestamp channel arrays of `buffer`. The consumer takes
+ * completed blocks by pointer with lis3mdl_soa_take() and hands them back
+ * with lis3mdl_soa_release(). After lis3mdl_stop_acquisition(), once any
+ * in-flight read has completed, lis3mdl_soa_flush() publishes the partial
+ * block.
+ */
+status_t lis3mdl_start_soa_acquisition(
+    lis3mdl_dev_t *dev,
+    lis3mdl_soa_buffer_t *buffer,
+    lis3mdl_clock_t clock);
+
+void lis3mdl_stop_acquisition(lis3mdl_dev_t *dev);
+
+/*
+ * Batched reads, for a scheduler such as lis3mdl_manager that chains the
+ * reads of several devices into one transaction. The device must be in
+ * ring or SoA acquisition.
+ *
+ * lis3mdl_batch_data_ready() stamps a data-ready whose read will be
+ * batched; call it from the DRDY ISR instead of lis3mdl_on_data_ready().
+ * While the device's read is in a chain it stamps the other receive buffer,
+ * which the next chain reads, so the read in flight keeps its own stamp.
+ * lis3mdl_batch_prepare() fills `msg` with one read of STATUS_REG through
+ * OUT_Z_H (five bytes instead of seven under FAST_READ) into the device's
+ * receive buffer, stamping it now if no data-ready was recorded,
+ * and returns STATUS_BUSY while the previous read is outstanding. Once the
+ * chain has run, lis3mdl_batch_complete() decodes the window; a window
+ * whose STATUS_REG shows no new data produces no sample, so devices can be
+ * polled without DRDY. If the chain cannot be submitted,
+ * lis3mdl_batch_cancel() withdraws the prepared read and keeps its stamp
+ * for the next lis3mdl_batch_prepare().
+ */
+void lis3mdl_batch_data_ready(lis3mdl_dev_t *dev);
+
+status_t lis3mdl_batch_prepare(
+    lis3mdl_dev_t *dev,
+    i2c_msg_t *msg);
+
+void lis3mdl_batch_complete(
+    lis3mdl_dev_t *dev,
+    status_t status);
+
+void lis3mdl_batch_cancel(lis3mdl_dev_t *dev);
+
+/*
+ * Time between conversions at the current settings, or 0 when the device
+ * is not converting continuously.
+ */
+status_t lis3mdl_get_output_period_ns(
+    lis3mdl_dev_t *dev,
+    uint32_t *period_ns);
+
+/*
+ * Track the sensor's output clock during ring and SoA acquisition. Each
+ * data-ready is stamped on `clock` at nanosecond resolution and fed to
+ * `timing`, and each sample carries the sequence number the estimator gave
+ * its conversion, so consumers get drift-corrected sample times from
+ * lis3mdl_timing_get() and lis3mdl_timing_time_ns() without a clock of
+ * their own. A NULL `timing` detaches the estimator. Call while
+ * acquisition is stopped.
+ */
+void lis3mdl_set_timing(
+    lis3mdl_dev_t *dev,
+    lis3mdl_clock_ns_t clock,
+    lis3mdl_timing_t *timing);
+
+/*
+ * Set or clear ST in CTRL_REG1 without blocking, so the self-test can be
+ * switched during acquisition. The write is queued behind the sample reads
+ * already submitted, with its own descriptor, and the shadow is updated
+ * when it completes. `callback` runs at once if ST already has the wanted
+ * value. Returns STATUS_BUSY while a previous switch is in flight. ST is
+ * not part of the output clock settings, so the timing fit carries on.
+ */
+status_t lis3mdl_set_self_test_async(
+    lis3mdl_dev_t *dev,
+    bool enable,
+    lis3mdl_self_test_callback_t callback,
+    void *context);
+
+/* Snapshot of the loss counters, combining sensor and ring overruns */
+void lis3mdl_get_overruns(
+    lis3mdl_dev_t *dev,
+    lis3mdl_overruns_t *overruns);
+
+/* Per-device counters; loss counters are in lis3mdl_get_overruns */
+void lis3mdl_get_stats(
+    lis3mdl_dev_t *dev,
+    lis3mdl_stats_t *stats);
+
+/* To be called from the DRDY pin interrupt handler */
+void lis3mdl_on_data_ready(lis3mdl_dev_t *dev);
+
+/*
+ * Program the hard-iron OFFSET_X..OFFSET_Z registers, which the device
+ * subtracts from every conversion, in LSB at the current full scale. The
+ * six bytes go out as one auto-increment write. Samples converted before
+ * the write completes are not corrected.
+ */
+status_t lis3mdl_set_offset(
+    lis3mdl_dev_t *dev,
+    const int16_t offset[3]);
+
+/* Program INT_THS from a field in gauss at the current full scale */
+status_t lis3mdl_set_interrupt_threshold(
+    lis3mdl_dev_t *dev,
+    float threshold_gauss);
+
+/*
+ * Enter threshold wake mode: program INT_THS and INT_CFG, select low-power
+ * continuous conversion at `config->odr` and clear any latched interrupt.
+ * From then on the INT pin handler calls lis3mdl_on_interrupt(), which
+ * reads STATUS_REG..OUT_Z_H and INT_SRC in one chained transaction and
+ * hands the result to `callback`. Nothing is read between interrupts.
+ */
+status_t lis3mdl_start_wake(
+    lis3mdl_dev_t *dev,
+    const lis3mdl_wake_config_t *config,
+    lis3mdl_clock_t clock,
+    lis3mdl_wake_callback_t callback,
+    void *context);
+
+/* To be called from the INT pin interrupt handler */
+void lis3mdl_on_interrupt(lis3mdl_dev_t *dev);
+
+/*
+ * Single-conversion triggered sampling, for samples aligned to an external
+ * tick rather than the free-running ODR. The device idles in power-down;
+ * each lis3mdl_trigger() writes MD = 01 and the device converts once (the
+ * conversion time depends on OM) and drops back to power-down. The
+ * datasheet only specifies single-conversion mode at the DO rates, 80 Hz
+ * and below, so select one of those first: with LIS3MDL_ODR_FAST both
+ * lis3mdl_start_triggered() and lis3mdl_trigger() return STATUS_ERROR.
+ *
+ * Without `pipelined`, DRDY must be wired: lis3mdl_on_data_ready() reads
+ * STATUS_REG..OUT_Z_H as soon as the conversion ends, which gives the
+ * lowest latency at two bus operations per sample. With `pipelined`, DRDY
+ * only timestamps the conversion, and each trigger reads the previous
+ * result and starts the next conversion in one chained transaction, one
+ * bus operation per sample, delivered one tick late. The tick period must
+ * then exceed the conversion time; a result read before it is ready is
+ * reported with STATUS_BUSY.
+ *
+ * `callback` receives each sample with its trigger timestamp, the
+ * conversion time and the trigger-to-data latency measured on `clock`.
+ */
+status_t lis3mdl_start_triggered(
+    lis3mdl_dev_t *dev,
+    bool pipelined,
+    lis3mdl_clock_t clock,
+    lis3mdl_trigger_callback_t callback,
+    void *context);
+
+/* Start a conversion; safe to call from the tick ISR */
+status_t lis3mdl_trigger(lis3mdl_dev_t *dev);
+
+/*
+ * Burst-capture `count` samples after a wake event, from task context.
+ * The device is switched to the capture rate and mode and polled, with
+ * STATUS_REG and the outputs in one read per poll, until every sample is
+ * collected. It is then put back into wake mode. The sample that raised
+ * the interrupt is in the wake event; the sensor has no FIFO, so nothing
+ * older survives while the host sleeps.
+ */
+status_t lis3mdl_capture_window(
+    lis3mdl_dev_t *dev,
+    lis3mdl_sample_t *samples,
+    size_t count);
+
+/*
+ * As lis3mdl_read_xyz, but give up at `deadline_us` (see i2c.h). A read
+ * still on the wire at the deadline is ended by bus recovery, so the next
+ * read starts on a free bus; one still queued behind another device's
+ * transfer is only withdrawn. The duration
+ * of every call is folded into `worst_read_us`, so the bound can be checked
+ * in the field.
+ */
+status_t lis3mdl_read_xyz_deadline(
+    lis3mdl_dev_t *dev,
+    int16_t xyz[3],
+    uint32_t deadline_us);
+
+/* Free a stuck bus (9-clock recovery) and refresh the register shadow */
+status_t lis3mdl_recover(lis3mdl_dev_t *dev);
+
+/* As lis3mdl_read_xyz, extended to TEMP_OUT so `xyzt[3]` holds temperature */
+status_t lis3mdl_read_xyz_temp(
+    lis3mdl_dev_t *dev,
+    int16_t xyzt[4]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
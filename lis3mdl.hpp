@@ -0,0 +1,123 @@
+#ifndef LIS3MDL_HPP_HEADER_H
+#define LIS3MDL_HPP_HEADER_H
+
+#include <stdint.h>
+
+#include "lis3mdl.h"
+
+/*
+ * Header-only C++ front end for boards whose sensor configuration is fixed
+ * at build time. The CTRL_REG1..CTRL_REG5 image, the output rate and the
+ * sensitivity are all computed at compile time, invalid parameters fail to
+ * compile, and init() is a single write of the precomputed image.
+ *
+ *     using Magnetometer = Lis3mdl<
+ *         LIS3MDL_ADDRESS_SA1_LOW,
+ *         LIS3MDL_FULL_SCALE_4_GAUSS,
+ *         LIS3MDL_ODR_FAST,
+ *         LIS3MDL_OP_MODE_HIGH_PERFORMANCE>;
+ *
+ * The same operating mode is used for X/Y (OM) and Z (OMZ), and the device
+ * runs in continuous conversion.
+ */
+template <
+    uint8_t Addr,
+    lis3mdl_full_scale_t FullScale,
+    lis3mdl_odr_t Odr,
+    lis3mdl_op_mode_t OpMode,
+    lis3mdl_sampling_t Sampling = LIS3MDL_SAMPLING_COHERENT,
+    uint8_t Bus = 0>
+class Lis3mdl {
+    static_assert(
+        Addr == LIS3MDL_ADDRESS_SA1_LOW || Addr == LIS3MDL_ADDRESS_SA1_HIGH,
+        "LIS3MDL responds only at 0x1C (SA1 low) or 0x1E (SA1 high)");
+    static_assert(Bus < I2C_BUS_COUNT, "no such I2C controller");
+    static_assert(
+        FullScale >= LIS3MDL_FULL_SCALE_4_GAUSS
+            && FullScale <= LIS3MDL_FULL_SCALE_16_GAUSS,
+        "invalid full-scale selection");
+    static_assert(
+        Odr >= LIS3MDL_ODR_0_625_HZ && Odr <= LIS3MDL_ODR_FAST,
+        "invalid output data rate");
+    static_assert(
+        OpMode >= LIS3MDL_OP_MODE_LOW_POWER
+            && OpMode <= LIS3MDL_OP_MODE_ULTRA_HIGH_PERFORMANCE,
+        "invalid operating mode");
+    static_assert(
+        Sampling >= LIS3MDL_SAMPLING_STANDARD
+            && Sampling <= LIS3MDL_SAMPLING_FAST_READ,
+        "invalid sampling mode");
+
+    static constexpr uint8_t odr_bits()
+    {
+        return Odr == LIS3MDL_ODR_FAST
+            ? LIS3MDL_CTRL_REG1_FAST_ODR
+            : static_cast<uint8_t>(Odr << LIS3MDL_CTRL_REG1_DO_SHIFT);
+    }
+
+    static constexpr uint8_t sampling_bits()
+    {
+        return Sampling == LIS3MDL_SAMPLING_COHERENT ? LIS3MDL_CTRL_REG5_BDU
+            : Sampling == LIS3MDL_SAMPLING_FAST_READ
+                ? LIS3MDL_CTRL_REG5_FAST_READ
+                : 0;
+    }
+
+    /* FAST_ODR rate in mHz for each operating mode */
+    static constexpr uint32_t fast_odr_mhz[] = {1000000, 560000, 300000, 155000};
+
+    /* DO rates in mHz */
+    static constexpr uint32_t odr_mhz[] = {
+        625, 1250, 2500, 5000, 10000, 20000, 40000, 80000};
+
+    static constexpr uint16_t sensitivity[] = {6842, 3421, 2281, 1711};
+
+public:
+    static constexpr uint8_t bus_address = Addr;
+
+    static constexpr uint8_t ctrl_image[LIS3MDL_CTRL_REG_COUNT] = {
+        static_cast<uint8_t>((OpMode << LIS3MDL_CTRL_REG1_OM_SHIFT) | odr_bits()),
+        static_cast<uint8_t>(FullScale << LIS3MDL_CTRL_REG2_FS_SHIFT),
+        static_cast<uint8_t>(
+            LIS3MDL_MEASUREMENT_CONTINUOUS << LIS3MDL_CTRL_REG3_MD_SHIFT),
+        static_cast<uint8_t>(OpMode << LIS3MDL_CTRL_REG4_OMZ_SHIFT),
+        sampling_bits(),
+    };
+
+    /* Output data rate in mHz */
+    static constexpr uint32_t output_rate_mhz =
+        Odr == LIS3MDL_ODR_FAST ? fast_odr_mhz[OpMode] : odr_mhz[Odr];
+
+    static constexpr uint16_t lsb_per_gauss = sensitivity[FullScale];
+
+    static constexpr float gauss(int16_t raw)
+    {
+        return static_cast<float>(raw) / static_cast<float>(lsb_per_gauss);
+    }
+
+    status_t init()
+    {
+        return lis3mdl_init_with_image(&dev_, Bus, Addr, ctrl_image);
+    }
+
+    /* init() for a device that may be configured from before a warm reset */
+    status_t warm_start(const lis3mdl_retained_t *retained = nullptr)
+    {
+        return lis3mdl_warm_start(&dev_, Bus, Addr, ctrl_image, retained);
+    }
+
+    status_t read_xyz(int16_t xyz[3])
+    {
+        return Sampling == LIS3MDL_SAMPLING_FAST_READ
+            ? lis3mdl_read_xyz_fast(&dev_, xyz)
+            : lis3mdl_read_xyz(&dev_, xyz);
+    }
+
+    /* The underlying C driver handle, for everything not wrapped here */
+    lis3mdl_dev_t *device() { return &dev_; }
+
+private:
+    lis3mdl_dev_t dev_;
+};
+
+#endif
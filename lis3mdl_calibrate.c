@@ -0,0 +1,535 @@
+#include "lis3mdl_calibrate.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Eigenvalues below this fraction of the largest make the fit degenerate */
+#define MIN_EIGEN_RATIO 1e-9
+
+/* Cholesky pivots below this fraction of their diagonal are rank loss */
+#define MIN_PIVOT_RATIO 1e-12
+
+#define JACOBI_SWEEPS 32
+
+void lis3mdl_calibrate_default_config(lis3mdl_calibrate_config_t *config)
+{
+    config->min_samples = 200;
+    config->fit_interval = 50;
+    config->window_samples = 0;
+    config->max_error = 0.05f;
+    config->min_coverage = 0.2f;
+}
+
+static void begin_write(lis3mdl_calibrate_t *calibrate)
+{
+    uint32_t version =
+        atomic_load_explicit(&calibrate->version, memory_order_relaxed);
+
+    atomic_store_explicit(
+        &calibrate->version,
+        version + 1,
+        memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void end_write(lis3mdl_calibrate_t *calibrate)
+{
+    uint32_t version =
+        atomic_load_explicit(&calibrate->version, memory_order_relaxed);
+
+    atomic_store_explicit(
+        &calibrate->version,
+        version + 1,
+        memory_order_release);
+}
+
+/* Publish the centre against the programmed offset, and `soft` if given */
+static void publish(
+    lis3mdl_calibrate_t *calibrate,
+    double soft[3][3],
+    const lis3mdl_calibrate_fit_t *fit)
+{
+    begin_write(calibrate);
+    calibrate->calib.gauss_per_lsb = (float)calibrate->gauss_per_lsb;
+    for (size_t r = 0; r < 3; ++r) {
+        calibrate->calib.hard_iron[r] = (float)(calibrate->center_gauss[r]
+            - calibrate->offset[r] * calibrate->gauss_per_lsb);
+        if (soft != NULL) {
+            for (size_t c = 0; c < 3; ++c) {
+                calibrate->calib.soft_iron[r][c] = (float)soft[r][c];
+            }
+        }
+    }
+    if (fit != NULL) {
+        calibrate->fit = *fit;
+    }
+    end_write(calibrate);
+}
+
+void lis3mdl_calibrate_restart(lis3mdl_calibrate_t *calibrate)
+{
+    lis3mdl_full_scale_t full_scale;
+
+    for (size_t i = 0; i < 9; ++i) {
+        for (size_t j = 0; j < 9; ++j) {
+            calibrate->moments[i][j] = 0.0;
+        }
+        calibrate->targets[i] = 0.0;
+    }
+    calibrate->weight = 0.0;
+    calibrate->since_fit = 0;
+    calibrate->samples = 0;
+
+    lis3mdl_get_full_scale(calibrate->dev, &full_scale);
+    calibrate->gauss_per_lsb = 1.0 / lis3mdl_lsb_per_gauss(full_scale);
+    publish(calibrate, NULL, NULL);
+}
+
+status_t lis3mdl_calibrate_init(
+    lis3mdl_calibrate_t *calibrate,
+    lis3mdl_dev_t *dev,
+    const lis3mdl_calibrate_config_t *config)
+{
+    lis3mdl_full_scale_t full_scale;
+
+    if (config->fit_interval == 0 || config->min_samples < 9) {
+        return STATUS_ERROR;
+    }
+
+    atomic_init(&calibrate->version, 0);
+    calibrate->dev = dev;
+    calibrate->config = *config;
+    calibrate->forget = config->window_samples != 0
+        ? 1.0 - 1.0 / config->window_samples
+        : 1.0;
+
+    for (size_t axis = 0; axis < 3; ++axis) {
+        calibrate->offset[axis] = 0;
+        calibrate->previous_offset[axis] = 0;
+        calibrate->center_gauss[axis] = 0.0;
+    }
+    calibrate->offset_sequence = 0;
+    calibrate->offset_written = false;
+    calibrate->fit = (lis3mdl_calibrate_fit_t){0};
+
+    lis3mdl_get_full_scale(dev, &full_scale);
+    lis3mdl_calib_init(&calibrate->calib, full_scale);
+    lis3mdl_calibrate_restart(calibrate);
+    return STATUS_OK;
+}
+
+/*
+ * Solve the normal equations by Cholesky decomposition. Only the upper
+ * triangle of `m` is used. Fails when the samples do not pin down all nine
+ * parameters, e.g. while the sensor has only turned about one axis.
+ */
+static bool solve(
+    double m[9][9],
+    const double b[9],
+    double x[9])
+{
+    double l[9][9];
+    double y[9];
+
+    for (size_t i = 0; i < 9; ++i) {
+        for (size_t j = 0; j <= i; ++j) {
+            double sum = m[j][i];
+
+            for (size_t k = 0; k < j; ++k) {
+                sum -= l[i][k] * l[j][k];
+            }
+            if (i == j) {
+                if (!(sum > MIN_PIVOT_RATIO * m[i][i])) {
+                    return false;
+                }
+                l[i][i] = sqrt(sum);
+            } else {
+                l[i][j] = sum / l[j][j];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < 9; ++i) {
+        double sum = b[i];
+
+        for (size_t k = 0; k < i; ++k) {
+            sum -= l[i][k] * y[k];
+        }
+        y[i] = sum / l[i][i];
+    }
+    for (size_t i = 9; i-- > 0;) {
+        double sum = y[i];
+
+        for (size_t k = i + 1; k < 9; ++k) {
+            sum -= l[k][i] * x[k];
+        }
+        x[i] = sum / l[i][i];
+    }
+    return true;
+}
+
+/*
+ * Eigen-decomposition of a symmetric 3x3 matrix by Jacobi rotations: `a`
+ * is left diagonal with the eigenvalues, `vectors` holds the eigenvectors
+ * as columns.
+ */
+static void eigen3(
+    double a[3][3],
+    double vectors[3][3])
+{
+    static const size_t pairs[3][2] = {{0, 1}, {0, 2}, {1, 2}};
+
+    for (size_t r = 0; r < 3; ++r) {
+        for (size_t c = 0; c < 3; ++c) {
+            vectors[r][c] = r == c ? 1.0 : 0.0;
+        }
+    }
+
+    for (int sweep = 0; sweep < JACOBI_SWEEPS; ++sweep) {
+        if (a[0][1] == 0.0 && a[0][2] == 0.0 && a[1][2] == 0.0) {
+            return;
+        }
+        for (size_t n = 0; n < 3; ++n) {
+            size_t p = pairs[n][0];
+            size_t q = pairs[n][1];
+
+            double diagonal = fabs(a[p][p]) + fabs(a[q][q]);
+
+            if (fabs(a[p][q]) <= DBL_EPSILON * diagonal) {
+                a[p][q] = 0.0;
+                a[q][p] = 0.0;
+                continue;
+            }
+
+            double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+            double t = (theta >= 0.0 ? 1.0 : -1.0)
+                / (fabs(theta) + sqrt(theta * theta + 1.0));
+            double c = 1.0 / sqrt(t * t + 1.0);
+            double s = t * c;
+
+            for (size_t k = 0; k < 3; ++k) {
+                double kp = a[k][p];
+                double kq = a[k][q];
+                a[k][p] = c * kp - s * kq;
+                a[k][q] = s * kp + c * kq;
+            }
+            for (size_t k = 0; k < 3; ++k) {
+                double pk = a[p][k];
+                double qk = a[q][k];
+                a[p][k] = c * pk - s * qk;
+                a[q][k] = s * pk + c * qk;
+            }
+            a[p][q] = 0.0;
+            a[q][p] = 0.0;
+            for (size_t k = 0; k < 3; ++k) {
+                double kp = vectors[k][p];
+                double kq = vectors[k][q];
+                vectors[k][p] = c * kp - s * kq;
+                vectors[k][q] = s * kp + c * kq;
+            }
+        }
+    }
+}
+
+/* V diag(d) V^T */
+static void compose(
+    double vectors[3][3],
+    const double d[3],
+    double out[3][3])
+{
+    for (size_t r = 0; r < 3; ++r) {
+        for (size_t c = 0; c < 3; ++c) {
+            out[r][c] = vectors[r][0] * d[0] * vectors[c][0]
+                + vectors[r][1] * d[1] * vectors[c][1]
+                + vectors[r][2] * d[2] * vectors[c][2];
+        }
+    }
+}
+
+/* Least eigenvalue of the covariance of the samples, in gauss^2 */
+static double least_spread(const lis3mdl_calibrate_t *calibrate)
+{
+    const double *t = calibrate->targets;
+    double w = calibrate->weight;
+    double mean[3] = {t[6] / (2 * w), t[7] / (2 * w), t[8] / (2 * w)};
+    double cov[3][3] = {
+        {t[0] / w, t[3] / (2 * w), t[4] / (2 * w)},
+        {t[3] / (2 * w), t[1] / w, t[5] / (2 * w)},
+        {t[4] / (2 * w), t[5] / (2 * w), t[2] / w},
+    };
+    double vectors[3][3];
+    double least;
+
+    for (size_t r = 0; r < 3; ++r) {
+        for (size_t c = 0; c < 3; ++c) {
+            cov[r][c] -= mean[r] * mean[c];
+        }
+    }
+    eigen3(cov, vectors);
+
+    least = cov[0][0];
+    for (size_t i = 1; i < 3; ++i) {
+        if (cov[i][i] < least) {
+            least = cov[i][i];
+        }
+    }
+    return least;
+}
+
+/* Weighted sum of squared residuals of `p`, from the normal equations */
+static double residual(
+    const lis3mdl_calibrate_t *calibrate,
+    const double p[9])
+{
+    double sum = calibrate->weight;
+
+    for (size_t i = 0; i < 9; ++i) {
+        double row = 0.0;
+
+        for (size_t j = 0; j < 9; ++j) {
+            row += (i <= j
+                ? calibrate->moments[i][j]
+                : calibrate->moments[j][i]) * p[j];
+        }
+        sum += p[i] * row - 2.0 * p[i] * calibrate->targets[i];
+    }
+    return sum > 0.0 ? sum : 0.0;
+}
+
+static bool reject(lis3mdl_calibrate_t *calibrate)
+{
+    lis3mdl_calibrate_fit_t fit = calibrate->fit;
+
+    fit.fits++;
+    fit.rejected++;
+    publish(calibrate, NULL, &fit);
+    return false;
+}
+
+static bool fit_ellipsoid(lis3mdl_calibrate_t *calibrate)
+{
+    const lis3mdl_calibrate_config_t *config = &calibrate->config;
+    double p[9];
+    double vectors[3][3];
+    double inverse[3][3];
+    double soft[3][3];
+    double lambda[3];
+    double center[3];
+    double scale[3];
+    double largest = 0.0;
+    double k = 1.0;
+
+    if (!solve(calibrate->moments, calibrate->targets, p)) {
+        return reject(calibrate);
+    }
+
+    double a[3][3] = {
+        {p[0], p[3], p[4]},
+        {p[3], p[1], p[5]},
+        {p[4], p[5], p[2]},
+    };
+    const double v[3] = {p[6], p[7], p[8]};
+
+    eigen3(a, vectors);
+    for (size_t i = 0; i < 3; ++i) {
+        lambda[i] = a[i][i];
+        if (fabs(lambda[i]) > largest) {
+            largest = fabs(lambda[i]);
+        }
+    }
+    for (size_t i = 0; i < 3; ++i) {
+        if (!(fabs(lambda[i]) > MIN_EIGEN_RATIO * largest)) {
+            return reject(calibrate);
+        }
+        scale[i] = 1.0 / lambda[i];
+    }
+
+    /* Centre c = -A^-1 v, and (x - c)^T A (x - c) = 1 + c^T A c = k */
+    compose(vectors, scale, inverse);
+    for (size_t r = 0; r < 3; ++r) {
+        center[r] = -(inverse[r][0] * v[0] + inverse[r][1] * v[1]
+            + inverse[r][2] * v[2]);
+    }
+    for (size_t r = 0; r < 3; ++r) {
+        k -= center[r] * v[r];
+    }
+
+    /* Axes of (x - c)^T M (x - c) = 1, with M = A / k */
+    double volume = 1.0;
+    for (size_t i = 0; i < 3; ++i) {
+        lambda[i] /= k;
+        if (!(lambda[i] > 0.0)) {
+            return reject(calibrate);
+        }
+        volume *= lambda[i];
+    }
+    double radius = 1.0 / sqrt(cbrt(volume));
+
+    /*
+     * A residual r of the quadric is an error of r / k in the squared
+     * normalised radius, so about half that in the radius.
+     */
+    double error = sqrt(residual(calibrate, p) / calibrate->weight)
+        / (2.0 * fabs(k));
+    double coverage = 3.0 * least_spread(calibrate) / (radius * radius);
+
+    if (error > config->max_error || coverage < config->min_coverage) {
+        return reject(calibrate);
+    }
+
+    for (size_t i = 0; i < 3; ++i) {
+        scale[i] = sqrt(lambda[i]) * radius;
+    }
+    compose(vectors, scale, soft);
+
+    lis3mdl_calibrate_fit_t fit = calibrate->fit;
+    fit.valid = true;
+    fit.error = (float)error;
+    fit.coverage = (float)coverage;
+    fit.field_gauss = (float)radius;
+    fit.samples = calibrate->samples;
+    fit.fits++;
+
+    for (size_t r = 0; r < 3; ++r) {
+        calibrate->center_gauss[r] = center[r];
+    }
+    publish(calibrate, soft, &fit);
+    return true;
+}
+
+/* Offset the device applied to `sample`, or NULL for one straddling a write */
+static const int16_t *sample_offset(
+    lis3mdl_calibrate_t *calibrate,
+    const lis3mdl_sample_t *sample)
+{
+    if (!calibrate->offset_written) {
+        return calibrate->offset;
+    }
+
+    int16_t since =
+        (int16_t)(uint16_t)(sample->sequence - calibrate->offset_sequence);
+    if (since <= 0) {
+        return calibrate->previous_offset;
+    }
+    if (since == 1) {
+        return NULL;
+    }
+    calibrate->offset_written = false;
+    return calibrate->offset;
+}
+
+static void accumulate(
+    lis3mdl_calibrate_t *calibrate,
+    const lis3mdl_sample_t *sample)
+{
+    const int16_t *offset = sample_offset(calibrate, sample);
+    double gauss_per_lsb = calibrate->gauss_per_lsb;
+    double forget = calibrate->forget;
+
+    if (offset == NULL) {
+        return;
+    }
+
+    double x = (sample->x + offset[0]) * gauss_per_lsb;
+    double y = (sample->y + offset[1]) * gauss_per_lsb;
+    double z = (sample->z + offset[2]) * gauss_per_lsb;
+    const double d[9] = {
+        x * x, y * y, z * z,
+        2 * x * y, 2 * x * z, 2 * y * z,
+        2 * x, 2 * y, 2 * z,
+    };
+
+    for (size_t i = 0; i < 9; ++i) {
+        for (size_t j = i; j < 9; ++j) {
+            calibrate->moments[i][j] =
+                forget * calibrate->moments[i][j] + d[i] * d[j];
+        }
+        calibrate->targets[i] = forget * calibrate->targets[i] + d[i];
+    }
+    calibrate->weight = forget * calibrate->weight + 1.0;
+
+    if (calibrate->samples < UINT32_MAX) {
+        calibrate->samples++;
+    }
+    calibrate->since_fit++;
+}
+
+bool lis3mdl_calibrate_feed(
+    lis3mdl_calibrate_t *calibrate,
+    const lis3mdl_sample_t *samples,
+    size_t count)
+{
+    bool published = false;
+
+    for (size_t i = 0; i < count; ++i) {
+        accumulate(calibrate, &samples[i]);
+
+        if (calibrate->samples >= calibrate->config.min_samples
+            && calibrate->since_fit >= calibrate->config.fit_interval) {
+            calibrate->since_fit = 0;
+            published |= fit_ellipsoid(calibrate);
+        }
+    }
+    return published;
+}
+
+void lis3mdl_calibrate_get(
+    lis3mdl_calibrate_t *calibrate,
+    lis3mdl_calib_t *calib,
+    lis3mdl_calibrate_fit_t *fit)
+{
+    uint32_t before;
+    uint32_t after;
+
+    do {
+        before =
+            atomic_load_explicit(&calibrate->version, memory_order_acquire);
+
+        *calib = calibrate->calib;
+        if (fit != NULL) {
+            *fit = calibrate->fit;
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&calibrate->version, memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+}
+
+status_t lis3mdl_calibrate_write_offset(lis3mdl_calibrate_t *calibrate)
+{
+    int16_t offset[3];
+
+    if (!calibrate->fit.valid) {
+        return STATUS_ERROR;
+    }
+
+    for (size_t axis = 0; axis < 3; ++axis) {
+        double lsb = calibrate->center_gauss[axis] / calibrate->gauss_per_lsb;
+
+        if (lsb > INT16_MAX) {
+            lsb = INT16_MAX;
+        } else if (lsb < INT16_MIN) {
+            lsb = INT16_MIN;
+        }
+        offset[axis] = (int16_t)lrint(lsb);
+    }
+
+    status_t status = lis3mdl_set_offset(calibrate->dev, offset);
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    for (size_t axis = 0; axis < 3; ++axis) {
+        calibrate->previous_offset[axis] = calibrate->offset[axis];
+        calibrate->offset[axis] = offset[axis];
+    }
+    calibrate->offset_sequence = (uint16_t)calibrate->dev->sequence;
+    calibrate->offset_written = true;
+
+    publish(calibrate, NULL, NULL);
+    return STATUS_OK;
+}
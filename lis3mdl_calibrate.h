@@ -0,0 +1,135 @@
+#ifndef LIS3MDL_CALIBRATE_HEADER_H
+#define LIS3MDL_CALIBRATE_HEADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2c.h"
+#include "lis3mdl.h"
+#include "lis3mdl_convert.h"
+#include "lis3mdl_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * On-line hard- and soft-iron calibration. A distorted field traces an
+ * ellipsoid as the sensor turns, which is fitted as the quadric
+ *
+ *     a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z = 1
+ *
+ * by least squares. The fit needs only the normal equations, so each
+ * sample updates a fixed 9x9 moment matrix in O(1) and nothing else is
+ * kept. Every `fit_interval` samples the equations are solved and the
+ * ellipsoid is turned into the lis3mdl_calib_t the conversion kernels use:
+ * the centre becomes `hard_iron`, and `soft_iron` is the symmetric matrix
+ * that maps the ellipsoid onto a sphere of the same volume, so corrected
+ * readings keep the field strength. A fit whose residual or spread of
+ * orientations is too poor is rejected and the previous calibration stays.
+ *
+ * With `window_samples` set, older samples are forgotten exponentially so
+ * the calibration follows a changing installation; otherwise every sample
+ * counts. Feed samples drained from the device's ring in order. Readers in
+ * other contexts take the calibration through a sequence lock.
+ *
+ * lis3mdl_calibrate_write_offset() can move the coarse hard-iron offset
+ * into the device's OFFSET registers. The fit keeps working in the
+ * uncorrected frame by adding the programmed offset back to each sample,
+ * chosen by sequence number so conversions still in the ring from before
+ * the write are handled correctly, and the published `hard_iron` shrinks
+ * to the residual. Restart the fit after changing the full scale.
+ */
+
+typedef struct {
+    uint16_t min_samples;    /* Before the first fit */
+    uint16_t fit_interval;   /* Samples between fits */
+    uint32_t window_samples; /* Forgetting time constant; 0 keeps all */
+    float max_error;         /* Largest RMS radius error, relative */
+    float min_coverage;      /* Smallest spread of orientations, 0 to 1 */
+} lis3mdl_calibrate_config_t;
+
+/* Quality of the latest accepted fit, and how many were tried */
+typedef struct {
+    bool valid;
+    float error;        /* RMS radius error, relative to the radius */
+    float coverage;     /* Least spread of the samples, 1 for a full sphere */
+    float field_gauss;  /* Field strength the corrected output reads */
+    uint32_t samples;   /* Fed before the accepted fit */
+    uint32_t fits;
+    uint32_t rejected;
+} lis3mdl_calibrate_fit_t;
+
+typedef struct {
+    lis3mdl_ring_index_t version; /* Odd while a fit is being published */
+
+    lis3mdl_dev_t *dev;
+    lis3mdl_calibrate_config_t config;
+    double gauss_per_lsb;
+    double forget;
+
+    /* Weighted normal equations, upper triangle, and the sample weight */
+    double moments[9][9];
+    double targets[9];
+    double weight;
+    uint32_t samples;
+    uint16_t since_fit;
+
+    /* Programmed device offset, and the one before the latest write */
+    int16_t offset[3];
+    int16_t previous_offset[3];
+    uint16_t offset_sequence;
+    bool offset_written;
+
+    double center_gauss[3]; /* In the uncorrected frame */
+    lis3mdl_calib_t calib;
+    lis3mdl_calibrate_fit_t fit;
+} lis3mdl_calibrate_t;
+
+/*
+ * At least 200 samples before the first fit, a fit every 50 samples, no
+ * forgetting, at most 5 % radius error and a coverage of 0.2.
+ */
+void lis3mdl_calibrate_default_config(lis3mdl_calibrate_config_t *config);
+
+/*
+ * Start fitting samples from `dev`, whose OFFSET registers are taken to
+ * be zero. The published calibration is the identity until a fit passes.
+ */
+status_t lis3mdl_calibrate_init(
+    lis3mdl_calibrate_t *calibrate,
+    lis3mdl_dev_t *dev,
+    const lis3mdl_calibrate_config_t *config);
+
+/* Forget the samples, e.g. after a full-scale change; keep the offset */
+void lis3mdl_calibrate_restart(lis3mdl_calibrate_t *calibrate);
+
+/*
+ * Account for `count` samples drained from the ring, refitting when the
+ * interval is reached. Returns true if a new calibration was published.
+ */
+bool lis3mdl_calibrate_feed(
+    lis3mdl_calibrate_t *calibrate,
+    const lis3mdl_sample_t *samples,
+    size_t count);
+
+/* Consistent snapshot of the calibration and its fit, from any context */
+void lis3mdl_calibrate_get(
+    lis3mdl_calibrate_t *calibrate,
+    lis3mdl_calib_t *calib,
+    lis3mdl_calibrate_fit_t *fit);
+
+/*
+ * Program the fitted hard-iron offset, rounded to LSB, into the device with
+ * lis3mdl_set_offset() and republish the calibration with the residual.
+ * Blocks on the bus, so call from task context. STATUS_ERROR until a fit
+ * has been accepted.
+ */
+status_t lis3mdl_calibrate_write_offset(lis3mdl_calibrate_t *calibrate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
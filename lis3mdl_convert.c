@@ -0,0 +1,271 @@
+#include "lis3mdl_convert.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Every kernel must round after each multiply and add, exactly like the
+ * scalar reference, so contraction into fused multiply-add is disabled.
+ */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+/* Samples deinterleaved per step of lis3mdl_convert_batch */
+#define BLOCK_SIZE 64
+
+uint16_t lis3mdl_lsb_per_gauss(lis3mdl_full_scale_t full_scale)
+{
+    static const uint16_t sensitivity[] = {6842, 3421, 2281, 1711};
+
+    if (full_scale > LIS3MDL_FULL_SCALE_16_GAUSS) {
+        return 0;
+    }
+    return sensitivity[full_scale];
+}
+
+void lis3mdl_calib_init(
+    lis3mdl_calib_t *calib,
+    lis3mdl_full_scale_t full_scale)
+{
+    calib->gauss_per_lsb = 1.0f / (float)lis3mdl_lsb_per_gauss(full_scale);
+    for (size_t r = 0; r < 3; ++r) {
+        calib->hard_iron[r] = 0.0f;
+        for (size_t c = 0; c < 3; ++c) {
+            calib->soft_iron[r][c] = r == c ? 1.0f : 0.0f;
+        }
+    }
+}
+
+void lis3mdl_convert_sample(
+    const int16_t raw_xyz[3],
+    float out[3],
+    const lis3mdl_calib_t *calib)
+{
+    float c[3];
+
+    for (size_t i = 0; i < 3; ++i) {
+        float g = (float)raw_xyz[i] * calib->gauss_per_lsb;
+        c[i] = g - calib->hard_iron[i];
+    }
+
+    for (size_t r = 0; r < 3; ++r) {
+        float sum = calib->soft_iron[r][0] * c[0];
+        sum = sum + calib->soft_iron[r][1] * c[1];
+        sum = sum + calib->soft_iron[r][2] * c[2];
+        out[r] = sum;
+    }
+}
+
+static void convert_scalar(
+    const int16_t *const raw[3],
+    size_t begin,
+    size_t end,
+    float *const out[3],
+    const lis3mdl_calib_t *calib)
+{
+    for (size_t i = begin; i < end; ++i) {
+        const int16_t sample[3] = {raw[0][i], raw[1][i], raw[2][i]};
+        float result[3];
+
+        lis3mdl_convert_sample(sample, result, calib);
+        out[0][i] = result[0];
+        out[1][i] = result[1];
+        out[2][i] = result[2];
+    }
+}
+
+#if defined(__AVX2__)
+
+#define LANES 8
+
+static size_t convert_simd(
+    const int16_t *const raw[3],
+    size_t n,
+    float *const out[3],
+    const lis3mdl_calib_t *calib)
+{
+    const __m256 scale = _mm256_set1_ps(calib->gauss_per_lsb);
+    __m256 offset[3];
+    __m256 m[3][3];
+    size_t i = 0;
+
+    for (size_t r = 0; r < 3; ++r) {
+        offset[r] = _mm256_set1_ps(calib->hard_iron[r]);
+        for (size_t c = 0; c < 3; ++c) {
+            m[r][c] = _mm256_set1_ps(calib->soft_iron[r][c]);
+        }
+    }
+
+    for (; i + LANES <= n; i += LANES) {
+        __m256 c[3];
+
+        for (size_t a = 0; a < 3; ++a) {
+            __m128i v = _mm_loadu_si128((const __m128i *)&raw[a][i]);
+            __m256 g = _mm256_mul_ps(
+                _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)),
+                scale);
+            c[a] = _mm256_sub_ps(g, offset[a]);
+        }
+
+        for (size_t r = 0; r < 3; ++r) {
+            __m256 sum = _mm256_mul_ps(m[r][0], c[0]);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(m[r][1], c[1]));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(m[r][2], c[2]));
+            _mm256_storeu_ps(&out[r][i], sum);
+        }
+    }
+    return i;
+}
+
+#elif defined(__SSE2__)
+
+#define LANES 4
+
+static size_t convert_simd(
+    const int16_t *const raw[3],
+    size_t n,
+    float *const out[3],
+    const lis3mdl_calib_t *calib)
+{
+    const __m128 scale = _mm_set1_ps(calib->gauss_per_lsb);
+    __m128 offset[3];
+    __m128 m[3][3];
+    size_t i = 0;
+
+    for (size_t r = 0; r < 3; ++r) {
+        offset[r] = _mm_set1_ps(calib->hard_iron[r]);
+        for (size_t c = 0; c < 3; ++c) {
+            m[r][c] = _mm_set1_ps(calib->soft_iron[r][c]);
+        }
+    }
+
+    for (; i + LANES <= n; i += LANES) {
+        __m128 c[3];
+
+        for (size_t a = 0; a < 3; ++a) {
+            __m128i v = _mm_loadl_epi64((const __m128i *)&raw[a][i]);
+            /* Sign-extend by placing each word in the top half, then shift */
+            __m128i words = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            __m128 g = _mm_mul_ps(_mm_cvtepi32_ps(words), scale);
+            c[a] = _mm_sub_ps(g, offset[a]);
+        }
+
+        for (size_t r = 0; r < 3; ++r) {
+            __m128 sum = _mm_mul_ps(m[r][0], c[0]);
+            sum = _mm_add_ps(sum, _mm_mul_ps(m[r][1], c[1]));
+            sum = _mm_add_ps(sum, _mm_mul_ps(m[r][2], c[2]));
+            _mm_storeu_ps(&out[r][i], sum);
+        }
+    }
+    return i;
+}
+
+#elif defined(__ARM_NEON)
+
+#define LANES 4
+
+static size_t convert_simd(
+    const int16_t *const raw[3],
+    size_t n,
+    float *const out[3],
+    const lis3mdl_calib_t *calib)
+{
+    const float32x4_t scale = vdupq_n_f32(calib->gauss_per_lsb);
+    float32x4_t offset[3];
+    float32x4_t m[3][3];
+    size_t i = 0;
+
+    for (size_t r = 0; r < 3; ++r) {
+        offset[r] = vdupq_n_f32(calib->hard_iron[r]);
+        for (size_t c = 0; c < 3; ++c) {
+            m[r][c] = vdupq_n_f32(calib->soft_iron[r][c]);
+        }
+    }
+
+    for (; i + LANES <= n; i += LANES) {
+        float32x4_t c[3];
+
+        for (size_t a = 0; a < 3; ++a) {
+            int32x4_t words = vmovl_s16(vld1_s16(&raw[a][i]));
+            float32x4_t g = vmulq_f32(vcvtq_f32_s32(words), scale);
+            c[a] = vsubq_f32(g, offset[a]);
+        }
+
+        /* Separate multiply and add; vmlaq_f32 may be fused */
+        for (size_t r = 0; r < 3; ++r) {
+            float32x4_t sum = vmulq_f32(m[r][0], c[0]);
+            sum = vaddq_f32(sum, vmulq_f32(m[r][1], c[1]));
+            sum = vaddq_f32(sum, vmulq_f32(m[r][2], c[2]));
+            vst1q_f32(&out[r][i], sum);
+        }
+    }
+    return i;
+}
+
+#else
+
+static size_t convert_simd(
+    const int16_t *const raw[3],
+    size_t n,
+    float *const out[3],
+    const lis3mdl_calib_t *calib)
+{
+    (void)raw;
+    (void)n;
+    (void)out;
+    (void)calib;
+    return 0;
+}
+
+#endif
+
+void lis3mdl_convert_batch_soa(
+    const int16_t *const raw[3],
+    size_t n,
+    float *const out[3],
+    const lis3mdl_calib_t *calib)
+{
+    size_t done = convert_simd(raw, n, out, calib);
+    convert_scalar(raw, done, n, out, calib);
+}
+
+void lis3mdl_convert_batch(
+    const int16_t *raw_xyz,
+    size_t n,
+    float *out,
+    const lis3mdl_calib_t *calib)
+{
+    int16_t raw_block[3][BLOCK_SIZE];
+    float out_block[3][BLOCK_SIZE];
+    const int16_t *const raw_soa[3] = {raw_block[0], raw_block[1], raw_block[2]};
+    float *const out_soa[3] = {out_block[0], out_block[1], out_block[2]};
+
+    for (size_t base = 0; base < n; base += BLOCK_SIZE) {
+        size_t count = n - base < BLOCK_SIZE ? n - base : BLOCK_SIZE;
+
+        for (size_t i = 0; i < count; ++i) {
+            for (size_t a = 0; a < 3; ++a) {
+                raw_block[a][i] = raw_xyz[3 * (base + i) + a];
+            }
+        }
+
+        lis3mdl_convert_batch_soa(raw_soa, count, out_soa, calib);
+
+        for (size_t i = 0; i < count; ++i) {
+            for (size_t a = 0; a < 3; ++a) {
+                out[3 * (base + i) + a] = out_block[a][i];
+            }
+        }
+    }
+}
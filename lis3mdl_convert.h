@@ -0,0 +1,71 @@
+#ifndef LIS3MDL_CONVERT_HEADER_H
+#define LIS3MDL_CONVERT_HEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lis3mdl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Conversion from raw output to calibrated field:
+ *
+ *     g   = raw * gauss_per_lsb
+ *     c   = g - hard_iron
+ *     out = soft_iron * c
+ *
+ * evaluated in single precision in exactly that order, with each row of the
+ * matrix product summed left to right. Scale `soft_iron` by 100 for
+ * microtesla output.
+ */
+typedef struct {
+    float gauss_per_lsb;
+    float hard_iron[3];
+    float soft_iron[3][3]; /* Row-major */
+} lis3mdl_calib_t;
+
+/* Sensitivity of a full-scale setting, in LSB/gauss */
+uint16_t lis3mdl_lsb_per_gauss(lis3mdl_full_scale_t full_scale);
+
+/* Identity calibration for `full_scale`: no offset, unit matrix */
+void lis3mdl_calib_init(
+    lis3mdl_calib_t *calib,
+    lis3mdl_full_scale_t full_scale);
+
+/* Reference conversion of one sample */
+void lis3mdl_convert_sample(
+    const int16_t raw_xyz[3],
+    float out[3],
+    const lis3mdl_calib_t *calib);
+
+/*
+ * Convert `n` interleaved raw triples into `n` interleaved float triples.
+ * Samples are deinterleaved into blocks and run through the same kernel as
+ * lis3mdl_convert_batch_soa. Results are bit-exact with
+ * lis3mdl_convert_sample on every kernel.
+ */
+void lis3mdl_convert_batch(
+    const int16_t *raw_xyz,
+    size_t n,
+    float *out,
+    const lis3mdl_calib_t *calib);
+
+/*
+ * Convert `n` samples held as separate X, Y and Z channel arrays. The kernel
+ * is chosen at build time: AVX2, SSE2 or NEON when the compiler targets
+ * them, scalar otherwise.
+ */
+void lis3mdl_convert_batch_soa(
+    const int16_t *const raw[3],
+    size_t n,
+    float *const out[3],
+    const lis3mdl_calib_t *calib);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
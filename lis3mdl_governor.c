@@ -0,0 +1,150 @@
+#include "lis3mdl_governor.h"
+
+#include "lis3mdl_convert.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static const lis3mdl_governor_level_t default_levels[] = {
+    {LIS3MDL_ODR_5_HZ, LIS3MDL_OP_MODE_LOW_POWER},
+    {LIS3MDL_ODR_20_HZ, LIS3MDL_OP_MODE_MEDIUM_PERFORMANCE},
+    {LIS3MDL_ODR_80_HZ, LIS3MDL_OP_MODE_HIGH_PERFORMANCE},
+    {LIS3MDL_ODR_FAST, LIS3MDL_OP_MODE_ULTRA_HIGH_PERFORMANCE},
+};
+
+void lis3mdl_governor_default_config(lis3mdl_governor_config_t *config)
+{
+    config->levels = default_levels;
+    config->level_count = sizeof(default_levels) / sizeof(default_levels[0]);
+    config->window_samples = 16;
+    config->raise_mgauss = 5.0f;
+    config->lower_mgauss = 2.0f;
+    config->lower_windows = 4;
+}
+
+static void reset_window(lis3mdl_governor_t *governor)
+{
+    governor->count = 0;
+    for (size_t axis = 0; axis < 3; ++axis) {
+        governor->mean[axis] = 0.0f;
+        governor->m2[axis] = 0.0f;
+    }
+}
+
+static status_t apply_level(
+    lis3mdl_governor_t *governor,
+    size_t level)
+{
+    const lis3mdl_governor_level_t *target = &governor->config.levels[level];
+    lis3mdl_config_t config;
+
+    lis3mdl_get_config(governor->dev, &config);
+    config.odr = target->odr;
+    config.xy_mode = target->op_mode;
+    config.z_mode = target->op_mode;
+
+    status_t status = lis3mdl_apply_config(governor->dev, &config);
+    if (status == STATUS_OK) {
+        if (level != governor->level) {
+            governor->changes++;
+        }
+        governor->level = level;
+    }
+    return status;
+}
+
+status_t lis3mdl_governor_init(
+    lis3mdl_governor_t *governor,
+    lis3mdl_dev_t *dev,
+    const lis3mdl_governor_config_t *config,
+    size_t level)
+{
+    if (config->level_count == 0 || level >= config->level_count
+        || config->window_samples < 2
+        || config->lower_mgauss > config->raise_mgauss) {
+        return STATUS_ERROR;
+    }
+
+    governor->dev = dev;
+    governor->config = *config;
+    governor->level = level;
+    governor->have_previous = false;
+    governor->quiet_windows = 0;
+    governor->changes = 0;
+    reset_window(governor);
+
+    return apply_level(governor, level);
+}
+
+/* Squared activity threshold in LSB^2 at the current full scale */
+static float threshold_lsb2(
+    lis3mdl_governor_t *governor,
+    float mgauss)
+{
+    lis3mdl_full_scale_t full_scale;
+    float lsb;
+
+    lis3mdl_get_full_scale(governor->dev, &full_scale);
+    lsb = mgauss * 0.001f * (float)lis3mdl_lsb_per_gauss(full_scale);
+    return lsb * lsb;
+}
+
+status_t lis3mdl_governor_feed(
+    lis3mdl_governor_t *governor,
+    const int16_t xyz[3])
+{
+    float variance = 0.0f;
+    float shift = 0.0f;
+
+    governor->count++;
+    for (size_t axis = 0; axis < 3; ++axis) {
+        float value = (float)xyz[axis];
+        float delta = value - governor->mean[axis];
+        governor->mean[axis] += delta / (float)governor->count;
+        governor->m2[axis] += delta * (value - governor->mean[axis]);
+    }
+    if (governor->count < governor->config.window_samples) {
+        return STATUS_OK;
+    }
+
+    for (size_t axis = 0; axis < 3; ++axis) {
+        variance += governor->m2[axis] / (float)governor->count;
+        if (governor->have_previous) {
+            float d = governor->mean[axis] - governor->previous_mean[axis];
+            shift += d * d;
+        }
+        governor->previous_mean[axis] = governor->mean[axis];
+    }
+    governor->have_previous = true;
+    reset_window(governor);
+
+    float activity = variance > shift ? variance : shift;
+    size_t level = governor->level;
+
+    if (activity > threshold_lsb2(governor, governor->config.raise_mgauss)) {
+        governor->quiet_windows = 0;
+        if (level + 1 < governor->config.level_count) {
+            level++;
+        }
+    } else if (activity < threshold_lsb2(governor, governor->config.lower_mgauss)) {
+        if (++governor->quiet_windows >= governor->config.lower_windows) {
+            governor->quiet_windows = 0;
+            if (level > 0) {
+                level--;
+            }
+        }
+    } else {
+        governor->quiet_windows = 0;
+    }
+
+    if (level == governor->level) {
+        return STATUS_OK;
+    }
+    return apply_level(governor, level);
+}
+
+size_t lis3mdl_governor_level(const lis3mdl_governor_t *governor)
+{
+    return governor->level;
+}
@@ -0,0 +1,87 @@
+#ifndef LIS3MDL_GOVERNOR_HEADER_H
+#define LIS3MDL_GOVERNOR_HEADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2c.h"
+#include "lis3mdl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One rung of the governor ladder; OM and OMZ get the same mode */
+typedef struct {
+    lis3mdl_odr_t odr;
+    lis3mdl_op_mode_t op_mode;
+} lis3mdl_governor_level_t;
+
+/*
+ * The governor splits the sample stream into windows. A window's activity
+ * is the larger of the RMS deviation of its samples and the shift of its
+ * mean from the previous window, so a steady rotation counts as well as
+ * vibration. An active window climbs one level at once. Stepping down
+ * needs `lower_windows` quiet windows in a row, and the quiet threshold is
+ * below the active one, so a signal near either threshold cannot make the
+ * governor oscillate.
+ */
+typedef struct {
+    const lis3mdl_governor_level_t *levels; /* Slowest first */
+    size_t level_count;
+    uint16_t window_samples;
+    float raise_mgauss;   /* Activity above this raises the level */
+    float lower_mgauss;   /* Activity below this counts as quiet */
+    uint8_t lower_windows;
+} lis3mdl_governor_config_t;
+
+typedef struct {
+    lis3mdl_dev_t *dev;
+    lis3mdl_governor_config_t config;
+    size_t level;
+
+    /* Running window statistics (Welford), in LSB */
+    uint16_t count;
+    float mean[3];
+    float m2[3];
+    float previous_mean[3];
+    bool have_previous;
+
+    uint8_t quiet_windows;
+    uint32_t changes;
+} lis3mdl_governor_t;
+
+/*
+ * Four levels from 5 Hz low-power to FAST_ODR ultra-high-performance
+ * (155 Hz), 16-sample windows, raise above 5 mgauss, and lower after four
+ * windows under 2 mgauss.
+ */
+void lis3mdl_governor_default_config(lis3mdl_governor_config_t *config);
+
+/* Take control of `dev`'s rate and operating mode, starting at `level` */
+status_t lis3mdl_governor_init(
+    lis3mdl_governor_t *governor,
+    lis3mdl_dev_t *dev,
+    const lis3mdl_governor_config_t *config,
+    size_t level);
+
+/*
+ * Account for one sample, and at the end of a window move the device to a
+ * new level if needed. The change goes through lis3mdl_apply_config(),
+ * which writes only CTRL_REG1..CTRL_REG4 when they differ. Conversion and
+ * any running acquisition continue, so no sample is dropped. Blocks on the
+ * bus when it changes level, so call from task context, e.g. while draining
+ * the ring, not from a completion callback.
+ */
+status_t lis3mdl_governor_feed(
+    lis3mdl_governor_t *governor,
+    const int16_t xyz[3]);
+
+size_t lis3mdl_governor_level(const lis3mdl_governor_t *governor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
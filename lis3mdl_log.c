@@ -0,0 +1,314 @@
+#include "lis3mdl_log.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static const uint8_t magic[4] = {'L', '3', 'M', 'B'};
+
+static void put16(
+    uint8_t *out,
+    uint16_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(
+    uint8_t *out,
+    uint32_t value)
+{
+    put16(out, (uint16_t)value);
+    put16(out + 2, (uint16_t)(value >> 16));
+}
+
+static uint16_t get16(const uint8_t *in)
+{
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static uint32_t get32(const uint8_t *in)
+{
+    return get16(in) | ((uint32_t)get16(in + 2) << 16);
+}
+
+static uint16_t crc16(
+    const uint8_t *data,
+    size_t length)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= (uint16_t)(data[i] << 8);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static size_t put_varint(
+    uint8_t *out,
+    uint32_t value)
+{
+    size_t n = 0;
+
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+/* Returns the bytes consumed, or 0 if the varint runs past `end` or 32 bits */
+static size_t get_varint(
+    const uint8_t *in,
+    const uint8_t *end,
+    uint32_t *value)
+{
+    uint32_t result = 0;
+
+    for (size_t n = 0; n < 5 && in + n < end; ++n) {
+        result |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+        if (!(in[n] & 0x80)) {
+            *value = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+void lis3mdl_log_init(
+    lis3mdl_log_writer_t *writer,
+    lis3mdl_log_sink_t sink,
+    void *context)
+{
+    writer->used = 0;
+    writer->count = 0;
+    writer->sequence = 0;
+    writer->ctrl_reg1 = 0;
+    writer->ctrl_reg2 = 0;
+    writer->sink = sink;
+    writer->context = context;
+}
+
+status_t lis3mdl_log_flush(lis3mdl_log_writer_t *writer)
+{
+    uint8_t *header = writer->block;
+    size_t payload_size = writer->used - LIS3MDL_LOG_HEADER_SIZE;
+
+    if (writer->count == 0) {
+        return STATUS_OK;
+    }
+
+    put16(&header[12], writer->count);
+    put16(&header[14], (uint16_t)payload_size);
+    put16(&header[26], crc16(&header[LIS3MDL_LOG_HEADER_SIZE], payload_size));
+
+    status_t status = writer->sink(writer->context, writer->block, writer->used);
+    writer->used = 0;
+    writer->count = 0;
+    writer->sequence++;
+    return status;
+}
+
+status_t lis3mdl_log_set_config(
+    lis3mdl_log_writer_t *writer,
+    uint8_t ctrl_reg1,
+    uint8_t ctrl_reg2)
+{
+    status_t status = STATUS_OK;
+
+    if (ctrl_reg1 != writer->ctrl_reg1 || ctrl_reg2 != writer->ctrl_reg2) {
+        status = lis3mdl_log_flush(writer);
+        writer->ctrl_reg1 = ctrl_reg1;
+        writer->ctrl_reg2 = ctrl_reg2;
+    }
+    return status;
+}
+
+status_t lis3mdl_log_set_device_config(
+    lis3mdl_log_writer_t *writer,
+    const lis3mdl_dev_t *dev)
+{
+    return lis3mdl_log_set_config(writer, dev->shadow.ctrl[0], dev->shadow.ctrl[1]);
+}
+
+status_t lis3mdl_log_append(
+    lis3mdl_log_writer_t *writer,
+    const lis3mdl_sample_t *sample)
+{
+    uint8_t *out = writer->block;
+
+    if (writer->count == 0) {
+        out[0] = magic[0];
+        out[1] = magic[1];
+        out[2] = magic[2];
+        out[3] = magic[3];
+        out[4] = LIS3MDL_LOG_VERSION;
+        out[5] = LIS3MDL_LOG_HEADER_SIZE;
+        out[6] = writer->ctrl_reg1;
+        out[7] = writer->ctrl_reg2;
+        put32(&out[8], writer->sequence);
+        put32(&out[16], sample->timestamp);
+        put16(&out[20], (uint16_t)sample->x);
+        put16(&out[22], (uint16_t)sample->y);
+        put16(&out[24], (uint16_t)sample->z);
+        writer->used = LIS3MDL_LOG_HEADER_SIZE;
+    } else {
+        const lis3mdl_sample_t *previous = &writer->previous;
+
+        out += writer->used;
+        out += put_varint(out, sample->timestamp - previous->timestamp);
+        out += put_varint(out, zigzag((int32_t)sample->x - previous->x));
+        out += put_varint(out, zigzag((int32_t)sample->y - previous->y));
+        out += put_varint(out, zigzag((int32_t)sample->z - previous->z));
+        writer->used = (size_t)(out - writer->block);
+    }
+
+    writer->previous = *sample;
+    if (++writer->count == LIS3MDL_LOG_BLOCK_SAMPLES) {
+        return lis3mdl_log_flush(writer);
+    }
+    return STATUS_OK;
+}
+
+status_t lis3mdl_log_append_soa(
+    lis3mdl_log_writer_t *writer,
+    const lis3mdl_soa_block_t *block)
+{
+    status_t status = STATUS_OK;
+
+    for (uint32_t i = 0; i < block->count && status == STATUS_OK; ++i) {
+        const lis3mdl_sample_t sample = {
+            .x = block->x[i],
+            .y = block->y[i],
+            .z = block->z[i],
+            .sequence = block->sequence[i],
+            .timestamp = block->timestamp[i],
+        };
+        status = lis3mdl_log_append(writer, &sample);
+    }
+    return status;
+}
+
+status_t lis3mdl_log_parse_header(
+    const uint8_t *data,
+    size_t size,
+    lis3mdl_log_header_t *header)
+{
+    if (size < LIS3MDL_LOG_HEADER_SIZE
+        || data[0] != magic[0] || data[1] != magic[1]
+        || data[2] != magic[2] || data[3] != magic[3]
+        || data[4] != LIS3MDL_LOG_VERSION
+        || data[5] != LIS3MDL_LOG_HEADER_SIZE) {
+        return STATUS_ERROR;
+    }
+
+    header->ctrl_reg1 = data[6];
+    header->ctrl_reg2 = data[7];
+    header->sequence = get32(&data[8]);
+    header->count = get16(&data[12]);
+    header->payload_size = get16(&data[14]);
+    header->first.timestamp = get32(&data[16]);
+    header->first.x = (int16_t)get16(&data[20]);
+    header->first.y = (int16_t)get16(&data[22]);
+    header->first.z = (int16_t)get16(&data[24]);
+    header->first.sequence = 0;
+    header->crc = get16(&data[26]);
+
+    if (header->count == 0 || lis3mdl_log_block_size(header) > size) {
+        return STATUS_ERROR;
+    }
+    return STATUS_OK;
+}
+
+size_t lis3mdl_log_block_size(const lis3mdl_log_header_t *header)
+{
+    return LIS3MDL_LOG_HEADER_SIZE + (size_t)header->payload_size;
+}
+
+static bool has_magic(
+    const uint8_t *data,
+    size_t size)
+{
+    return size >= sizeof(magic) && memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+size_t lis3mdl_log_find_block(
+    const uint8_t *data,
+    size_t size,
+    size_t offset,
+    lis3mdl_log_header_t *header)
+{
+    for (; offset < size; ++offset) {
+        if (lis3mdl_log_parse_header(data + offset, size - offset, header) != STATUS_OK) {
+            continue;
+        }
+
+        size_t end = offset + lis3mdl_log_block_size(header);
+
+        if (end == size || has_magic(data + end, size - end)
+            || crc16(data + offset + LIS3MDL_LOG_HEADER_SIZE, header->payload_size)
+                   == header->crc) {
+            return offset;
+        }
+    }
+    return size;
+}
+
+status_t lis3mdl_log_decode(
+    const uint8_t *data,
+    size_t size,
+    lis3mdl_sample_t *out,
+    size_t capacity,
+    lis3mdl_log_header_t *header)
+{
+    status_t status = lis3mdl_log_parse_header(data, size, header);
+
+    if (status != STATUS_OK) {
+        return status;
+    }
+    if (header->count > capacity) {
+        return STATUS_ERROR;
+    }
+
+    const uint8_t *in = data + LIS3MDL_LOG_HEADER_SIZE;
+    const uint8_t *end = in + header->payload_size;
+
+    if (crc16(in, header->payload_size) != header->crc) {
+        return STATUS_ERROR;
+    }
+
+    lis3mdl_sample_t sample = header->first;
+    out[0] = sample;
+    for (size_t i = 1; i < header->count; ++i) {
+        uint32_t fields[4];
+
+        for (size_t f = 0; f < 4; ++f) {
+            size_t n = get_varint(in, end, &fields[f]);
+            if (n == 0) {
+                return STATUS_ERROR;
+            }
+            in += n;
+        }
+        sample.timestamp += fields[0];
+        sample.x = (int16_t)(sample.x + unzigzag(fields[1]));
+        sample.y = (int16_t)(sample.y + unzigzag(fields[2]));
+        sample.z = (int16_t)(sample.z + unzigzag(fields[3]));
+        out[i] = sample;
+    }
+    return in == end ? STATUS_OK : STATUS_ERROR;
+}
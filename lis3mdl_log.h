@@ -0,0 +1,155 @@
+#ifndef LIS3MDL_LOG_HEADER_H
+#define LIS3MDL_LOG_HEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2c.h"
+#include "lis3mdl.h"
+#include "lis3mdl_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compact sample log. A log is a plain concatenation of self-contained
+ * blocks, so it can be appended to flash or a file and cut anywhere on a
+ * block boundary. Each block is a fixed little-endian header followed by a
+ * varint payload:
+ *
+ *     0  magic "L3MB"
+ *     4  format version
+ *     5  header size
+ *     6  CTRL_REG1 and CTRL_REG2 in force for every sample in the block
+ *     8  block sequence number, incrementing from 0
+ *    12  sample count
+ *    14  payload size in bytes
+ *    16  timestamp, X, Y and Z of the first sample, stored verbatim
+ *    26  CRC-16/CCITT of the payload
+ *
+ * For each further sample the payload holds the timestamp delta as an
+ * unsigned varint, then the X, Y and Z deltas from the previous sample as
+ * zigzag varints. A slowly varying field sampled at a steady rate costs
+ * about five bytes per sample instead of ten. Because blocks share no
+ * state, a reader can index the headers and decode any block on its own.
+ * Conversion sequence numbers are not stored and decode as 0.
+ */
+
+#define LIS3MDL_LOG_VERSION     1
+#define LIS3MDL_LOG_HEADER_SIZE 28
+
+/* Samples per block; a configuration change also ends a block */
+#ifndef LIS3MDL_LOG_BLOCK_SAMPLES
+#define LIS3MDL_LOG_BLOCK_SAMPLES 256
+#endif
+
+/* Worst case per delta-coded sample: 5-byte timestamp, 3 bytes per axis */
+#define LIS3MDL_LOG_MAX_SAMPLE_BYTES 14
+
+#define LIS3MDL_LOG_MAX_BLOCK_BYTES                                           \
+    (LIS3MDL_LOG_HEADER_SIZE                                                  \
+     + (LIS3MDL_LOG_BLOCK_SAMPLES - 1) * LIS3MDL_LOG_MAX_SAMPLE_BYTES)
+
+#if LIS3MDL_LOG_BLOCK_SAMPLES < 1 || LIS3MDL_LOG_MAX_BLOCK_BYTES > 0xFFFF
+#error "LIS3MDL_LOG_BLOCK_SAMPLES out of range"
+#endif
+
+/* Receives each finished block; anything but STATUS_OK is passed back */
+typedef status_t (*lis3mdl_log_sink_t)(
+    void *context,
+    const uint8_t *block,
+    size_t length);
+
+typedef struct {
+    uint8_t block[LIS3MDL_LOG_MAX_BLOCK_BYTES];
+    size_t used;
+    uint16_t count;
+    uint32_t sequence;
+    uint8_t ctrl_reg1;
+    uint8_t ctrl_reg2;
+    lis3mdl_sample_t previous;
+
+    lis3mdl_log_sink_t sink;
+    void *context;
+} lis3mdl_log_writer_t;
+
+/* Decoded block header */
+typedef struct {
+    uint8_t ctrl_reg1;
+    uint8_t ctrl_reg2;
+    uint32_t sequence;
+    uint16_t count;
+    uint16_t payload_size;
+    uint16_t crc;
+    lis3mdl_sample_t first;
+} lis3mdl_log_header_t;
+
+void lis3mdl_log_init(
+    lis3mdl_log_writer_t *writer,
+    lis3mdl_log_sink_t sink,
+    void *context);
+
+/* Record the configuration of later samples, ending the block if it changed */
+status_t lis3mdl_log_set_config(
+    lis3mdl_log_writer_t *writer,
+    uint8_t ctrl_reg1,
+    uint8_t ctrl_reg2);
+
+/* As lis3mdl_log_set_config, from the driver's register shadow */
+status_t lis3mdl_log_set_device_config(
+    lis3mdl_log_writer_t *writer,
+    const lis3mdl_dev_t *dev);
+
+status_t lis3mdl_log_append(
+    lis3mdl_log_writer_t *writer,
+    const lis3mdl_sample_t *sample);
+
+status_t lis3mdl_log_append_soa(
+    lis3mdl_log_writer_t *writer,
+    const lis3mdl_soa_block_t *block);
+
+/* Hand a partial block to the sink */
+status_t lis3mdl_log_flush(lis3mdl_log_writer_t *writer);
+
+/*
+ * Parse the header at `data`. Returns STATUS_ERROR if the magic, version or
+ * sizes are wrong, or `size` does not cover the whole block.
+ */
+status_t lis3mdl_log_parse_header(
+    const uint8_t *data,
+    size_t size,
+    lis3mdl_log_header_t *header);
+
+/* Total size of the block described by `header` */
+size_t lis3mdl_log_block_size(const lis3mdl_log_header_t *header);
+
+/*
+ * Find the first block at or after `offset` and parse its header. A block
+ * whose end does not meet the end of the log or another block magic is
+ * accepted only if its CRC matches, so a block cut short when the log was
+ * written cannot claim the start of the block that follows it. Returns the
+ * block's offset, or `size` if there are no more blocks.
+ */
+size_t lis3mdl_log_find_block(
+    const uint8_t *data,
+    size_t size,
+    size_t offset,
+    lis3mdl_log_header_t *header);
+
+/*
+ * Decode the block at `data` into `out`, which must hold `header.count`
+ * samples. Fails on a CRC mismatch or a malformed payload.
+ */
+status_t lis3mdl_log_decode(
+    const uint8_t *data,
+    size_t size,
+    lis3mdl_sample_t *out,
+    size_t capacity,
+    lis3mdl_log_header_t *header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,257 @@
+#include "lis3mdl_manager.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+void lis3mdl_manager_init(lis3mdl_manager_t *manager)
+{
+    manager->count = 0;
+    for (size_t bus = 0; bus < I2C_BUS_COUNT; ++bus) {
+        manager->next[bus] = 0;
+        manager->chains[bus].status = STATUS_OK;
+    }
+    lis3mdl_manager_batch_default(&manager->batch);
+    manager->chains_submitted = 0;
+    manager->batched_reads = 0;
+}
+
+lis3mdl_dev_t *lis3mdl_manager_find(
+    lis3mdl_manager_t *manager,
+    uint8_t bus,
+    uint8_t bus_address)
+{
+    for (size_t i = 0; i < manager->count; ++i) {
+        lis3mdl_dev_t *dev = manager->devices[i];
+        if (dev->bus == bus && dev->bus_address == bus_address) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+status_t lis3mdl_manager_add(
+    lis3mdl_manager_t *manager,
+    lis3mdl_dev_t *dev)
+{
+    if (manager->count == LIS3MDL_MANAGER_MAX_DEVICES
+        || dev->bus >= I2C_BUS_COUNT
+        || lis3mdl_manager_find(manager, dev->bus, dev->bus_address) != NULL) {
+        return STATUS_ERROR;
+    }
+
+    manager->ready[manager->count] = false;
+    manager->devices[manager->count++] = dev;
+    return STATUS_OK;
+}
+
+/* The `rank`-th device on `bus`, counting from that bus's cursor */
+static lis3mdl_dev_t *nth_on_bus(
+    lis3mdl_manager_t *manager,
+    uint8_t bus,
+    size_t on_bus,
+    size_t rank)
+{
+    size_t wanted = (manager->next[bus] + rank) % on_bus;
+
+    for (size_t i = 0; i < manager->count; ++i) {
+        if (manager->devices[i]->bus != bus) {
+            continue;
+        }
+        if (wanted == 0) {
+            return manager->devices[i];
+        }
+        --wanted;
+    }
+    return NULL;
+}
+
+size_t lis3mdl_manager_sample_all(lis3mdl_manager_t *manager)
+{
+    size_t on_bus[I2C_BUS_COUNT] = {0};
+    size_t deepest = 0;
+    size_t queued = 0;
+
+    for (size_t i = 0; i < manager->count; ++i) {
+        size_t depth = ++on_bus[manager->devices[i]->bus];
+        if (depth > deepest) {
+            deepest = depth;
+        }
+    }
+
+    for (size_t rank = 0; rank < deepest; ++rank) {
+        for (uint8_t bus = 0; bus < I2C_BUS_COUNT; ++bus) {
+            if (rank >= on_bus[bus]) {
+                continue;
+            }
+
+            lis3mdl_dev_t *dev = nth_on_bus(manager, bus, on_bus[bus], rank);
+            if (dev->acquisition == LIS3MDL_ACQUISITION_OFF) {
+                continue;
+            }
+
+            uint32_t missed = dev->overruns.missed_data_ready;
+            lis3mdl_on_data_ready(dev);
+            if (dev->overruns.missed_data_ready == missed) {
+                ++queued;
+            }
+        }
+    }
+
+    for (uint8_t bus = 0; bus < I2C_BUS_COUNT; ++bus) {
+        if (on_bus[bus] > 0) {
+            manager->next[bus] = (uint8_t)((manager->next[bus] + 1) % on_bus[bus]);
+        }
+    }
+    return queued;
+}
+
+void lis3mdl_manager_batch_default(lis3mdl_manager_batch_t *batch)
+{
+    batch->poll_all = false;
+    batch->min_ready = 0;
+    batch->max_batch = LIS3MDL_MANAGER_MAX_DEVICES;
+}
+
+status_t lis3mdl_manager_set_batch(
+    lis3mdl_manager_t *manager,
+    const lis3mdl_manager_batch_t *batch)
+{
+    if (batch->max_batch == 0
+        || batch->max_batch > LIS3MDL_MANAGER_MAX_DEVICES
+        || batch->min_ready > LIS3MDL_MANAGER_MAX_DEVICES) {
+        return STATUS_ERROR;
+    }
+
+    manager->batch = *batch;
+    return STATUS_OK;
+}
+
+static size_t flush_bus(
+    lis3mdl_manager_t *manager,
+    uint8_t bus);
+
+static size_t ready_on_bus(
+    lis3mdl_manager_t *manager,
+    uint8_t bus)
+{
+    size_t ready = 0;
+
+    for (size_t i = 0; i < manager->count; ++i) {
+        ready += manager->devices[i]->bus == bus && manager->ready[i];
+    }
+    return ready;
+}
+
+static void set_ready(
+    lis3mdl_manager_t *manager,
+    lis3mdl_dev_t *dev)
+{
+    for (size_t i = 0; i < manager->count; ++i) {
+        if (manager->devices[i] == dev) {
+            manager->ready[i] = true;
+        }
+    }
+}
+
+static void chain_complete(i2c_transaction_t *transaction)
+{
+    lis3mdl_manager_t *manager = transaction->context;
+    uint8_t bus = transaction->bus;
+    lis3mdl_dev_t **devices = manager->chain_devices[bus];
+
+    for (size_t i = 0; i < transaction->msg_count; ++i) {
+        lis3mdl_batch_complete(devices[i], transaction->status);
+    }
+
+    /* Devices that became ready during the chain go out straight away */
+    if (manager->batch.min_ready != 0
+        && ready_on_bus(manager, bus) >= manager->batch.min_ready) {
+        flush_bus(manager, bus);
+    }
+}
+
+/* Chain the reads of the ready devices on `bus`, from its cursor */
+static size_t flush_bus(
+    lis3mdl_manager_t *manager,
+    uint8_t bus)
+{
+    i2c_transaction_t *chain = &manager->chains[bus];
+    i2c_msg_t *msgs = manager->chain_msgs[bus];
+    lis3mdl_dev_t **devices = manager->chain_devices[bus];
+    size_t on_bus = 0;
+    size_t count = 0;
+
+    if (chain->status == STATUS_PENDING) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < manager->count; ++i) {
+        on_bus += manager->devices[i]->bus == bus;
+    }
+
+    for (size_t rank = 0; rank < on_bus && count < manager->batch.max_batch;
+         ++rank) {
+        lis3mdl_dev_t *dev = nth_on_bus(manager, bus, on_bus, rank);
+        size_t index = 0;
+
+        while (manager->devices[index] != dev) {
+            ++index;
+        }
+        if (!manager->ready[index] && !manager->batch.poll_all) {
+            continue;
+        }
+        if (lis3mdl_batch_prepare(dev, &msgs[count]) != STATUS_OK) {
+            continue;
+        }
+        manager->ready[index] = false;
+        devices[count++] = dev;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    chain->bus = bus;
+    chain->msgs = msgs;
+    chain->msg_count = count;
+    chain->callback = chain_complete;
+    chain->context = manager;
+
+    /* Nothing was read if the queue refuses: flag the devices again */
+    status_t status = i2c_transfer_async(chain);
+    if (status != STATUS_OK) {
+        for (size_t i = 0; i < count; ++i) {
+            lis3mdl_batch_cancel(devices[i]);
+            set_ready(manager, devices[i]);
+        }
+        return 0;
+    }
+
+    manager->next[bus] = (uint8_t)((manager->next[bus] + 1) % on_bus);
+    manager->chains_submitted++;
+    manager->batched_reads += (uint32_t)count;
+    return count;
+}
+
+void lis3mdl_manager_on_data_ready(
+    lis3mdl_manager_t *manager,
+    lis3mdl_dev_t *dev)
+{
+    lis3mdl_batch_data_ready(dev);
+    set_ready(manager, dev);
+
+    if (manager->batch.min_ready != 0
+        && ready_on_bus(manager, dev->bus) >= manager->batch.min_ready) {
+        flush_bus(manager, dev->bus);
+    }
+}
+
+size_t lis3mdl_manager_flush(lis3mdl_manager_t *manager)
+{
+    size_t queued = 0;
+
+    for (uint8_t bus = 0; bus < I2C_BUS_COUNT; ++bus) {
+        queued += flush_bus(manager, bus);
+    }
+    return queued;
+}
@@ -0,0 +1,115 @@
+#ifndef LIS3MDL_MANAGER_HEADER_H
+#define LIS3MDL_MANAGER_HEADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2c.h"
+#include "lis3mdl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of devices one manager schedules */
+#ifndef LIS3MDL_MANAGER_MAX_DEVICES
+#define LIS3MDL_MANAGER_MAX_DEVICES 8
+#endif
+
+/*
+ * Batching knobs. A chain carries up to `max_batch` reads; a longer chain
+ * costs fewer START/address/STOP sequences and less software per sample,
+ * but holds the bus longer and delays the first device's sample until the
+ * whole chain completes. `min_ready` also trades latency for throughput:
+ * at 1 every data-ready flushes its bus at once, higher values wait for
+ * more devices, and 0 leaves flushing to lis3mdl_manager_flush() on the
+ * tick. DRDY stays high until a sample is read, so above 1 keep flushing on
+ * a tick shorter than the output period; otherwise a device waiting for
+ * slower partners loses its next sample to an overrun.
+ */
+typedef struct {
+    bool poll_all;       /* Also read devices not flagged ready */
+    uint8_t min_ready;   /* Ready devices on a bus that flush it early */
+    uint8_t max_batch;   /* Reads per chain, 1..LIS3MDL_MANAGER_MAX_DEVICES */
+} lis3mdl_manager_batch_t;
+
+/*
+ * Scheduler for several LIS3MDL devices spread over one or more I2C
+ * controllers. Devices keep their own handle and acquisition mode; the
+ * manager only decides the order in which their sample reads are queued.
+ */
+typedef struct {
+    lis3mdl_dev_t *devices[LIS3MDL_MANAGER_MAX_DEVICES];
+    size_t count;
+
+    /* Per-bus round-robin cursor, so no device is always queued last */
+    uint8_t next[I2C_BUS_COUNT];
+
+    /* Batched reads: ready flags, and one chain in flight per bus */
+    lis3mdl_manager_batch_t batch;
+    volatile bool ready[LIS3MDL_MANAGER_MAX_DEVICES];
+    i2c_transaction_t chains[I2C_BUS_COUNT];
+    i2c_msg_t chain_msgs[I2C_BUS_COUNT][LIS3MDL_MANAGER_MAX_DEVICES];
+    lis3mdl_dev_t *chain_devices[I2C_BUS_COUNT][LIS3MDL_MANAGER_MAX_DEVICES];
+    uint32_t chains_submitted;
+    uint32_t batched_reads;
+} lis3mdl_manager_t;
+
+void lis3mdl_manager_init(lis3mdl_manager_t *manager);
+
+/*
+ * Register an initialised device. Fails if the manager is full, the device
+ * is on a bus beyond I2C_BUS_COUNT, or another device already uses the same
+ * bus and address.
+ */
+status_t lis3mdl_manager_add(
+    lis3mdl_manager_t *manager,
+    lis3mdl_dev_t *dev);
+
+/* The device at `bus_address` on `bus`, or NULL */
+lis3mdl_dev_t *lis3mdl_manager_find(
+    lis3mdl_manager_t *manager,
+    uint8_t bus,
+    uint8_t bus_address);
+
+/*
+ * Queue one sample read for every device in a running acquisition. Reads
+ * are submitted alternating across buses, so each controller starts its
+ * first transfer immediately and all buses drain their queues in parallel;
+ * within a bus the reads run back to back in round-robin order. Useful on
+ * a common tick, or from a shared DRDY interrupt. Returns the number of
+ * reads queued.
+ */
+size_t lis3mdl_manager_sample_all(lis3mdl_manager_t *manager);
+
+/* Reads only on flagged devices, flushed on the tick, full-length chains */
+void lis3mdl_manager_batch_default(lis3mdl_manager_batch_t *batch);
+
+status_t lis3mdl_manager_set_batch(
+    lis3mdl_manager_t *manager,
+    const lis3mdl_manager_batch_t *batch);
+
+/*
+ * Batched acquisition for devices in ring or SoA acquisition. Their DRDY
+ * ISRs call lis3mdl_manager_on_data_ready(), which stamps the sample and
+ * flags the device; lis3mdl_manager_flush() then gathers the flagged
+ * devices of each bus (every acquiring device with `poll_all`) into one
+ * transaction chain of STATUS_REG..OUT_Z_H windows. STATUS_REG in each
+ * window tells whether the device had a new sample, so polled devices with
+ * nothing new cost seven bytes and produce nothing. Each bus has one chain
+ * in flight; devices flagged meanwhile go in the next one. A chain the
+ * I2C queue refuses leaves its devices flagged for the next flush.
+ */
+void lis3mdl_manager_on_data_ready(
+    lis3mdl_manager_t *manager,
+    lis3mdl_dev_t *dev);
+
+/* Chain the reads of the flagged devices; returns the number queued */
+size_t lis3mdl_manager_flush(lis3mdl_manager_t *manager);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+#include "lis3mdl_ring.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RING_MASK (LIS3MDL_RING_CAPACITY - 1)
+
+#if (LIS3MDL_RING_CAPACITY & RING_MASK) != 0
+#error "LIS3MDL_RING_CAPACITY must be a power of two"
+#endif
+
+void lis3mdl_ring_reset(lis3mdl_ring_t *ring)
+{
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+size_t lis3mdl_ring_count(lis3mdl_ring_t *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    return (uint32_t)(tail - head);
+}
+
+lis3mdl_sample_t *lis3mdl_ring_reserve(lis3mdl_ring_t *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if ((uint32_t)(tail - head) == LIS3MDL_RING_CAPACITY) {
+        return NULL;
+    }
+    return &ring->slots[tail & RING_MASK];
+}
+
+void lis3mdl_ring_commit(lis3mdl_ring_t *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+size_t lis3mdl_ring_pop(
+    lis3mdl_ring_t *ring,
+    lis3mdl_sample_t *out,
+    size_t max)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t count = (uint32_t)(tail - head);
+
+    if (count > max) {
+        count = max;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = ring->slots[(head + i) & RING_MASK];
+    }
+
+    atomic_store_explicit(
+        &ring->head,
+        (uint32_t)(head + count),
+        memory_order_release);
+    return count;
+}
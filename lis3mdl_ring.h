@@ -0,0 +1,74 @@
+#ifndef LIS3MDL_RING_HEADER_H
+#define LIS3MDL_RING_HEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* C++ front ends see the same layout through std::atomic */
+#ifdef __cplusplus
+#include <atomic>
+typedef std::atomic<uint_least32_t> lis3mdl_ring_index_t;
+#else
+#include <stdatomic.h>
+typedef atomic_uint_least32_t lis3mdl_ring_index_t;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of sample slots in a ring, must be a power of two */
+#ifndef LIS3MDL_RING_CAPACITY
+#define LIS3MDL_RING_CAPACITY 64
+#endif
+
+/*
+ * `sequence` numbers the conversion a sample came from (its low 16 bits),
+ * for lis3mdl_timing_time_ns(). It fills what would otherwise be padding.
+ */
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    uint16_t sequence;
+    uint32_t timestamp;
+} lis3mdl_sample_t;
+
+/*
+ * Single-producer/single-consumer sample ring. The producer (the driver's
+ * read completion, usually in interrupt context) and one consumer task may
+ * run concurrently without locks: `head` is only written by the consumer and
+ * `tail` only by the producer, each published with release semantics.
+ */
+typedef struct {
+    lis3mdl_sample_t slots[LIS3MDL_RING_CAPACITY];
+    lis3mdl_ring_index_t head;
+    lis3mdl_ring_index_t tail;
+} lis3mdl_ring_t;
+
+void lis3mdl_ring_reset(lis3mdl_ring_t *ring);
+
+/* Number of samples waiting for the consumer */
+size_t lis3mdl_ring_count(lis3mdl_ring_t *ring);
+
+/*
+ * Producer side. lis3mdl_ring_reserve() returns the next free slot, or NULL
+ * if the ring is full; the slot becomes visible to the consumer on
+ * lis3mdl_ring_commit(). This lets the producer decode straight into the
+ * ring without an intermediate copy.
+ */
+lis3mdl_sample_t *lis3mdl_ring_reserve(lis3mdl_ring_t *ring);
+
+void lis3mdl_ring_commit(lis3mdl_ring_t *ring);
+
+/* Consumer side: move up to `max` samples into `out`, returning the count */
+size_t lis3mdl_ring_pop(
+    lis3mdl_ring_t *ring,
+    lis3mdl_sample_t *out,
+    size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
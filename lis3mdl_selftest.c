@@ -0,0 +1,323 @@
+#include "lis3mdl_selftest.h"
+
+#include "lis3mdl_convert.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* FAST_READ samples top out at 0x7F00, so treat that as clipped too */
+#define CLIP_LSB 0x7F00
+
+void lis3mdl_selftest_default_config(lis3mdl_selftest_config_t *config)
+{
+    static const lis3mdl_selftest_limits_t datasheet = {
+        .min_gauss = {1.0f, 1.0f, 0.1f},
+        .max_gauss = {3.0f, 3.0f, 1.0f},
+    };
+
+    config->limits = datasheet;
+    config->samples = 5;
+    config->settle_samples = 1;
+}
+
+static void reset_sum(lis3mdl_selftest_t *selftest)
+{
+    selftest->count = 0;
+    for (size_t axis = 0; axis < 3; ++axis) {
+        selftest->sum[axis] = 0;
+    }
+}
+
+status_t lis3mdl_selftest_init(
+    lis3mdl_selftest_t *selftest,
+    lis3mdl_dev_t *dev,
+    const lis3mdl_selftest_config_t *config)
+{
+    if (config->samples == 0) {
+        return STATUS_ERROR;
+    }
+
+    selftest->dev = dev;
+    selftest->config = *config;
+    selftest->step = LIS3MDL_SELFTEST_IDLE;
+    selftest->have_result = false;
+    selftest->health = (lis3mdl_selftest_health_t){0};
+    for (size_t axis = 0; axis < 3; ++axis) {
+        selftest->m2[axis] = 0.0f;
+        selftest->first_gauss[axis] = 0.0f;
+    }
+    return STATUS_OK;
+}
+
+status_t lis3mdl_selftest_start(lis3mdl_selftest_t *selftest)
+{
+    if (selftest->step != LIS3MDL_SELFTEST_IDLE) {
+        return STATUS_BUSY;
+    }
+
+    selftest->saturated = false;
+    selftest->discarded = 0;
+    reset_sum(selftest);
+    selftest->step = LIS3MDL_SELFTEST_BASELINE;
+    return STATUS_OK;
+}
+
+static void switch_complete(
+    lis3mdl_dev_t *dev,
+    status_t status,
+    uint32_t sequence,
+    void *context)
+{
+    lis3mdl_selftest_t *selftest = context;
+
+    (void)dev;
+    selftest->switch_sequence = (uint16_t)sequence;
+    selftest->switch_status = status;
+    selftest->switched = true;
+}
+
+/* Queue the ST switch if it is not queued yet; retried on the next sample */
+static void request_switch(
+    lis3mdl_selftest_t *selftest,
+    bool enable)
+{
+    if (selftest->submitted) {
+        return;
+    }
+
+    selftest->switched = false;
+    if (lis3mdl_set_self_test_async(
+            selftest->dev,
+            enable,
+            switch_complete,
+            selftest)
+        == STATUS_OK) {
+        selftest->submitted = true;
+    }
+}
+
+static void begin_switch(
+    lis3mdl_selftest_t *selftest,
+    lis3mdl_selftest_step_t step,
+    bool enable)
+{
+    selftest->step = step;
+    selftest->submitted = false;
+    request_switch(selftest, enable);
+}
+
+/* Conversions `sample` comes after the one the switch completed behind */
+static int16_t since_switch(
+    const lis3mdl_selftest_t *selftest,
+    const lis3mdl_sample_t *sample)
+{
+    return (int16_t)(uint16_t)(sample->sequence - selftest->switch_sequence);
+}
+
+/* Add a sample to the running sum; true once the step has enough */
+static bool accumulate(
+    lis3mdl_selftest_t *selftest,
+    const lis3mdl_sample_t *sample)
+{
+    const int16_t xyz[3] = {sample->x, sample->y, sample->z};
+
+    for (size_t axis = 0; axis < 3; ++axis) {
+        selftest->sum[axis] += xyz[axis];
+        if (xyz[axis] >= CLIP_LSB || xyz[axis] <= -CLIP_LSB) {
+            selftest->saturated = true;
+        }
+    }
+    return ++selftest->count >= selftest->config.samples;
+}
+
+static void record_health(
+    lis3mdl_selftest_t *selftest,
+    const float response[3])
+{
+    lis3mdl_selftest_health_t *health = &selftest->health;
+    uint32_t count = health->passes + health->failures;
+
+    for (size_t axis = 0; axis < 3; ++axis) {
+        float value = response[axis];
+        float delta = value - health->mean_gauss[axis];
+
+        if (count == 1) {
+            selftest->first_gauss[axis] = value;
+        }
+        health->mean_gauss[axis] += delta / (float)count;
+        selftest->m2[axis] += delta * (value - health->mean_gauss[axis]);
+        health->variance_gauss2[axis] = count > 1
+            ? selftest->m2[axis] / (float)(count - 1)
+            : 0.0f;
+        health->drift_gauss[axis] = value - selftest->first_gauss[axis];
+    }
+}
+
+static void finish(
+    lis3mdl_selftest_t *selftest,
+    lis3mdl_selftest_verdict_t verdict)
+{
+    lis3mdl_selftest_result_t *result = &selftest->result;
+    const lis3mdl_selftest_limits_t *limits = &selftest->config.limits;
+    lis3mdl_full_scale_t full_scale;
+
+    result->failed_axes = 0;
+    result->discarded = selftest->discarded;
+    for (size_t axis = 0; axis < 3; ++axis) {
+        result->response_gauss[axis] = 0.0f;
+    }
+
+    /* PASS unless the test was cut short; the limits decide from here */
+    if (verdict == LIS3MDL_SELFTEST_PASS && selftest->saturated) {
+        verdict = LIS3MDL_SELFTEST_SATURATED;
+    }
+    if (verdict == LIS3MDL_SELFTEST_PASS) {
+        float samples = (float)selftest->config.samples;
+        float lsb_per_gauss;
+
+        lis3mdl_get_full_scale(selftest->dev, &full_scale);
+        lsb_per_gauss = (float)lis3mdl_lsb_per_gauss(full_scale);
+
+        for (size_t axis = 0; axis < 3; ++axis) {
+            float active = (float)selftest->active[axis] / samples;
+            float baseline = (float)(selftest->baseline[axis]
+                + selftest->sum[axis]) / (2.0f * samples);
+            float response = (active - baseline) / lsb_per_gauss;
+
+            result->response_gauss[axis] = response;
+            if (response < limits->min_gauss[axis]
+                || response > limits->max_gauss[axis]) {
+                result->failed_axes |= (uint8_t)(1u << axis);
+            }
+        }
+        if (result->failed_axes != 0) {
+            verdict = LIS3MDL_SELFTEST_FAIL;
+        }
+    }
+
+    result->verdict = verdict;
+    selftest->health.runs++;
+    if (verdict == LIS3MDL_SELFTEST_PASS) {
+        selftest->health.passes++;
+    } else if (verdict == LIS3MDL_SELFTEST_FAIL) {
+        selftest->health.failures++;
+    } else {
+        selftest->health.errors++;
+    }
+    if (verdict == LIS3MDL_SELFTEST_PASS || verdict == LIS3MDL_SELFTEST_FAIL) {
+        record_health(selftest, result->response_gauss);
+    }
+
+    selftest->have_result = true;
+    selftest->step = LIS3MDL_SELFTEST_IDLE;
+}
+
+/* Biased sample: count it and tell the caller to drop it */
+static bool discard(lis3mdl_selftest_t *selftest)
+{
+    selftest->discarded++;
+    return false;
+}
+
+bool lis3mdl_selftest_feed(
+    lis3mdl_selftest_t *selftest,
+    const lis3mdl_sample_t *sample)
+{
+    int16_t settle = (int16_t)(selftest->config.settle_samples + 1);
+
+    switch (selftest->step) {
+    case LIS3MDL_SELFTEST_IDLE:
+        return true;
+
+    case LIS3MDL_SELFTEST_BASELINE:
+        if (accumulate(selftest, sample)) {
+            for (size_t axis = 0; axis < 3; ++axis) {
+                selftest->baseline[axis] = selftest->sum[axis];
+            }
+            reset_sum(selftest);
+            begin_switch(selftest, LIS3MDL_SELFTEST_ENABLING, true);
+        }
+        return true;
+
+    case LIS3MDL_SELFTEST_ENABLING:
+        request_switch(selftest, true);
+        if (!selftest->switched) {
+            return true;
+        }
+        if (selftest->switch_status != STATUS_OK) {
+            finish(selftest, LIS3MDL_SELFTEST_BUS_ERROR);
+            return true;
+        }
+        /* Converted before the write landed */
+        if (since_switch(selftest, sample) <= 0) {
+            return true;
+        }
+        selftest->step = LIS3MDL_SELFTEST_MEASURE;
+        /* fall through */
+
+    case LIS3MDL_SELFTEST_MEASURE:
+        if (since_switch(selftest, sample) > settle
+            && accumulate(selftest, sample)) {
+            for (size_t axis = 0; axis < 3; ++axis) {
+                selftest->active[axis] = selftest->sum[axis];
+            }
+            reset_sum(selftest);
+            begin_switch(selftest, LIS3MDL_SELFTEST_DISABLING, false);
+        }
+        return discard(selftest);
+
+    case LIS3MDL_SELFTEST_DISABLING:
+        request_switch(selftest, false);
+        if (!selftest->switched) {
+            return discard(selftest);
+        }
+        /* ST must not stay on: keep retrying the clear */
+        if (selftest->switch_status != STATUS_OK) {
+            selftest->submitted = false;
+            request_switch(selftest, false);
+            return discard(selftest);
+        }
+        if (since_switch(selftest, sample) <= 0) {
+            return discard(selftest);
+        }
+        selftest->step = LIS3MDL_SELFTEST_RECOVER;
+        /* fall through */
+
+    case LIS3MDL_SELFTEST_RECOVER:
+        if (since_switch(selftest, sample) <= settle) {
+            return discard(selftest);
+        }
+        if (accumulate(selftest, sample)) {
+            finish(selftest, LIS3MDL_SELFTEST_PASS);
+        }
+        return true;
+    }
+    return true;
+}
+
+bool lis3mdl_selftest_running(const lis3mdl_selftest_t *selftest)
+{
+    return selftest->step != LIS3MDL_SELFTEST_IDLE;
+}
+
+status_t lis3mdl_selftest_get_result(
+    const lis3mdl_selftest_t *selftest,
+    lis3mdl_selftest_result_t *result)
+{
+    if (selftest->step != LIS3MDL_SELFTEST_IDLE) {
+        return STATUS_PENDING;
+    }
+    if (!selftest->have_result) {
+        return STATUS_ERROR;
+    }
+    *result = selftest->result;
+    return STATUS_OK;
+}
+
+void lis3mdl_selftest_get_health(
+    const lis3mdl_selftest_t *selftest,
+    lis3mdl_selftest_health_t *health)
+{
+    *health = selftest->health;
+}
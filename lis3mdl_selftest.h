@@ -0,0 +1,159 @@
+#ifndef LIS3MDL_SELFTEST_HEADER_H
+#define LIS3MDL_SELFTEST_HEADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "i2c.h"
+#include "lis3mdl.h"
+#include "lis3mdl_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Incremental self-test, run on a device that keeps streaming. The test is
+ * fed the samples the consumer drains from the ring and moves through its
+ * steps as they arrive:
+ *
+ *   1. average `samples` conversions with ST clear
+ *   2. set ST with lis3mdl_set_self_test_async(), queued between reads
+ *   3. skip the conversion the write lands in and `settle_samples` more,
+ *      then average `samples` conversions with ST set
+ *   4. clear ST the same way, skip the settling conversions again, and
+ *      average `samples` more with ST clear
+ *
+ * The response is the ST average minus the mean of the two baselines, so a
+ * field changing steadily during the test cancels out. Which conversions
+ * saw ST is decided from the sequence numbers the driver reports for each
+ * switch, not from when the consumer happens to drain them. Only the
+ * conversions from the first write to the end of settling after the second
+ * are biased: `samples` + 2 * (settle_samples + 1), plus any converted
+ * while a write waits in the queue. lis3mdl_selftest_feed() flags them so
+ * they can be dropped from the stream.
+ *
+ * The datasheet specifies the response at the +/-12 gauss range. The coil
+ * produces a field, so the limits are held in gauss and compared after
+ * conversion at the full scale in force, which lets the test run without
+ * changing the range of the stream. At +/-4 gauss a strong ambient field
+ * plus the response can clip, which is reported as saturated rather than
+ * as a failure. Do not change the device configuration while a test runs.
+ */
+
+/* Self-test response limits per axis, in gauss */
+typedef struct {
+    float min_gauss[3];
+    float max_gauss[3];
+} lis3mdl_selftest_limits_t;
+
+typedef struct {
+    lis3mdl_selftest_limits_t limits;
+    uint8_t samples;         /* Conversions averaged per step */
+    uint8_t settle_samples;  /* Skipped after each switch, past the first */
+} lis3mdl_selftest_config_t;
+
+typedef enum {
+    LIS3MDL_SELFTEST_IDLE,
+    LIS3MDL_SELFTEST_BASELINE,
+    LIS3MDL_SELFTEST_ENABLING,
+    LIS3MDL_SELFTEST_MEASURE,
+    LIS3MDL_SELFTEST_DISABLING,
+    LIS3MDL_SELFTEST_RECOVER
+} lis3mdl_selftest_step_t;
+
+typedef enum {
+    LIS3MDL_SELFTEST_PASS,
+    LIS3MDL_SELFTEST_FAIL,
+    LIS3MDL_SELFTEST_SATURATED, /* An output clipped; no verdict */
+    LIS3MDL_SELFTEST_BUS_ERROR  /* Switching ST failed; no verdict */
+} lis3mdl_selftest_verdict_t;
+
+typedef struct {
+    lis3mdl_selftest_verdict_t verdict;
+    float response_gauss[3];  /* ST average minus the baseline */
+    uint8_t failed_axes;      /* Bit per axis outside the limits, X first */
+    uint16_t discarded;       /* Samples flagged as biased by the test */
+} lis3mdl_selftest_result_t;
+
+/* Completed tests; the response figures cover those with a verdict */
+typedef struct {
+    uint32_t runs;
+    uint32_t passes;
+    uint32_t failures;
+    uint32_t errors;          /* Saturated or bus errors */
+    float mean_gauss[3];      /* Mean response */
+    float variance_gauss2[3]; /* Sample variance of the response */
+    float drift_gauss[3];     /* Latest response minus the first */
+} lis3mdl_selftest_health_t;
+
+typedef struct {
+    lis3mdl_dev_t *dev;
+    lis3mdl_selftest_config_t config;
+    lis3mdl_selftest_step_t step;
+
+    /* ST switch: queued, and completed (set from the completion) */
+    bool submitted;
+    volatile bool switched;
+    volatile status_t switch_status;
+    volatile uint16_t switch_sequence;
+
+    uint8_t count;
+    int32_t sum[3];
+    int32_t baseline[3];
+    int32_t active[3];
+    bool saturated;
+    uint16_t discarded;
+
+    bool have_result;
+    lis3mdl_selftest_result_t result;
+
+    /* Response statistics (Welford), in gauss */
+    lis3mdl_selftest_health_t health;
+    float m2[3];
+    float first_gauss[3];
+} lis3mdl_selftest_t;
+
+/*
+ * Datasheet limits, X and Y 1 to 3 gauss and Z 0.1 to 1 gauss, with five
+ * samples per step and one settling sample after each switch.
+ */
+void lis3mdl_selftest_default_config(lis3mdl_selftest_config_t *config);
+
+status_t lis3mdl_selftest_init(
+    lis3mdl_selftest_t *selftest,
+    lis3mdl_dev_t *dev,
+    const lis3mdl_selftest_config_t *config);
+
+/* Start a test; STATUS_BUSY if one is already running */
+status_t lis3mdl_selftest_start(lis3mdl_selftest_t *selftest);
+
+/*
+ * Account for one sample drained from the device's ring, in order, and
+ * issue the ST switches as the test reaches them. Returns false for a
+ * sample biased by the test, which the caller should drop. Call from task
+ * context; the switches are queued without blocking.
+ */
+bool lis3mdl_selftest_feed(
+    lis3mdl_selftest_t *selftest,
+    const lis3mdl_sample_t *sample);
+
+bool lis3mdl_selftest_running(const lis3mdl_selftest_t *selftest);
+
+/*
+ * Result of the latest completed test. STATUS_PENDING while a test is
+ * running, STATUS_ERROR if none has completed.
+ */
+status_t lis3mdl_selftest_get_result(
+    const lis3mdl_selftest_t *selftest,
+    lis3mdl_selftest_result_t *result);
+
+void lis3mdl_selftest_get_health(
+    const lis3mdl_selftest_t *selftest,
+    lis3mdl_selftest_health_t *health);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
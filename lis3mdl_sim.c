@@ -0,0 +1,775 @@
+#include "lis3mdl_sim.h"
+
+#include "i2c_port.h"
+#include "lis3mdl_convert.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define REG_MASK (LIS3MDL_SIM_REG_COUNT - 1)
+
+/* Per-axis data-available and overrun bits of STATUS_REG */
+#define STATUS_XDA 0x01
+#define STATUS_XOR 0x10
+
+#define OUTPUT_BYTES    6
+#define ALL_OUTPUT_READ ((1u << OUTPUT_BYTES) - 1)
+
+#define NEVER UINT64_MAX
+
+#define BITS_PER_BYTE 9 /* Eight data bits and ACK */
+
+static status_t sim_start(i2c_transaction_t *transaction);
+static status_t sim_recover(void);
+
+static const i2c_port_t sim_port = {
+    .start = sim_start,
+    .recover = sim_recover,
+};
+
+/* Models by controller, indexed by the SA1 level of their address */
+static lis3mdl_sim_t *models[I2C_BUS_COUNT][2];
+
+static uint64_t now_ns;
+static uint64_t bit_ns = 2500;
+
+/*
+ * Set while a transfer is on the wire. DRDY and INT edges are delivered at
+ * their own instant even then, as an ISR would preempt the transfer, but a
+ * transfer they start on another controller waits here until the wire is
+ * free, since the model runs one transfer at a time.
+ */
+static bool in_transfer;
+static i2c_transaction_t *waiting[I2C_BUS_COUNT];
+
+static uint8_t out_register(size_t index)
+{
+    return (uint8_t)(LIS3MDL_REG_OUT_X_L + index);
+}
+
+static int16_t le16_at(
+    const lis3mdl_sim_t *sim,
+    uint8_t reg)
+{
+    return (int16_t)(uint16_t)(sim->regs[reg] | (sim->regs[reg + 1] << 8));
+}
+
+static uint8_t operating_mode(const lis3mdl_sim_t *sim)
+{
+    return (sim->regs[LIS3MDL_REG_CTRL_REG1] & LIS3MDL_CTRL_REG1_OM_MASK)
+        >> LIS3MDL_CTRL_REG1_OM_SHIFT;
+}
+
+/* Nominal period `ns` as paced by the model's oscillator */
+static uint64_t oscillator_ns(
+    const lis3mdl_sim_t *sim,
+    uint64_t ns)
+{
+    return ns * 1000000ull / (uint64_t)(1000000 + sim->odr_error_ppm);
+}
+
+/* Conversion time of one FAST_ODR cycle, which also bounds single mode */
+static uint64_t fast_period_ns(const lis3mdl_sim_t *sim)
+{
+    static const uint64_t fast_odr_mhz[] = {1000000, 560000, 300000, 155000};
+
+    return oscillator_ns(
+        sim,
+        1000000000000ull / fast_odr_mhz[operating_mode(sim)]);
+}
+
+static uint64_t period_ns(const lis3mdl_sim_t *sim)
+{
+    static const uint64_t odr_mhz[] = {
+        625, 1250, 2500, 5000, 10000, 20000, 40000, 80000};
+    uint8_t ctrl1 = sim->regs[LIS3MDL_REG_CTRL_REG1];
+
+    if (sim->regs[LIS3MDL_REG_CTRL_REG3] & LIS3MDL_CTRL_REG3_LP) {
+        return oscillator_ns(
+            sim,
+            1000000000000ull / odr_mhz[LIS3MDL_ODR_0_625_HZ]);
+    }
+    if (ctrl1 & LIS3MDL_CTRL_REG1_FAST_ODR) {
+        return fast_period_ns(sim);
+    }
+    return oscillator_ns(
+        sim,
+        1000000000000ull
+            / odr_mhz[(ctrl1 & LIS3MDL_CTRL_REG1_DO_MASK)
+                      >> LIS3MDL_CTRL_REG1_DO_SHIFT]);
+}
+
+static uint8_t measurement_mode(const lis3mdl_sim_t *sim)
+{
+    return sim->regs[LIS3MDL_REG_CTRL_REG3] & LIS3MDL_CTRL_REG3_MD_MASK;
+}
+
+static void schedule(lis3mdl_sim_t *sim)
+{
+    switch (measurement_mode(sim)) {
+    case LIS3MDL_MEASUREMENT_CONTINUOUS:
+        sim->next_conversion_ns = now_ns + period_ns(sim);
+        break;
+    case LIS3MDL_MEASUREMENT_SINGLE:
+        sim->next_conversion_ns = now_ns + fast_period_ns(sim);
+        break;
+    default:
+        sim->next_conversion_ns = NEVER;
+        break;
+    }
+}
+
+static void update_drdy(lis3mdl_sim_t *sim)
+{
+    bool level =
+        (sim->regs[LIS3MDL_REG_STATUS_REG] & LIS3MDL_STATUS_ZYXDA) != 0;
+    bool rising = level && !sim->drdy_level;
+
+    sim->drdy_level = level;
+    if (rising && sim->drdy != NULL) {
+        sim->drdy(sim->drdy_context);
+    }
+}
+
+static void update_int(lis3mdl_sim_t *sim)
+{
+    bool level = (sim->regs[LIS3MDL_REG_INT_SRC] & LIS3MDL_INT_SRC_INT) != 0;
+    bool asserted = level && !sim->int_level;
+
+    sim->int_level = level;
+    if (asserted && sim->interrupt != NULL) {
+        sim->interrupt(sim->interrupt_context);
+    }
+}
+
+/* Compare a conversion against INT_THS on the enabled axes */
+static void evaluate_threshold(
+    lis3mdl_sim_t *sim,
+    const int16_t xyz[3])
+{
+    uint8_t cfg = sim->regs[LIS3MDL_REG_INT_CFG];
+    int32_t threshold = (int32_t)(uint16_t)(sim->regs[LIS3MDL_REG_INT_THS_L]
+        | (sim->regs[LIS3MDL_REG_INT_THS_H] << 8)) & LIS3MDL_INT_THS_MAX;
+    uint8_t source = 0;
+
+    if (!(cfg & LIS3MDL_INT_CFG_IEN)) {
+        return;
+    }
+    for (size_t axis = 0; axis < 3; ++axis) {
+        if (!(cfg & (LIS3MDL_INT_CFG_XIEN >> axis))) {
+            continue;
+        }
+        if (xyz[axis] > threshold) {
+            source |= (uint8_t)(LIS3MDL_INT_SRC_PTH_X >> axis);
+        }
+        if (xyz[axis] < -threshold) {
+            source |= (uint8_t)(LIS3MDL_INT_SRC_NTH_X >> axis);
+        }
+    }
+    if (source != 0) {
+        source |= LIS3MDL_INT_SRC_INT;
+    }
+
+    if (cfg & LIS3MDL_INT_CFG_LIR) {
+        sim->regs[LIS3MDL_REG_INT_SRC] |= source;
+    } else {
+        sim->regs[LIS3MDL_REG_INT_SRC] = source;
+    }
+    update_int(sim);
+}
+
+/* ZYXDA and ZYXOR summarise the per-axis bits */
+static void update_status(lis3mdl_sim_t *sim)
+{
+    uint8_t status = sim->regs[LIS3MDL_REG_STATUS_REG] & 0x77;
+
+    if (status & 0x07) {
+        status |= LIS3MDL_STATUS_ZYXDA;
+    }
+    if (status & 0x70) {
+        status |= LIS3MDL_STATUS_ZYXOR;
+    }
+    sim->regs[LIS3MDL_REG_STATUS_REG] = status;
+    update_drdy(sim);
+}
+
+/* Make a sample visible in OUT_X_L..OUT_Z_H */
+static void publish(
+    lis3mdl_sim_t *sim,
+    const int16_t xyz[3])
+{
+    bool big_endian =
+        (sim->regs[LIS3MDL_REG_CTRL_REG4] & LIS3MDL_CTRL_REG4_BLE) != 0;
+    uint8_t status = sim->regs[LIS3MDL_REG_STATUS_REG];
+
+    for (size_t axis = 0; axis < 3; ++axis) {
+        uint16_t value = (uint16_t)xyz[axis];
+        uint8_t reg = out_register(2 * axis);
+
+        sim->regs[reg] = (uint8_t)(big_endian ? value >> 8 : value);
+        sim->regs[reg + 1] = (uint8_t)(big_endian ? value : value >> 8);
+
+        if (status & (STATUS_XDA << axis)) {
+            status |= STATUS_XOR << axis;
+            sim->overruns++;
+        }
+        status |= STATUS_XDA << axis;
+    }
+    sim->regs[LIS3MDL_REG_STATUS_REG] = status;
+    update_status(sim);
+}
+
+static int16_t quantise(
+    float gauss,
+    uint16_t lsb_per_gauss,
+    int16_t offset)
+{
+    float lsb = gauss * (float)lsb_per_gauss - (float)offset;
+
+    lsb += lsb < 0.0f ? -0.5f : 0.5f;
+    if (lsb >= 32767.0f) {
+        return 32767;
+    }
+    if (lsb <= -32768.0f) {
+        return -32768;
+    }
+    return (int16_t)lsb;
+}
+
+static void convert(lis3mdl_sim_t *sim)
+{
+    uint64_t time_ns = sim->next_conversion_ns;
+    lis3mdl_full_scale_t full_scale = (lis3mdl_full_scale_t)(
+        (sim->regs[LIS3MDL_REG_CTRL_REG2] & LIS3MDL_CTRL_REG2_FS_MASK)
+        >> LIS3MDL_CTRL_REG2_FS_SHIFT);
+    uint16_t lsb_per_gauss = lis3mdl_lsb_per_gauss(full_scale);
+    float gauss[3] = {
+        sim->constant_field[0],
+        sim->constant_field[1],
+        sim->constant_field[2],
+    };
+    int16_t xyz[3];
+
+    if (sim->field != NULL) {
+        sim->field(sim->field_context, time_ns, gauss);
+    }
+    if (sim->regs[LIS3MDL_REG_CTRL_REG1] & LIS3MDL_CTRL_REG1_ST) {
+        for (size_t axis = 0; axis < 3; ++axis) {
+            gauss[axis] += sim->self_test_field[axis];
+        }
+    }
+    for (size_t axis = 0; axis < 3; ++axis) {
+        xyz[axis] = quantise(
+            gauss[axis],
+            lsb_per_gauss,
+            le16_at(sim, (uint8_t)(LIS3MDL_REG_OFFSET_X_L + 2 * axis)));
+    }
+
+    if (sim->regs[LIS3MDL_REG_CTRL_REG1] & LIS3MDL_CTRL_REG1_TEMP_EN) {
+        int16_t temp = (int16_t)((sim->temperature_c - 25.0f) * 8.0f);
+        sim->regs[LIS3MDL_REG_TEMP_OUT_L] = (uint8_t)(uint16_t)temp;
+        sim->regs[LIS3MDL_REG_TEMP_OUT_H] = (uint8_t)((uint16_t)temp >> 8);
+    }
+
+    evaluate_threshold(sim, xyz);
+
+    sim->conversions++;
+    if (measurement_mode(sim) == LIS3MDL_MEASUREMENT_SINGLE) {
+        sim->regs[LIS3MDL_REG_CTRL_REG3] |= LIS3MDL_CTRL_REG3_MD_MASK;
+        sim->next_conversion_ns = NEVER;
+    } else {
+        sim->next_conversion_ns = time_ns + period_ns(sim);
+    }
+
+    if (sim->frozen) {
+        /* BDU: hold the sample back; replacing a held one is an overrun */
+        if (sim->held) {
+            sim->overruns++;
+            sim->regs[LIS3MDL_REG_STATUS_REG] |= 0x70;
+        }
+        for (size_t axis = 0; axis < 3; ++axis) {
+            sim->held_xyz[axis] = xyz[axis];
+        }
+        sim->held = true;
+        update_status(sim);
+    } else {
+        publish(sim, xyz);
+    }
+}
+
+/*
+ * Run conversions due up to `target_ns` in time order across every model.
+ * Outside a transfer each one runs at its own instant, so DRDY callbacks
+ * that start reads see the time of the edge.
+ */
+static void run_until(uint64_t target_ns)
+{
+    for (;;) {
+        lis3mdl_sim_t *next = NULL;
+
+        for (size_t bus = 0; bus < I2C_BUS_COUNT; ++bus) {
+            for (size_t slot = 0; slot < 2; ++slot) {
+                lis3mdl_sim_t *sim = models[bus][slot];
+                if (sim != NULL
+                    && sim->next_conversion_ns <= target_ns
+                    && (next == NULL
+                        || sim->next_conversion_ns
+                            < next->next_conversion_ns)) {
+                    next = sim;
+                }
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        if (next->next_conversion_ns > now_ns) {
+            now_ns = next->next_conversion_ns;
+        }
+        convert(next);
+    }
+    if (target_ns > now_ns) {
+        now_ns = target_ns;
+    }
+}
+
+/* Clock `bits` out on the wire */
+static void wire(uint32_t bits)
+{
+    run_until(now_ns + bits * bit_ns);
+}
+
+static void reset_registers(lis3mdl_sim_t *sim)
+{
+    memset(sim->regs, 0, sizeof(sim->regs));
+    sim->regs[LIS3MDL_REG_WHO_AM_I] = LIS3MDL_WHO_AM_I_VALUE;
+    sim->regs[LIS3MDL_REG_CTRL_REG1] = 0x10;
+    sim->regs[LIS3MDL_REG_CTRL_REG3] = 0x03;
+    sim->regs[LIS3MDL_REG_INT_CFG] = 0xE8;
+
+    sim->frozen = false;
+    sim->read_mask = 0;
+    sim->held = false;
+    sim->next_conversion_ns = NEVER;
+    update_status(sim);
+    update_int(sim);
+}
+
+static bool writable(uint8_t reg)
+{
+    return (reg >= LIS3MDL_REG_OFFSET_X_L && reg < LIS3MDL_REG_OFFSET_X_L + 6)
+        || (reg >= LIS3MDL_REG_CTRL_REG1 && reg <= LIS3MDL_REG_CTRL_REG5)
+        || reg == LIS3MDL_REG_INT_CFG
+        || reg == LIS3MDL_REG_INT_THS_L
+        || reg == LIS3MDL_REG_INT_THS_H;
+}
+
+static void write_register(
+    lis3mdl_sim_t *sim,
+    uint8_t reg,
+    uint8_t value)
+{
+    if (!writable(reg)) {
+        return;
+    }
+
+    if (reg == LIS3MDL_REG_CTRL_REG2 && (value & LIS3MDL_CTRL_REG2_SOFT_RST)) {
+        reset_registers(sim);
+        return;
+    }
+
+    uint8_t previous = sim->regs[reg];
+    sim->regs[reg] = value;
+
+    switch (reg) {
+    case LIS3MDL_REG_CTRL_REG1:
+        if (measurement_mode(sim) == LIS3MDL_MEASUREMENT_CONTINUOUS
+            && ((previous ^ value) & (LIS3MDL_CTRL_REG1_DO_MASK
+                                      | LIS3MDL_CTRL_REG1_FAST_ODR
+                                      | LIS3MDL_CTRL_REG1_OM_MASK))) {
+            schedule(sim);
+        }
+        break;
+    case LIS3MDL_REG_CTRL_REG2:
+        /* REBOOT reloads trimming, which the model lacks; it self-clears */
+        sim->regs[reg] &= (uint8_t)~LIS3MDL_CTRL_REG2_REBOOT;
+        break;
+    case LIS3MDL_REG_CTRL_REG3:
+        if ((previous ^ value)
+                & (LIS3MDL_CTRL_REG3_MD_MASK | LIS3MDL_CTRL_REG3_LP)
+            || measurement_mode(sim) == LIS3MDL_MEASUREMENT_SINGLE) {
+            schedule(sim);
+        }
+        break;
+    case LIS3MDL_REG_CTRL_REG5:
+        if (!(value & LIS3MDL_CTRL_REG5_BDU) && sim->frozen) {
+            sim->frozen = false;
+            sim->read_mask = 0;
+            if (sim->held) {
+                sim->held = false;
+                publish(sim, sim->held_xyz);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static bool fast_read(const lis3mdl_sim_t *sim)
+{
+    return (sim->regs[LIS3MDL_REG_CTRL_REG5] & LIS3MDL_CTRL_REG5_FAST_READ)
+        != 0;
+}
+
+/* Reading the high byte of an axis consumes its DA and OR bits */
+static void output_read(
+    lis3mdl_sim_t *sim,
+    size_t index)
+{
+    bool big_endian =
+        (sim->regs[LIS3MDL_REG_CTRL_REG4] & LIS3MDL_CTRL_REG4_BLE) != 0;
+    size_t axis = index / 2;
+
+    if ((index & 1) == (big_endian ? 0u : 1u)) {
+        sim->regs[LIS3MDL_REG_STATUS_REG] &=
+            (uint8_t)~((STATUS_XDA | STATUS_XOR) << axis);
+        update_status(sim);
+    }
+
+    if (!(sim->regs[LIS3MDL_REG_CTRL_REG5] & LIS3MDL_CTRL_REG5_BDU)) {
+        return;
+    }
+    sim->frozen = true;
+    sim->read_mask |= (uint8_t)(1u << index);
+    if (fast_read(sim)) {
+        sim->read_mask |= (uint8_t)(1u << (index ^ 1));
+    }
+    if (sim->read_mask == ALL_OUTPUT_READ) {
+        sim->frozen = false;
+        sim->read_mask = 0;
+        if (sim->held) {
+            sim->held = false;
+            publish(sim, sim->held_xyz);
+        }
+    }
+}
+
+static uint8_t read_register(
+    lis3mdl_sim_t *sim,
+    uint8_t reg)
+{
+    uint8_t value = sim->regs[reg];
+
+    if (reg >= LIS3MDL_REG_OUT_X_L && reg <= LIS3MDL_REG_OUT_Z_H) {
+        output_read(sim, reg - LIS3MDL_REG_OUT_X_L);
+    }
+    if (reg == LIS3MDL_REG_INT_SRC
+        && (sim->regs[LIS3MDL_REG_INT_CFG] & LIS3MDL_INT_CFG_LIR)) {
+        sim->regs[LIS3MDL_REG_INT_SRC] = 0;
+        update_int(sim);
+    }
+    return value;
+}
+
+/* Without bit 7 of the sub-address every byte goes to the same register */
+static uint8_t next_register(
+    const lis3mdl_sim_t *sim,
+    uint8_t sub_address,
+    uint8_t reg)
+{
+    if (!(sub_address & LIS3MDL_AUTO_INCREMENT)) {
+        return reg;
+    }
+    if (fast_read(sim)
+        && (reg == LIS3MDL_REG_OUT_X_H || reg == LIS3MDL_REG_OUT_Y_H)) {
+        return (uint8_t)(reg + 2);
+    }
+    return (uint8_t)((reg + 1) & REG_MASK);
+}
+
+static lis3mdl_sim_t *lookup(
+    uint8_t bus,
+    uint8_t bus_address)
+{
+    if (bus >= I2C_BUS_COUNT) {
+        return NULL;
+    }
+    if (bus_address == LIS3MDL_ADDRESS_SA1_LOW) {
+        return models[bus][0];
+    }
+    if (bus_address == LIS3MDL_ADDRESS_SA1_HIGH) {
+        return models[bus][1];
+    }
+    return NULL;
+}
+
+/* One START (or repeated START) ... data, without the final STOP */
+static status_t run_segment(
+    uint8_t bus,
+    const i2c_msg_t *msg)
+{
+    lis3mdl_sim_t *sim = lookup(bus, msg->bus_address);
+
+    wire(1 + BITS_PER_BYTE);
+    if (sim == NULL) {
+        return STATUS_NACK;
+    }
+    if (sim->fail_next != STATUS_OK) {
+        status_t status = sim->fail_next;
+        sim->fail_next = STATUS_OK;
+        return status;
+    }
+
+    uint8_t sub_address = msg->register_address;
+    uint8_t reg = sub_address & REG_MASK;
+    wire(BITS_PER_BYTE);
+
+    if (msg->direction == I2C_DIRECTION_READ) {
+        wire(1 + BITS_PER_BYTE);
+        for (size_t b = 0; b < msg->length; ++b) {
+            msg->buffer[b] = read_register(sim, reg);
+            reg = next_register(sim, sub_address, reg);
+            wire(BITS_PER_BYTE);
+        }
+    } else {
+        for (size_t b = 0; b < msg->length; ++b) {
+            wire(BITS_PER_BYTE);
+            write_register(sim, reg, msg->buffer[b]);
+            reg = next_register(sim, sub_address, reg);
+        }
+    }
+    return STATUS_OK;
+}
+
+static void run_transfer(i2c_transaction_t *transaction)
+{
+    const i2c_msg_t single = {
+        .direction = transaction->direction,
+        .bus_address = transaction->bus_address,
+        .register_address = transaction->register_address,
+        .length = transaction->length,
+        .buffer = transaction->buffer,
+    };
+    const i2c_msg_t *msgs = &single;
+    size_t count = 1;
+    status_t status = STATUS_OK;
+
+    if (transaction->direction == I2C_DIRECTION_CHAIN) {
+        msgs = transaction->msgs;
+        count = transaction->msg_count;
+    }
+
+    in_transfer = true;
+    for (size_t i = 0; i < count && status == STATUS_OK; ++i) {
+        status = run_segment(transaction->bus, &msgs[i]);
+    }
+    wire(1); /* STOP */
+    in_transfer = false;
+
+    i2c_port_complete_bus(transaction->bus, status);
+}
+
+/*
+ * Transfers run to completion in line, like the stub. One started from an
+ * edge callback while another is on the wire runs after it.
+ */
+static status_t sim_start(i2c_transaction_t *transaction)
+{
+    bool ran;
+
+    if (in_transfer) {
+        waiting[transaction->bus] = transaction;
+        return STATUS_OK;
+    }
+
+    run_transfer(transaction);
+    do {
+        ran = false;
+        for (size_t bus = 0; bus < I2C_BUS_COUNT; ++bus) {
+            i2c_transaction_t *next = waiting[bus];
+            if (next != NULL) {
+                waiting[bus] = NULL;
+                run_transfer(next);
+                ran = true;
+            }
+        }
+    } while (ran);
+    return STATUS_OK;
+}
+
+/* The model never holds SDA, so there is nothing to free */
+static status_t sim_recover(void)
+{
+    return STATUS_OK;
+}
+
+void lis3mdl_sim_init(lis3mdl_sim_t *sim)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->temperature_c = 25.0f;
+    lis3mdl_sim_set_self_test_field(sim, 2.0f, 2.0f, 0.5f);
+    sim->fail_next = STATUS_OK;
+    reset_registers(sim);
+}
+
+status_t lis3mdl_sim_attach(
+    lis3mdl_sim_t *sim,
+    uint8_t bus,
+    uint8_t bus_address)
+{
+    size_t slot;
+
+    if (bus >= I2C_BUS_COUNT || sim->attached) {
+        return STATUS_ERROR;
+    }
+    if (bus_address == LIS3MDL_ADDRESS_SA1_LOW) {
+        slot = 0;
+    } else if (bus_address == LIS3MDL_ADDRESS_SA1_HIGH) {
+        slot = 1;
+    } else {
+        return STATUS_ERROR;
+    }
+    if (models[bus][slot] != NULL) {
+        return STATUS_BUSY;
+    }
+
+    sim->bus = bus;
+    sim->bus_address = bus_address;
+    sim->attached = true;
+    models[bus][slot] = sim;
+    i2c_set_bus_port(bus, &sim_port);
+    return STATUS_OK;
+}
+
+void lis3mdl_sim_detach(lis3mdl_sim_t *sim)
+{
+    if (!sim->attached) {
+        return;
+    }
+    models[sim->bus][sim->bus_address == LIS3MDL_ADDRESS_SA1_HIGH] = NULL;
+    sim->attached = false;
+}
+
+void lis3mdl_sim_set_field(
+    lis3mdl_sim_t *sim,
+    lis3mdl_sim_field_t field,
+    void *context)
+{
+    sim->field = field;
+    sim->field_context = context;
+}
+
+void lis3mdl_sim_set_constant_field(
+    lis3mdl_sim_t *sim,
+    float x,
+    float y,
+    float z)
+{
+    sim->constant_field[0] = x;
+    sim->constant_field[1] = y;
+    sim->constant_field[2] = z;
+}
+
+void lis3mdl_sim_set_self_test_field(
+    lis3mdl_sim_t *sim,
+    float x,
+    float y,
+    float z)
+{
+    sim->self_test_field[0] = x;
+    sim->self_test_field[1] = y;
+    sim->self_test_field[2] = z;
+}
+
+void lis3mdl_sim_set_temperature(
+    lis3mdl_sim_t *sim,
+    float celsius)
+{
+    sim->temperature_c = celsius;
+}
+
+void lis3mdl_sim_set_odr_error(
+    lis3mdl_sim_t *sim,
+    int32_t ppm)
+{
+    if (ppm <= -1000000) {
+        ppm = -999999;
+    }
+    sim->odr_error_ppm = ppm;
+}
+
+void lis3mdl_sim_set_drdy_callback(
+    lis3mdl_sim_t *sim,
+    lis3mdl_sim_drdy_t drdy,
+    void *context)
+{
+    sim->drdy = drdy;
+    sim->drdy_context = context;
+}
+
+bool lis3mdl_sim_drdy_level(const lis3mdl_sim_t *sim)
+{
+    return sim->drdy_level;
+}
+
+void lis3mdl_sim_set_int_callback(
+    lis3mdl_sim_t *sim,
+    lis3mdl_sim_int_t interrupt,
+    void *context)
+{
+    sim->interrupt = interrupt;
+    sim->interrupt_context = context;
+}
+
+bool lis3mdl_sim_int_asserted(const lis3mdl_sim_t *sim)
+{
+    return sim->int_level;
+}
+
+void lis3mdl_sim_fail_next(
+    lis3mdl_sim_t *sim,
+    status_t status)
+{
+    sim->fail_next = status;
+}
+
+void lis3mdl_sim_set_bus_rate(uint32_t hz)
+{
+    if (hz != 0) {
+        bit_ns = 1000000000ull / hz;
+    }
+}
+
+void lis3mdl_sim_advance(uint64_t ns)
+{
+    run_until(now_ns + ns);
+}
+
+uint64_t lis3mdl_sim_time_ns(void)
+{
+    return now_ns;
+}
+
+uint32_t lis3mdl_sim_time_us(void)
+{
+    return (uint32_t)(now_ns / 1000);
+}
+
+void lis3mdl_sim_trace_field(
+    void *trace,
+    uint64_t time_ns,
+    float gauss[3])
+{
+    const lis3mdl_sim_trace_t *samples = trace;
+
+    if (samples->count == 0 || samples->period_ns == 0) {
+        return;
+    }
+
+    uint64_t index = (time_ns / samples->period_ns) % samples->count;
+    for (size_t axis = 0; axis < 3; ++axis) {
+        gauss[axis] = samples->gauss[index][axis];
+    }
+}
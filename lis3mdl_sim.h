@@ -0,0 +1,190 @@
+#ifndef LIS3MDL_SIM_HEADER_H
+#define LIS3MDL_SIM_HEADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "i2c.h"
+#include "lis3mdl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Register-level LIS3MDL model for host testing, installed as the I2C port
+ * of the controllers it is attached to. It keeps the device's register file
+ * and reproduces what the driver depends on:
+ *
+ *   - WHO_AM_I, power-on defaults, SOFT_RST
+ *   - sub-address auto-increment (bit 7), including the FAST_READ skip of
+ *     the low output bytes, and BLE byte order
+ *   - conversions paced by DO, FAST_ODR and LP on an oscillator that can
+ *     be set off nominal, single-conversion mode dropping back to
+ *     power-down, the OFFSET registers, and the ST self-test field
+ *   - per-axis DA and OR bits in STATUS_REG, and the DRDY pin
+ *   - BDU: once an output byte is read the registers stay frozen until all
+ *     six have been read; without BDU they update mid-burst
+ *   - the threshold interrupt: INT_CFG axis enables and LIR, INT_THS, and
+ *     INT_SRC evaluated on every conversion and cleared on read if latched
+ *
+ * Time is virtual. It advances only through lis3mdl_sim_advance() and by
+ * the duration of each bus transfer at the simulated SCL rate, so tests run
+ * as fast as the host allows. Conversions falling inside a transfer land
+ * between the bytes they come between on the wire, and their DRDY and INT
+ * callbacks run right there, at the edge time and before the transfer
+ * completes, like an ISR preempting it. All attached models share one
+ * timeline, so a transfer such a callback starts on another controller
+ * runs once the current one has ended.
+ */
+
+/* Field seen by the sensor at `time_ns`, in gauss */
+typedef void (*lis3mdl_sim_field_t)(
+    void *context,
+    uint64_t time_ns,
+    float gauss[3]);
+
+/* Called on each rising edge of DRDY */
+typedef void (*lis3mdl_sim_drdy_t)(void *context);
+
+/* Called each time INT is asserted, whatever the IEA polarity */
+typedef void (*lis3mdl_sim_int_t)(void *context);
+
+#define LIS3MDL_SIM_REG_COUNT 0x40
+
+typedef struct {
+    uint8_t regs[LIS3MDL_SIM_REG_COUNT];
+
+    uint8_t bus;
+    uint8_t bus_address;
+    bool attached;
+
+    /* BDU: output registers frozen, bytes read since, conversion held back */
+    bool frozen;
+    uint8_t read_mask;
+    bool held;
+    int16_t held_xyz[3];
+
+    uint64_t next_conversion_ns;
+
+    lis3mdl_sim_field_t field;
+    void *field_context;
+    float constant_field[3];
+    float self_test_field[3];
+    float temperature_c;
+    int32_t odr_error_ppm;
+
+    lis3mdl_sim_drdy_t drdy;
+    void *drdy_context;
+    bool drdy_level;
+
+    lis3mdl_sim_int_t interrupt;
+    void *interrupt_context;
+    bool int_level;
+
+    /* Status for the next transfer addressed to this model, then STATUS_OK */
+    status_t fail_next;
+
+    uint32_t conversions;
+    uint32_t overruns;
+} lis3mdl_sim_t;
+
+/* Power-on state: default registers, powered down, zero field at 25 C */
+void lis3mdl_sim_init(lis3mdl_sim_t *sim);
+
+/*
+ * Answer at `bus_address` on controller `bus`, installing the model as that
+ * controller's port. Targets nobody is attached at NACK.
+ */
+status_t lis3mdl_sim_attach(
+    lis3mdl_sim_t *sim,
+    uint8_t bus,
+    uint8_t bus_address);
+
+/* Stop answering; the controller keeps the model port for other targets */
+void lis3mdl_sim_detach(lis3mdl_sim_t *sim);
+
+/* Use a field source instead of the constant field; NULL restores it */
+void lis3mdl_sim_set_field(
+    lis3mdl_sim_t *sim,
+    lis3mdl_sim_field_t field,
+    void *context);
+
+void lis3mdl_sim_set_constant_field(
+    lis3mdl_sim_t *sim,
+    float x,
+    float y,
+    float z);
+
+/*
+ * Field the self-test coil adds while ST is set, in gauss. It defaults to
+ * a response inside the datasheet limits; set it outside them to model a
+ * part that fails.
+ */
+void lis3mdl_sim_set_self_test_field(
+    lis3mdl_sim_t *sim,
+    float x,
+    float y,
+    float z);
+
+void lis3mdl_sim_set_temperature(
+    lis3mdl_sim_t *sim,
+    float celsius);
+
+/* Run the output clock `ppm` fast (or slow, if negative) against nominal */
+void lis3mdl_sim_set_odr_error(
+    lis3mdl_sim_t *sim,
+    int32_t ppm);
+
+void lis3mdl_sim_set_drdy_callback(
+    lis3mdl_sim_t *sim,
+    lis3mdl_sim_drdy_t drdy,
+    void *context);
+
+/* Current level of the DRDY pin */
+bool lis3mdl_sim_drdy_level(const lis3mdl_sim_t *sim);
+
+void lis3mdl_sim_set_int_callback(
+    lis3mdl_sim_t *sim,
+    lis3mdl_sim_int_t interrupt,
+    void *context);
+
+/* Whether INT is asserted */
+bool lis3mdl_sim_int_asserted(const lis3mdl_sim_t *sim);
+
+/* Make the next transfer to `sim` end with `status` instead of running */
+void lis3mdl_sim_fail_next(
+    lis3mdl_sim_t *sim,
+    status_t status);
+
+/* SCL rate used to time transfers, 400 kHz by default */
+void lis3mdl_sim_set_bus_rate(uint32_t hz);
+
+/* Run every attached model forward by `ns` of virtual time */
+void lis3mdl_sim_advance(uint64_t ns);
+
+uint64_t lis3mdl_sim_time_ns(void);
+
+/* Virtual time as an i2c_time_source_t, for deadlines and statistics */
+uint32_t lis3mdl_sim_time_us(void);
+
+/*
+ * Field trace playback for lis3mdl_sim_set_field(): sample i applies from
+ * i * period_ns, and the trace repeats after `count` samples.
+ */
+typedef struct {
+    const float (*gauss)[3];
+    uint32_t count;
+    uint64_t period_ns;
+} lis3mdl_sim_trace_t;
+
+void lis3mdl_sim_trace_field(
+    void *trace,
+    uint64_t time_ns,
+    float gauss[3]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
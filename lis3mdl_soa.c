@@ -0,0 +1,74 @@
+#include "lis3mdl_soa.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOCK_MASK (LIS3MDL_SOA_BLOCK_COUNT - 1)
+
+#if (LIS3MDL_SOA_BLOCK_COUNT & BLOCK_MASK) != 0
+#error "LIS3MDL_SOA_BLOCK_COUNT must be a power of two"
+#endif
+
+void lis3mdl_soa_reset(lis3mdl_soa_buffer_t *buffer)
+{
+    atomic_init(&buffer->head, 0);
+    atomic_init(&buffer->tail, 0);
+    buffer->fill = 0;
+}
+
+lis3mdl_soa_block_t *lis3mdl_soa_reserve(
+    lis3mdl_soa_buffer_t *buffer,
+    size_t *index)
+{
+    uint32_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+
+    if ((uint32_t)(tail - head) == LIS3MDL_SOA_BLOCK_COUNT) {
+        return NULL;
+    }
+
+    *index = buffer->fill;
+    return &buffer->blocks[tail & BLOCK_MASK];
+}
+
+static void publish(lis3mdl_soa_buffer_t *buffer)
+{
+    uint32_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+
+    buffer->blocks[tail & BLOCK_MASK].count = buffer->fill;
+    buffer->fill = 0;
+    atomic_store_explicit(&buffer->tail, tail + 1, memory_order_release);
+}
+
+void lis3mdl_soa_commit(lis3mdl_soa_buffer_t *buffer)
+{
+    if (++buffer->fill == LIS3MDL_SOA_BLOCK_SAMPLES) {
+        publish(buffer);
+    }
+}
+
+void lis3mdl_soa_flush(lis3mdl_soa_buffer_t *buffer)
+{
+    if (buffer->fill > 0) {
+        publish(buffer);
+    }
+}
+
+const lis3mdl_soa_block_t *lis3mdl_soa_take(lis3mdl_soa_buffer_t *buffer)
+{
+    uint32_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&buffer->tail, memory_order_acquire);
+
+    if (head == tail) {
+        return NULL;
+    }
+    return &buffer->blocks[head & BLOCK_MASK];
+}
+
+void lis3mdl_soa_release(lis3mdl_soa_buffer_t *buffer)
+{
+    uint32_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+}
@@ -0,0 +1,78 @@
+#ifndef LIS3MDL_SOA_HEADER_H
+#define LIS3MDL_SOA_HEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lis3mdl_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Samples per block */
+#ifndef LIS3MDL_SOA_BLOCK_SAMPLES
+#define LIS3MDL_SOA_BLOCK_SAMPLES 64
+#endif
+
+/* Blocks per buffer, must be a power of two */
+#ifndef LIS3MDL_SOA_BLOCK_COUNT
+#define LIS3MDL_SOA_BLOCK_COUNT 4
+#endif
+
+/* One block of samples held as separate contiguous channels */
+typedef struct {
+    int16_t x[LIS3MDL_SOA_BLOCK_SAMPLES];
+    int16_t y[LIS3MDL_SOA_BLOCK_SAMPLES];
+    int16_t z[LIS3MDL_SOA_BLOCK_SAMPLES];
+    uint32_t timestamp[LIS3MDL_SOA_BLOCK_SAMPLES];
+    uint16_t sequence[LIS3MDL_SOA_BLOCK_SAMPLES];
+    uint32_t count; /* Valid samples, LIS3MDL_SOA_BLOCK_SAMPLES unless flushed */
+} lis3mdl_soa_block_t;
+
+/*
+ * Single-producer/single-consumer ring of SoA blocks. The producer fills
+ * the block at `tail` sample by sample and publishes it when full; the
+ * consumer takes the block at `head` by pointer, works on it in place and
+ * releases it. Blocks are never copied.
+ */
+typedef struct {
+    lis3mdl_soa_block_t blocks[LIS3MDL_SOA_BLOCK_COUNT];
+    lis3mdl_ring_index_t head;
+    lis3mdl_ring_index_t tail;
+    uint32_t fill; /* Producer only: samples in the block being filled */
+} lis3mdl_soa_buffer_t;
+
+void lis3mdl_soa_reset(lis3mdl_soa_buffer_t *buffer);
+
+/*
+ * Producer side. lis3mdl_soa_reserve() returns the block being filled and
+ * stores the slot to write in `index`, or returns NULL if every block is
+ * waiting for the consumer. lis3mdl_soa_commit() accounts for the written
+ * slot and publishes the block once it is full.
+ */
+lis3mdl_soa_block_t *lis3mdl_soa_reserve(
+    lis3mdl_soa_buffer_t *buffer,
+    size_t *index);
+
+void lis3mdl_soa_commit(lis3mdl_soa_buffer_t *buffer);
+
+/*
+ * Publish a partially filled block. Producer side only, e.g. once
+ * acquisition has been stopped.
+ */
+void lis3mdl_soa_flush(lis3mdl_soa_buffer_t *buffer);
+
+/*
+ * Consumer side. lis3mdl_soa_take() returns the oldest completed block, or
+ * NULL if none is ready. The block stays valid until lis3mdl_soa_release().
+ */
+const lis3mdl_soa_block_t *lis3mdl_soa_take(lis3mdl_soa_buffer_t *buffer);
+
+void lis3mdl_soa_release(lis3mdl_soa_buffer_t *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
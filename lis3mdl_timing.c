@@ -0,0 +1,234 @@
+#include "lis3mdl_timing.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define Q16_ONE 65536
+
+/* A stamp this many conversions after the last one restarts the fit */
+#define MAX_STEPS 65536
+
+/* Floor division by 2^16, well defined for negative values */
+static int64_t floor_q16(int64_t value)
+{
+    return value >= 0 ? value / Q16_ONE : -((-value + Q16_ONE - 1) / Q16_ONE);
+}
+
+/* value * 2^-shift, rounding towards zero on both sides */
+static int64_t scale_down(int64_t value, uint8_t shift)
+{
+    return value >= 0 ? value >> shift : -((-value) >> shift);
+}
+
+static void move_phase(
+    lis3mdl_timing_t *timing,
+    int64_t delta_q16)
+{
+    int64_t total = (int64_t)timing->phase_fraction + delta_q16;
+    int64_t whole = floor_q16(total);
+
+    timing->phase_ns += (uint64_t)whole;
+    timing->phase_fraction = (uint32_t)(total - whole * Q16_ONE);
+}
+
+static void begin_write(lis3mdl_timing_t *timing)
+{
+    uint32_t version =
+        atomic_load_explicit(&timing->version, memory_order_relaxed);
+
+    atomic_store_explicit(&timing->version, version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void end_write(lis3mdl_timing_t *timing)
+{
+    uint32_t version =
+        atomic_load_explicit(&timing->version, memory_order_relaxed);
+
+    atomic_store_explicit(&timing->version, version + 1, memory_order_release);
+}
+
+void lis3mdl_timing_init(
+    lis3mdl_timing_t *timing,
+    uint32_t nominal_period_ns)
+{
+    atomic_init(&timing->version, 0);
+    timing->nominal_period_ns = nominal_period_ns;
+    timing->phase_shift = LIS3MDL_TIMING_PHASE_SHIFT;
+    timing->period_shift = LIS3MDL_TIMING_PERIOD_SHIFT;
+    timing->stamps = 0;
+    timing->sequence = 0;
+    timing->phase_ns = 0;
+    timing->phase_fraction = 0;
+    timing->period_q16 = (int64_t)nominal_period_ns * Q16_ONE;
+    timing->jitter_q4 = 0;
+    timing->missed = 0;
+}
+
+void lis3mdl_timing_restart(
+    lis3mdl_timing_t *timing,
+    uint32_t nominal_period_ns)
+{
+    begin_write(timing);
+    if (timing->stamps != 0) {
+        timing->sequence++;
+    }
+    timing->nominal_period_ns = nominal_period_ns;
+    timing->stamps = 0;
+    timing->period_q16 = (int64_t)nominal_period_ns * Q16_ONE;
+    timing->jitter_q4 = 0;
+    end_write(timing);
+}
+
+void lis3mdl_timing_set_gains(
+    lis3mdl_timing_t *timing,
+    uint8_t phase_shift,
+    uint8_t period_shift)
+{
+    begin_write(timing);
+    timing->phase_shift = phase_shift < 16 ? phase_shift : 16;
+    timing->period_shift = period_shift < 24 ? period_shift : 24;
+    end_write(timing);
+}
+
+/* log2 of the stamps taken, which sets the gains while the loop locks */
+static uint8_t acquisition_shift(const lis3mdl_timing_t *timing)
+{
+    uint8_t shift = 0;
+
+    while (shift < 31 && (timing->stamps >> (shift + 1)) != 0) {
+        shift++;
+    }
+    return shift;
+}
+
+static bool locked(const lis3mdl_timing_t *timing)
+{
+    uint8_t needed = timing->phase_shift;
+
+    if ((uint8_t)((timing->period_shift + 1) / 2) > needed) {
+        needed = (uint8_t)((timing->period_shift + 1) / 2);
+    }
+    return acquisition_shift(timing) >= needed;
+}
+
+uint32_t lis3mdl_timing_update(
+    lis3mdl_timing_t *timing,
+    uint64_t stamp_ns)
+{
+    begin_write(timing);
+
+    int64_t elapsed_ns = (int64_t)(stamp_ns - timing->phase_ns);
+    int64_t steps = MAX_STEPS + 1;
+
+    if (timing->period_q16 > 0 && elapsed_ns < INT64_MAX / Q16_ONE) {
+        int64_t elapsed_q16 =
+            elapsed_ns * Q16_ONE - (int64_t)timing->phase_fraction;
+        steps = elapsed_q16 >= 0
+            ? (elapsed_q16 + timing->period_q16 / 2) / timing->period_q16
+            : 0;
+    }
+
+    if (timing->stamps == 0 || steps > MAX_STEPS) {
+        /* First stamp, or a gap too long to bridge: anchor the phase here */
+        if (timing->stamps != 0) {
+            timing->sequence++;
+        }
+        timing->stamps = 1;
+        timing->phase_ns = stamp_ns;
+        timing->phase_fraction = 0;
+        end_write(timing);
+        return timing->sequence;
+    }
+
+    /* A stamp early enough to round to the last conversion is jitter */
+    if (steps < 1) {
+        steps = 1;
+    }
+    move_phase(timing, steps * timing->period_q16);
+    timing->sequence += (uint32_t)steps;
+    timing->missed += (uint32_t)(steps - 1);
+
+    int64_t residual_q16 =
+        (int64_t)(stamp_ns - timing->phase_ns) * Q16_ONE
+        - (int64_t)timing->phase_fraction;
+
+    uint8_t shift = acquisition_shift(timing);
+    uint8_t phase_shift = shift < timing->phase_shift
+        ? shift
+        : timing->phase_shift;
+    uint8_t period_shift = 2 * shift < timing->period_shift
+        ? (uint8_t)(2 * shift)
+        : timing->period_shift;
+
+    move_phase(timing, scale_down(residual_q16, phase_shift));
+    timing->period_q16 += scale_down(residual_q16, period_shift) / steps;
+
+    /* Keep a runaway fit within 25 % of nominal */
+    int64_t nominal_q16 = (int64_t)timing->nominal_period_ns * Q16_ONE;
+    if (timing->period_q16 < nominal_q16 - nominal_q16 / 4) {
+        timing->period_q16 = nominal_q16 - nominal_q16 / 4;
+    } else if (timing->period_q16 > nominal_q16 + nominal_q16 / 4) {
+        timing->period_q16 = nominal_q16 + nominal_q16 / 4;
+    }
+
+    uint64_t error_ns = (uint64_t)(residual_q16 >= 0
+        ? residual_q16
+        : -residual_q16) / Q16_ONE;
+    if (error_ns > UINT32_MAX / 32) {
+        error_ns = UINT32_MAX / 32;
+    }
+    timing->jitter_q4 += (uint32_t)error_ns - (timing->jitter_q4 >> 4);
+
+    if (timing->stamps < UINT32_MAX) {
+        timing->stamps++;
+    }
+    uint32_t sequence = timing->sequence;
+    end_write(timing);
+    return sequence;
+}
+
+void lis3mdl_timing_get(
+    lis3mdl_timing_t *timing,
+    lis3mdl_timing_estimate_t *estimate)
+{
+    uint32_t before;
+    uint32_t after;
+    int64_t nominal_q16;
+
+    do {
+        before = atomic_load_explicit(&timing->version, memory_order_acquire);
+
+        estimate->phase_ns = timing->phase_ns;
+        estimate->sequence = timing->sequence;
+        estimate->period_q16 = timing->period_q16;
+        estimate->jitter_ns = timing->jitter_q4 >> 4;
+        estimate->missed = timing->missed;
+        estimate->locked = locked(timing);
+        nominal_q16 = (int64_t)timing->nominal_period_ns * Q16_ONE;
+
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&timing->version, memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+
+    /* No period before the first one is known, or while not converting */
+    if (estimate->period_q16 <= 0) {
+        estimate->odr_hz = 0.0f;
+        estimate->drift_ppm = 0.0f;
+        return;
+    }
+    estimate->odr_hz = (float)(1e9 * Q16_ONE / (double)estimate->period_q16);
+    estimate->drift_ppm = (float)(1e6 * (double)(nominal_q16
+        - estimate->period_q16) / (double)estimate->period_q16);
+}
+
+uint64_t lis3mdl_timing_time_ns(
+    const lis3mdl_timing_estimate_t *estimate,
+    uint16_t sequence)
+{
+    int16_t delta = (int16_t)(uint16_t)(sequence - estimate->sequence);
+
+    return estimate->phase_ns
+        + (uint64_t)floor_q16(delta * estimate->period_q16 + Q16_ONE / 2);
+}
@@ -0,0 +1,111 @@
+#ifndef LIS3MDL_TIMING_HEADER_H
+#define LIS3MDL_TIMING_HEADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lis3mdl_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Output clock estimator. The LIS3MDL paces conversions from its own
+ * oscillator, which runs a few hundred ppm off nominal and drifts with
+ * temperature, so sample n is not at n times the nominal period on the host
+ * clock. The estimator is fed the host time of each data-ready and tracks
+ * the sensor clock with a second-order loop:
+ *
+ *     t(n) = phase + (n - sequence) * period
+ *
+ * Each stamp is assigned the conversion it is nearest to, so reads that
+ * miss a data-ready leave a gap in the sequence rather than skewing the
+ * fit. Its residual then corrects the phase by 2^-phase_shift of the error
+ * and the period by 2^-period_shift per elapsed conversion. Gains start
+ * wide and narrow to these as stamps accumulate, so the loop locks within
+ * a few dozen samples and then filters interrupt latency jitter out of the
+ * timestamps it serves.
+ *
+ * The producer updates the estimator from the data-ready path, and readers
+ * in other contexts take a consistent snapshot through a sequence lock.
+ * Arithmetic is integer: the period is held in 1/65536 ns.
+ */
+
+#define LIS3MDL_TIMING_PHASE_SHIFT  3
+#define LIS3MDL_TIMING_PERIOD_SHIFT 7
+
+/* Snapshot of the fitted output clock */
+typedef struct {
+    uint64_t phase_ns;      /* Fitted host time of conversion `sequence` */
+    uint32_t sequence;      /* Conversions since reset, missed ones included */
+    int64_t period_q16;     /* Fitted period, in 1/65536 ns */
+    float odr_hz;           /* 0 while no period is known */
+    float drift_ppm;        /* Sensor clock against nominal, + is fast */
+    uint32_t jitter_ns;     /* Mean absolute residual of the stamps */
+    uint32_t missed;        /* Conversions with no stamp */
+    bool locked;
+} lis3mdl_timing_estimate_t;
+
+typedef struct {
+    lis3mdl_ring_index_t version; /* Odd while the producer updates */
+
+    uint32_t nominal_period_ns;
+    uint8_t phase_shift;
+    uint8_t period_shift;
+
+    uint32_t stamps;
+    uint32_t sequence;
+    uint64_t phase_ns;
+    uint32_t phase_fraction; /* Below 1 ns, in 1/65536 ns */
+    int64_t period_q16;
+    uint32_t jitter_q4;      /* Mean absolute residual, in 1/16 ns */
+    uint32_t missed;
+} lis3mdl_timing_t;
+
+/* Forget the fit and start again from `nominal_period_ns` */
+void lis3mdl_timing_init(
+    lis3mdl_timing_t *timing,
+    uint32_t nominal_period_ns);
+
+/*
+ * Producer side: start a new fit at `nominal_period_ns`, e.g. after an ODR
+ * change. The sequence carries on, counting one conversion for the gap.
+ */
+void lis3mdl_timing_restart(
+    lis3mdl_timing_t *timing,
+    uint32_t nominal_period_ns);
+
+/* Loop gains as powers of two, defaulting to the LIS3MDL_TIMING_* shifts */
+void lis3mdl_timing_set_gains(
+    lis3mdl_timing_t *timing,
+    uint8_t phase_shift,
+    uint8_t period_shift);
+
+/*
+ * Producer side: account for a data-ready seen at `stamp_ns` and return the
+ * sequence number of the conversion it belongs to.
+ */
+uint32_t lis3mdl_timing_update(
+    lis3mdl_timing_t *timing,
+    uint64_t stamp_ns);
+
+void lis3mdl_timing_get(
+    lis3mdl_timing_t *timing,
+    lis3mdl_timing_estimate_t *estimate);
+
+/*
+ * Fitted host time of the conversion numbered `sequence` on the estimate,
+ * for interpolation and resampling. Only the low 16 bits of the sequence
+ * are used, so the sample must be within 32768 conversions of the latest
+ * stamp; later conversions are extrapolated.
+ */
+uint64_t lis3mdl_timing_time_ns(
+    const lis3mdl_timing_estimate_t *estimate,
+    uint16_t sequence);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
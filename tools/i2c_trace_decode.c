@@ -0,0 +1,87 @@
+/*
+ * Offline decoder for i2c_trace_export() dumps.
+ *
+ *     cc -o i2c_trace_decode tools/i2c_trace_decode.c
+ *     ./i2c_trace_decode trace.bin
+ *
+ * Reads the dump from the named file, or standard input, and prints one
+ * line per recorded segment.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HEADER_SIZE 12
+#define DATA_BYTES  4
+
+static const char *const status_names[] = {
+    "OK", "ERROR", "BUSY", "PENDING", "TIMEOUT", "NACK", "ARB_LOST",
+};
+
+static uint16_t get_le16(const uint8_t *in)
+{
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *in)
+{
+    return (uint32_t)get_le16(in) | ((uint32_t)get_le16(in + 2) << 16);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in = stdin;
+    uint8_t header[HEADER_SIZE];
+    uint8_t record[256];
+
+    if (argc > 1 && (in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (fread(header, 1, sizeof(header), in) != sizeof(header)
+        || memcmp(header, "I2CT", 4) != 0) {
+        fprintf(stderr, "not an I2C trace dump\n");
+        return 1;
+    }
+    if (header[4] != 1 || header[5] < 16) {
+        fprintf(stderr, "unsupported trace version %u\n", header[4]);
+        return 1;
+    }
+
+    size_t record_size = header[5];
+    uint16_t count = get_le16(&header[6]);
+    uint32_t first = get_le32(&header[8]);
+
+    printf("# %u records, %lu overwritten before the first\n",
+        count,
+        (unsigned long)first);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (fread(record, 1, record_size, in) != record_size) {
+            fprintf(stderr, "truncated dump at record %lu\n", (unsigned long)i);
+            return 1;
+        }
+
+        uint8_t status = record[10];
+        uint8_t data_length = record[11];
+
+        printf(
+            "%10lu us  bus %u  0x%02x %s reg 0x%02x len %3u  %-8s",
+            (unsigned long)get_le32(&record[0]),
+            record[4],
+            record[5],
+            record[7] == 0 ? "rd" : "wr",
+            record[6],
+            get_le16(&record[8]),
+            status < sizeof(status_names) / sizeof(status_names[0])
+                ? status_names[status]
+                : "?");
+        for (uint8_t b = 0; b < data_length && b < DATA_BYTES; ++b) {
+            printf(" %02x", record[12 + b]);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,344 @@
+/*
+ * Driver benchmark on the simulated LIS3MDL (lis3mdl_sim).
+ *
+ *     cc -O2 -std=c11 -DI2C_STATS=1 -I. -o lis3mdl_bench \
+ *         tools/lis3mdl_bench.c i2c.c i2c_stats.c i2c_trace.c lis3mdl*.c
+ *     ./lis3mdl_bench [samples] [scl_hz]
+ *
+ * Each acquisition mode runs the sensor at FAST_ODR in low-power mode
+ * (1 kHz) until `samples` samples (default 20000) have reached the
+ * consumer. Polled modes and the ring consumers check in every POLL_US of
+ * virtual time. One JSON object is printed per mode:
+ *
+ *   samples_per_sec          host throughput of driver plus model
+ *   virtual_samples_per_sec  delivered rate on the simulated timeline
+ *   bytes_per_sample         payload bytes on the bus
+ *   transactions_per_sample  I2C transactions
+ *   cycles_per_sample        host cycle counter (TSC, CNTVCT or ns), model
+ *                            cost included
+ *   latency_us               rising DRDY edge to the sample reaching the
+ *                            consumer, in virtual microseconds
+ *   lost                     sensor overruns, ring overflows, missed edges
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "i2c.h"
+#include "i2c_stats.h"
+#include "lis3mdl.h"
+#include "lis3mdl_sim.h"
+
+#if !I2C_STATS
+#error "build with -DI2C_STATS=1 so bus traffic is counted"
+#endif
+
+#define FORMAT_VERSION 1
+
+#define POLL_US 50
+
+#define DEFAULT_SAMPLES 20000
+
+typedef enum {
+    MODE_PER_AXIS,
+    MODE_BURST,
+    MODE_BDU,
+    MODE_FAST_READ,
+    MODE_INTERRUPT,
+    MODE_ASYNC,
+    MODE_RING,
+    MODE_SOA,
+    MODE_COUNT
+} bench_mode_t;
+
+static const char *const mode_names[MODE_COUNT] = {
+    "per_axis", "burst", "bdu", "fast_read",
+    "interrupt", "async", "ring", "soa_block",
+};
+
+static lis3mdl_sim_t sim;
+static lis3mdl_dev_t dev;
+static lis3mdl_soa_buffer_t soa;
+static lis3mdl_sample_t drained[LIS3MDL_RING_CAPACITY];
+
+static bench_mode_t mode;
+static uint32_t edge_us;
+static uint32_t *latencies;
+static uint32_t consumed;
+static uint32_t wanted;
+static int16_t xyz[3];
+static volatile int32_t sink;
+static int async_in_flight;
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static double host_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void consume(
+    const int16_t sample[3],
+    uint32_t produced_us)
+{
+    if (consumed < wanted) {
+        latencies[consumed++] = lis3mdl_sim_time_us() - produced_us;
+    }
+    sink += sample[0] + sample[1] + sample[2];
+}
+
+static void on_drdy(void *context)
+{
+    (void)context;
+    edge_us = lis3mdl_sim_time_us();
+    if (mode == MODE_INTERRUPT || mode == MODE_RING || mode == MODE_SOA) {
+        lis3mdl_on_data_ready(&dev);
+    }
+}
+
+static void on_sample(
+    lis3mdl_dev_t *device,
+    status_t status,
+    int16_t sample[3],
+    void *context)
+{
+    (void)device;
+    (void)context;
+    async_in_flight = 0;
+    if (status == STATUS_OK) {
+        consume(sample, edge_us);
+    }
+}
+
+static status_t configure(void)
+{
+    lis3mdl_config_t config = {
+        .odr = LIS3MDL_ODR_FAST,
+        .full_scale = LIS3MDL_FULL_SCALE_4_GAUSS,
+        .xy_mode = LIS3MDL_OP_MODE_LOW_POWER,
+        .z_mode = LIS3MDL_OP_MODE_LOW_POWER,
+        .measurement_mode = LIS3MDL_MEASUREMENT_CONTINUOUS,
+        .block_data_update = mode != MODE_PER_AXIS && mode != MODE_BURST
+            && mode != MODE_FAST_READ,
+        .fast_read = mode == MODE_FAST_READ,
+    };
+    status_t status = lis3mdl_init(&dev, LIS3MDL_ADDRESS_SA1_LOW);
+
+    if (status != STATUS_OK) {
+        return status;
+    }
+
+    switch (mode) {
+    case MODE_INTERRUPT:
+        status = lis3mdl_apply_config(&dev, &config);
+        if (status == STATUS_OK) {
+            status = lis3mdl_start_acquisition(&dev, xyz, on_sample, NULL);
+        }
+        return status;
+    case MODE_RING:
+        status = lis3mdl_apply_config(&dev, &config);
+        return status == STATUS_OK
+            ? lis3mdl_start_ring_acquisition(&dev, lis3mdl_sim_time_us)
+            : status;
+    case MODE_SOA:
+        status = lis3mdl_apply_config(&dev, &config);
+        return status == STATUS_OK
+            ? lis3mdl_start_soa_acquisition(&dev, &soa, lis3mdl_sim_time_us)
+            : status;
+    default:
+        return lis3mdl_apply_config(&dev, &config);
+    }
+}
+
+/* One consumer check-in: poll DRDY or drain what acquisition produced */
+static status_t step(void)
+{
+    status_t status = STATUS_OK;
+
+    switch (mode) {
+    case MODE_PER_AXIS:
+    case MODE_BURST:
+    case MODE_BDU:
+    case MODE_FAST_READ:
+        if (!lis3mdl_sim_drdy_level(&sim)) {
+            break;
+        }
+        if (mode == MODE_PER_AXIS) {
+            for (size_t axis = 0; axis < 3 && status == STATUS_OK; ++axis) {
+                status = lis3mdl_read_axis(&dev, (lis3mdl_axis_t)axis, &xyz[axis]);
+            }
+        } else if (mode == MODE_FAST_READ) {
+            status = lis3mdl_read_xyz_fast(&dev, xyz);
+        } else {
+            status = lis3mdl_read_xyz(&dev, xyz);
+        }
+        if (status == STATUS_OK) {
+            consume(xyz, edge_us);
+        }
+        break;
+    case MODE_ASYNC:
+        if (!async_in_flight && lis3mdl_sim_drdy_level(&sim)) {
+            async_in_flight = 1;
+            status = lis3mdl_read_xyz_async(&dev, xyz, on_sample, NULL);
+        }
+        break;
+    case MODE_RING: {
+        size_t count = lis3mdl_ring_pop(&dev.ring, drained, LIS3MDL_RING_CAPACITY);
+        for (size_t i = 0; i < count; ++i) {
+            const int16_t sample[3] = {drained[i].x, drained[i].y, drained[i].z};
+            consume(sample, drained[i].timestamp);
+        }
+        break;
+    }
+    case MODE_SOA: {
+        const lis3mdl_soa_block_t *block;
+        while ((block = lis3mdl_soa_take(&soa)) != NULL) {
+            for (size_t i = 0; i < block->count; ++i) {
+                const int16_t sample[3] = {block->x[i], block->y[i], block->z[i]};
+                consume(sample, block->timestamp[i]);
+            }
+            lis3mdl_soa_release(&soa);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return status;
+}
+
+static int compare_u32(
+    const void *a,
+    const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(
+    const uint32_t *sorted,
+    uint32_t count,
+    uint32_t per_mille)
+{
+    return sorted[(uint64_t)(count - 1) * per_mille / 1000];
+}
+
+static int run(bench_mode_t selected)
+{
+    mode = selected;
+    consumed = 0;
+    async_in_flight = 0;
+
+    lis3mdl_sim_detach(&sim);
+    lis3mdl_sim_init(&sim);
+    lis3mdl_sim_set_constant_field(&sim, 0.21f, -0.05f, 0.43f);
+    lis3mdl_sim_set_drdy_callback(&sim, on_drdy, NULL);
+    lis3mdl_sim_attach(&sim, 0, LIS3MDL_ADDRESS_SA1_LOW);
+
+    status_t status = configure();
+    if (status != STATUS_OK) {
+        fprintf(stderr, "%s: configuration failed (%d)\n", mode_names[mode], status);
+        return 1;
+    }
+
+    i2c_reset_bus_stats(0);
+    uint64_t virtual_start_ns = lis3mdl_sim_time_ns();
+    double host_start = host_seconds();
+    uint64_t cycles_start = cycles();
+
+    while (consumed < wanted && status == STATUS_OK) {
+        lis3mdl_sim_advance(POLL_US * 1000u);
+        status = step();
+    }
+
+    uint64_t cycles_total = cycles() - cycles_start;
+    double host_elapsed = host_seconds() - host_start;
+    double virtual_elapsed = (double)(lis3mdl_sim_time_ns() - virtual_start_ns) * 1e-9;
+
+    i2c_bus_stats_t stats;
+    lis3mdl_overruns_t lost;
+    i2c_get_bus_stats(0, &stats);
+    lis3mdl_get_overruns(&dev, &lost);
+    lis3mdl_stop_acquisition(&dev);
+
+    if (status != STATUS_OK) {
+        fprintf(stderr, "%s: read failed (%d)\n", mode_names[mode], status);
+        return 1;
+    }
+
+    qsort(latencies, consumed, sizeof(latencies[0]), compare_u32);
+    printf(
+        "{\"version\":%d,\"mode\":\"%s\",\"samples\":%u,"
+        "\"samples_per_sec\":%.0f,\"virtual_samples_per_sec\":%.1f,"
+        "\"bytes_per_sample\":%.2f,\"transactions_per_sample\":%.2f,"
+        "\"cycles_per_sample\":%.0f,"
+        "\"latency_us\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u},"
+        "\"lost\":{\"sensor_overruns\":%u,\"ring_full\":%u,"
+        "\"missed_data_ready\":%u}}\n",
+        FORMAT_VERSION,
+        mode_names[mode],
+        consumed,
+        (double)consumed / host_elapsed,
+        (double)consumed / virtual_elapsed,
+        (double)stats.bytes / consumed,
+        (double)stats.transactions / consumed,
+        (double)cycles_total / consumed,
+        percentile(latencies, consumed, 500),
+        percentile(latencies, consumed, 900),
+        percentile(latencies, consumed, 990),
+        latencies[consumed - 1],
+        lost.sensor_overruns,
+        lost.ring_full,
+        lost.missed_data_ready);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    wanted = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : DEFAULT_SAMPLES;
+    if (argc > 2) {
+        lis3mdl_sim_set_bus_rate((uint32_t)strtoul(argv[2], NULL, 0));
+    }
+    if (wanted == 0) {
+        fprintf(stderr, "usage: %s [samples] [scl_hz]\n", argv[0]);
+        return 2;
+    }
+
+    latencies = malloc(wanted * sizeof(latencies[0]));
+    if (latencies == NULL) {
+        return 1;
+    }
+    i2c_set_time_source(lis3mdl_sim_time_us);
+
+    int failures = 0;
+    for (int m = 0; m < MODE_COUNT; ++m) {
+        failures += run((bench_mode_t)m);
+    }
+    free(latencies);
+    return failures != 0;
+}
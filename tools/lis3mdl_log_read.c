@@ -0,0 +1,281 @@
+/*
+ * Host reader for lis3mdl_log files.
+ *
+ *     cc -O2 -std=c11 -pthread -I. -o lis3mdl_log_read \
+ *         tools/lis3mdl_log_read.c lis3mdl_log.c
+ *     ./lis3mdl_log_read [-j threads] [-c | -b block] log.bin
+ *
+ * The file is memory-mapped and its block headers are indexed in one pass
+ * that skips payloads; damaged regions are resynchronised on the block
+ * magic, checking the CRC of any block that does not end on another one. Without options every block is decoded and verified on `threads`
+ * workers (default 4) and a summary is printed. -c decodes in parallel and
+ * prints all samples as CSV in log order; -b decodes only the given block.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lis3mdl_log.h"
+
+#define MAX_THREADS 64
+
+typedef struct {
+    size_t offset;
+    lis3mdl_log_header_t header;
+    size_t first_sample; /* Position of the block's first sample in the log */
+} block_entry_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    block_entry_t *blocks;
+    size_t block_count;
+    size_t sample_count;
+    size_t skipped_bytes;
+} log_index_t;
+
+typedef struct {
+    const log_index_t *index;
+    lis3mdl_sample_t *samples; /* NULL to verify only */
+    size_t worker;
+    size_t workers;
+    size_t failures;
+} worker_t;
+
+static int build_index(log_index_t *index)
+{
+    size_t capacity = 64;
+    size_t offset = 0;
+
+    index->blocks = malloc(capacity * sizeof(index->blocks[0]));
+    if (index->blocks == NULL) {
+        return -1;
+    }
+
+    while (offset < index->size) {
+        block_entry_t entry;
+
+        entry.offset =
+            lis3mdl_log_find_block(index->data, index->size, offset, &entry.header);
+        index->skipped_bytes += entry.offset - offset;
+        if (entry.offset == index->size) {
+            break;
+        }
+        offset = entry.offset;
+
+        if (index->block_count == capacity) {
+            block_entry_t *grown =
+                realloc(index->blocks, 2 * capacity * sizeof(index->blocks[0]));
+            if (grown == NULL) {
+                return -1;
+            }
+            index->blocks = grown;
+            capacity *= 2;
+        }
+        entry.first_sample = index->sample_count;
+        index->blocks[index->block_count++] = entry;
+        index->sample_count += entry.header.count;
+        offset += lis3mdl_log_block_size(&entry.header);
+    }
+    return 0;
+}
+
+static status_t decode_block(
+    const log_index_t *index,
+    size_t block,
+    lis3mdl_sample_t *out)
+{
+    const block_entry_t *entry = &index->blocks[block];
+    lis3mdl_log_header_t header;
+
+    return lis3mdl_log_decode(
+        index->data + entry->offset,
+        index->size - entry->offset,
+        out,
+        entry->header.count,
+        &header);
+}
+
+static void *decode_worker(void *argument)
+{
+    worker_t *worker = argument;
+    const log_index_t *index = worker->index;
+    lis3mdl_sample_t scratch[LIS3MDL_LOG_BLOCK_SAMPLES];
+
+    for (size_t b = worker->worker; b < index->block_count; b += worker->workers) {
+        lis3mdl_sample_t *out = worker->samples != NULL
+            ? &worker->samples[index->blocks[b].first_sample]
+            : scratch;
+
+        /* Blocks written with a larger LIS3MDL_LOG_BLOCK_SAMPLES need the full output */
+        if (out == scratch && index->blocks[b].header.count > LIS3MDL_LOG_BLOCK_SAMPLES) {
+            worker->failures++;
+            continue;
+        }
+        if (decode_block(index, b, out) != STATUS_OK) {
+            worker->failures++;
+        }
+    }
+    return NULL;
+}
+
+static size_t decode_parallel(
+    const log_index_t *index,
+    lis3mdl_sample_t *samples,
+    size_t workers)
+{
+    pthread_t threads[MAX_THREADS];
+    worker_t state[MAX_THREADS];
+    size_t failures = 0;
+
+    for (size_t w = 0; w < workers; ++w) {
+        state[w] = (worker_t){
+            .index = index,
+            .samples = samples,
+            .worker = w,
+            .workers = workers,
+        };
+        if (pthread_create(&threads[w], NULL, decode_worker, &state[w]) != 0) {
+            decode_worker(&state[w]);
+            threads[w] = pthread_self();
+        }
+    }
+    for (size_t w = 0; w < workers; ++w) {
+        if (!pthread_equal(threads[w], pthread_self())) {
+            pthread_join(threads[w], NULL);
+        }
+        failures += state[w].failures;
+    }
+    return failures;
+}
+
+static void print_csv(
+    const log_index_t *index,
+    size_t block,
+    const lis3mdl_sample_t *samples)
+{
+    const lis3mdl_log_header_t *header = &index->blocks[block].header;
+
+    for (size_t i = 0; i < header->count; ++i) {
+        printf(
+            "%lu,%lu,0x%02x,0x%02x,%lu,%d,%d,%d\n",
+            (unsigned long)header->sequence,
+            (unsigned long)i,
+            header->ctrl_reg1,
+            header->ctrl_reg2,
+            (unsigned long)samples[i].timestamp,
+            samples[i].x,
+            samples[i].y,
+            samples[i].z);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t workers = 4;
+    long only_block = -1;
+    int csv = 0;
+    int arg = 1;
+
+    for (; arg < argc - 1 && argv[arg][0] == '-'; ++arg) {
+        if (strcmp(argv[arg], "-c") == 0) {
+            csv = 1;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 2 < argc) {
+            workers = strtoul(argv[++arg], NULL, 0);
+        } else if (strcmp(argv[arg], "-b") == 0 && arg + 2 < argc) {
+            only_block = strtol(argv[++arg], NULL, 0);
+        } else {
+            break;
+        }
+    }
+    if (arg != argc - 1 || workers == 0 || workers > MAX_THREADS) {
+        fprintf(stderr, "usage: %s [-j threads] [-c | -b block] log.bin\n", argv[0]);
+        return 2;
+    }
+
+    int fd = open(argv[arg], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    log_index_t index = {.size = (size_t)st.st_size};
+    if (index.size == 0) {
+        fprintf(stderr, "empty log\n");
+        return 1;
+    }
+    index.data = mmap(NULL, index.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index.data == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (build_index(&index) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    if (only_block >= 0) {
+        if ((size_t)only_block >= index.block_count) {
+            fprintf(stderr, "log has %lu blocks\n", (unsigned long)index.block_count);
+            return 1;
+        }
+        lis3mdl_sample_t *samples =
+            malloc(index.blocks[only_block].header.count * sizeof(*samples));
+        if (samples == NULL || decode_block(&index, (size_t)only_block, samples) != STATUS_OK) {
+            fprintf(stderr, "block %ld is damaged\n", only_block);
+            return 1;
+        }
+        print_csv(&index, (size_t)only_block, samples);
+        free(samples);
+        return 0;
+    }
+
+    lis3mdl_sample_t *samples = NULL;
+    if (csv) {
+        samples = malloc((index.sample_count ? index.sample_count : 1) * sizeof(*samples));
+        if (samples == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    }
+
+    size_t failures = decode_parallel(&index, samples, workers);
+
+    if (csv) {
+        printf("block,index,ctrl_reg1,ctrl_reg2,timestamp,x,y,z\n");
+        for (size_t b = 0; b < index.block_count; ++b) {
+            print_csv(&index, b, &samples[index.blocks[b].first_sample]);
+        }
+        free(samples);
+    } else {
+        size_t config_changes = 0;
+        for (size_t b = 1; b < index.block_count; ++b) {
+            config_changes +=
+                index.blocks[b].header.ctrl_reg1 != index.blocks[b - 1].header.ctrl_reg1
+                || index.blocks[b].header.ctrl_reg2 != index.blocks[b - 1].header.ctrl_reg2;
+        }
+        printf(
+            "%lu blocks, %lu samples, %.2f bytes/sample, %lu config changes,"
+            " %lu damaged blocks, %lu bytes skipped\n",
+            (unsigned long)index.block_count,
+            (unsigned long)index.sample_count,
+            index.sample_count ? (double)index.size / (double)index.sample_count : 0.0,
+            (unsigned long)config_changes,
+            (unsigned long)failures,
+            (unsigned long)index.skipped_bytes);
+    }
+
+    free(index.blocks);
+    munmap((void *)index.data, index.size);
+    return failures != 0;
+}
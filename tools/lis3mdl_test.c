@@ -0,0 +1,1242 @@
+/*
+ * Host tests for the driver, run against the simulated LIS3MDL
+ * (lis3mdl_sim) and against ports that hold transfers open.
+ *
+ *     cc -O2 -std=c11 -I. -o lis3mdl_test \
+ *         tools/lis3mdl_test.c i2c.c i2c_stats.c i2c_trace.c lis3mdl*.c -lm
+ *     ./lis3mdl_test
+ *
+ * Prints one line per failed check and exits non-zero if any failed. The
+ * conversion kernel is chosen at build time, so build again with -mavx2,
+ * or for an ARM target, to cover the other kernels.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "i2c.h"
+#include "i2c_port.h"
+#include "lis3mdl.h"
+#include "lis3mdl_calibrate.h"
+#include "lis3mdl_convert.h"
+#include "lis3mdl_governor.h"
+#include "lis3mdl_log.h"
+#include "lis3mdl_manager.h"
+#include "lis3mdl_sim.h"
+#include "lis3mdl_timing.h"
+
+#define CHECK(condition)                                                \
+    do {                                                                \
+        if (!(condition)) {                                             \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n",            \
+                    __FILE__, __LINE__, __func__, #condition);          \
+            ++failures;                                                 \
+        }                                                               \
+    } while (0)
+
+static int failures;
+
+static lis3mdl_sim_t sim;
+static lis3mdl_dev_t dev;
+
+static uint32_t fake_now;
+
+/* Target of the filler transactions that occupy the bus */
+static uint8_t scratch[1];
+
+static uint32_t fake_clock(void)
+{
+    return fake_now;
+}
+
+/* Time source that moves on by a microsecond every time it is read */
+static uint32_t ticking_clock(void)
+{
+    return fake_now++;
+}
+
+/* Port that keeps each transfer open until release_held() */
+static i2c_transaction_t *held;
+static uint32_t aborts;
+static uint32_t recoveries;
+
+static status_t hold_start(i2c_transaction_t *transaction)
+{
+    held = transaction;
+    return STATUS_OK;
+}
+
+static void hold_abort(i2c_transaction_t *transaction)
+{
+    if (held == transaction) {
+        held = NULL;
+    }
+    aborts++;
+}
+
+static status_t hold_recover(void)
+{
+    recoveries++;
+    return STATUS_OK;
+}
+
+static const i2c_port_t hold_port = {
+    .start = hold_start,
+    .abort = hold_abort,
+    .recover = hold_recover,
+};
+
+/* Port that completes in line, tracking how deeply starts nest */
+static uint32_t start_depth;
+static uint32_t deepest_start;
+
+static status_t inline_start(i2c_transaction_t *transaction)
+{
+    if (++start_depth > deepest_start) {
+        deepest_start = start_depth;
+    }
+    i2c_port_complete_bus(transaction->bus, STATUS_OK);
+    start_depth--;
+    return STATUS_OK;
+}
+
+static const i2c_port_t inline_port = {
+    .start = inline_start,
+};
+
+/* Answer the held chain with a new sample in every STATUS_REG window */
+static void release_held(void)
+{
+    i2c_transaction_t *transaction = held;
+
+    if (transaction == NULL) {
+        return;
+    }
+    held = NULL;
+    for (size_t i = 0; i < transaction->msg_count; ++i) {
+        const i2c_msg_t *msg = &transaction->msgs[i];
+
+        memset(msg->buffer, 0, msg->length);
+        msg->buffer[0] = LIS3MDL_STATUS_ZYXDA;
+    }
+    i2c_port_complete_bus(transaction->bus, STATUS_OK);
+}
+
+static void on_drdy(void *context)
+{
+    (void)context;
+    lis3mdl_on_data_ready(&dev);
+}
+
+/* Power-on model at SA1 low on controller 0, and `dev` bound to it */
+static status_t attach_sim(void)
+{
+    lis3mdl_sim_detach(&sim);
+    lis3mdl_sim_init(&sim);
+    lis3mdl_sim_attach(&sim, 0, LIS3MDL_ADDRESS_SA1_LOW);
+    return lis3mdl_init_on_bus(&dev, 0, LIS3MDL_ADDRESS_SA1_LOW);
+}
+
+/* A data-ready while the device's chain is in flight keeps both stamps */
+static void test_batch_data_ready_during_chain(void)
+{
+    lis3mdl_manager_t manager;
+    lis3mdl_sample_t samples[4];
+
+    CHECK(attach_sim() == STATUS_OK);
+    CHECK(lis3mdl_start_ring_acquisition(&dev, fake_clock) == STATUS_OK);
+    lis3mdl_manager_init(&manager);
+    CHECK(lis3mdl_manager_add(&manager, &dev) == STATUS_OK);
+    i2c_set_bus_port(0, &hold_port);
+
+    fake_now = 100;
+    lis3mdl_manager_on_data_ready(&manager, &dev);
+    CHECK(lis3mdl_manager_flush(&manager) == 1);
+    CHECK(held != NULL);
+
+    fake_now = 200;
+    lis3mdl_manager_on_data_ready(&manager, &dev);
+    release_held();
+    CHECK(lis3mdl_manager_flush(&manager) == 1);
+    CHECK(held != NULL);
+    release_held();
+
+    CHECK(lis3mdl_ring_pop(&dev.ring, samples, 4) == 2);
+    CHECK(samples[0].timestamp == 100);
+    CHECK(samples[1].timestamp == 200);
+    CHECK((uint16_t)(samples[1].sequence - samples[0].sequence) == 1);
+    CHECK(dev.overruns.missed_data_ready == 0);
+
+    lis3mdl_stop_acquisition(&dev);
+    i2c_set_bus_port(0, NULL);
+}
+
+/* A chain the full I2C queue refuses is read on the next flush */
+static void test_batch_submit_refused(void)
+{
+    static i2c_transaction_t fillers[I2C_QUEUE_CAPACITY + 1];
+    lis3mdl_manager_t manager;
+    lis3mdl_sample_t samples[2];
+
+    CHECK(attach_sim() == STATUS_OK);
+    CHECK(lis3mdl_start_ring_acquisition(&dev, fake_clock) == STATUS_OK);
+    lis3mdl_manager_init(&manager);
+    CHECK(lis3mdl_manager_add(&manager, &dev) == STATUS_OK);
+    i2c_set_bus_port(0, &hold_port);
+
+    /* One filler on the wire and the queue full behind it */
+    for (size_t i = 0; i < I2C_QUEUE_CAPACITY + 1; ++i) {
+        fillers[i] = (i2c_transaction_t){
+            .bus_address = LIS3MDL_ADDRESS_SA1_LOW,
+            .register_address = LIS3MDL_REG_WHO_AM_I,
+            .length = 1,
+            .buffer = scratch,
+        };
+        CHECK(i2c_read_async(&fillers[i]) == STATUS_OK);
+    }
+
+    fake_now = 100;
+    lis3mdl_manager_on_data_ready(&manager, &dev);
+    CHECK(lis3mdl_manager_flush(&manager) == 0);
+    CHECK(manager.ready[0]);
+
+    while (held != NULL) {
+        held = NULL;
+        i2c_port_complete_bus(0, STATUS_OK);
+    }
+    fake_now = 150;
+    CHECK(lis3mdl_manager_flush(&manager) == 1);
+    CHECK(held != NULL);
+    release_held();
+
+    CHECK(lis3mdl_ring_pop(&dev.ring, samples, 2) == 1);
+    CHECK(samples[0].timestamp == 100);
+
+    lis3mdl_stop_acquisition(&dev);
+    i2c_set_bus_port(0, NULL);
+}
+
+/*
+ * Recovery from a completion callback, inside dispatch(), must leave the
+ * queue to that dispatch rather than start transfers under it.
+ */
+static i2c_transaction_t followers[2];
+static uint32_t completed;
+
+static void count_completion(i2c_transaction_t *transaction)
+{
+    (void)transaction;
+    completed++;
+}
+
+static void recover_from_completion(i2c_transaction_t *transaction)
+{
+    (void)transaction;
+    for (size_t i = 0; i < 2; ++i) {
+        followers[i] = (i2c_transaction_t){
+            .bus_address = LIS3MDL_ADDRESS_SA1_LOW,
+            .register_address = LIS3MDL_REG_WHO_AM_I,
+            .length = 1,
+            .buffer = scratch,
+            .callback = count_completion,
+        };
+        CHECK(i2c_read_async(&followers[i]) == STATUS_OK);
+    }
+    CHECK(i2c_bus_recover(0) == STATUS_OK);
+    completed++;
+}
+
+static void test_recover_inside_dispatch(void)
+{
+    i2c_transaction_t first = {
+        .bus_address = LIS3MDL_ADDRESS_SA1_LOW,
+        .register_address = LIS3MDL_REG_WHO_AM_I,
+        .length = 1,
+        .buffer = scratch,
+        .callback = recover_from_completion,
+    };
+
+    i2c_set_bus_port(0, &inline_port);
+    start_depth = 0;
+    deepest_start = 0;
+    completed = 0;
+
+    CHECK(i2c_read_async(&first) == STATUS_OK);
+    CHECK(completed == 3);
+    CHECK(deepest_start == 1);
+
+    i2c_set_bus_port(0, NULL);
+}
+
+/* A deadline read only recovers the bus when it is its own read that hung */
+static void test_deadline_recovers_own_read(void)
+{
+    i2c_transaction_t other = {
+        .bus_address = LIS3MDL_ADDRESS_SA1_HIGH,
+        .register_address = LIS3MDL_REG_WHO_AM_I,
+        .length = 1,
+        .buffer = scratch,
+    };
+    int16_t xyz[3];
+
+    CHECK(attach_sim() == STATUS_OK);
+    i2c_set_bus_port(0, &hold_port);
+    i2c_set_time_source(ticking_clock);
+    aborts = 0;
+    recoveries = 0;
+
+    /* Queued behind another device's transfer: withdrawn, nothing aborted */
+    CHECK(i2c_read_async(&other) == STATUS_OK);
+    fake_now = 0;
+    CHECK(lis3mdl_read_xyz_deadline(&dev, xyz, 100) == STATUS_TIMEOUT);
+    CHECK(other.status == STATUS_PENDING);
+    CHECK(held == &other);
+    CHECK(aborts == 0);
+    CHECK(recoveries == 0);
+    held = NULL;
+    i2c_port_complete_bus(0, STATUS_OK);
+    CHECK(other.status == STATUS_OK);
+
+    /* Its own read on the wire: aborted and the bus recovered */
+    fake_now = 0;
+    CHECK(lis3mdl_read_xyz_deadline(&dev, xyz, 100) == STATUS_TIMEOUT);
+    CHECK(held == NULL);
+    CHECK(aborts == 1);
+    CHECK(recoveries == 1);
+
+    i2c_set_time_source(lis3mdl_sim_time_us);
+    i2c_set_bus_port(0, NULL);
+}
+
+static void on_triggered(
+    lis3mdl_dev_t *device,
+    status_t status,
+    const lis3mdl_triggered_sample_t *sample,
+    void *context)
+{
+    (void)device;
+    (void)sample;
+    (void)status;
+    (void)context;
+}
+
+/* Single-conversion mode is refused at FAST_ODR, and accepted at 80 Hz */
+static void test_triggered_rejects_fast_odr(void)
+{
+    CHECK(attach_sim() == STATUS_OK);
+
+    CHECK(lis3mdl_set_odr(&dev, LIS3MDL_ODR_FAST) == STATUS_OK);
+    CHECK(lis3mdl_start_triggered(&dev, false, NULL, on_triggered, NULL)
+          == STATUS_ERROR);
+    CHECK(lis3mdl_trigger(&dev) == STATUS_ERROR);
+
+    CHECK(lis3mdl_set_odr(&dev, LIS3MDL_ODR_80_HZ) == STATUS_OK);
+    CHECK(lis3mdl_start_triggered(&dev, false, NULL, on_triggered, NULL)
+          == STATUS_OK);
+    CHECK(lis3mdl_set_odr(&dev, LIS3MDL_ODR_FAST) == STATUS_OK);
+    CHECK(lis3mdl_trigger(&dev) == STATUS_ERROR);
+    lis3mdl_stop_acquisition(&dev);
+}
+
+/* A device that is not converting has no period, and reports 0 Hz */
+static void test_timing_without_period(void)
+{
+    lis3mdl_timing_t timing;
+    lis3mdl_timing_estimate_t estimate;
+
+    lis3mdl_timing_init(&timing, 0);
+    lis3mdl_timing_get(&timing, &estimate);
+    CHECK(estimate.odr_hz == 0.0f);
+    CHECK(estimate.drift_ppm == 0.0f);
+
+    lis3mdl_timing_init(&timing, 1000000);
+    lis3mdl_timing_get(&timing, &estimate);
+    CHECK(estimate.odr_hz > 999.0f && estimate.odr_hz < 1001.0f);
+}
+
+/*
+ * A conversion that ends while its predecessor's read is still on the wire
+ * raises DRDY there and then: the read in flight defers the next one, which
+ * keeps the edge time as its stamp.
+ */
+static void test_sim_data_ready_during_read(void)
+{
+    static const lis3mdl_config_t config = {
+        .odr = LIS3MDL_ODR_FAST,
+        .full_scale = LIS3MDL_FULL_SCALE_4_GAUSS,
+        .xy_mode = LIS3MDL_OP_MODE_LOW_POWER,
+        .z_mode = LIS3MDL_OP_MODE_LOW_POWER,
+        .measurement_mode = LIS3MDL_MEASUREMENT_CONTINUOUS,
+    };
+    lis3mdl_sample_t samples[4];
+
+    CHECK(attach_sim() == STATUS_OK);
+    CHECK(lis3mdl_apply_config(&dev, &config) == STATUS_OK);
+    CHECK(lis3mdl_start_ring_acquisition(&dev, lis3mdl_sim_time_us)
+          == STATUS_OK);
+    lis3mdl_sim_set_drdy_callback(&sim, on_drdy, NULL);
+
+    /*
+     * At 87 kHz the 1 kHz output's OUT_Z_H is read 83 bits (954 us) after
+     * the edge and the read ends 93 bits (1069 us) after it, so the next
+     * conversion lands between the two.
+     */
+    lis3mdl_sim_set_bus_rate(87000);
+    lis3mdl_sim_advance(2500000);
+    lis3mdl_sim_set_drdy_callback(&sim, NULL, NULL);
+    lis3mdl_stop_acquisition(&dev);
+    lis3mdl_sim_set_bus_rate(400000);
+
+    CHECK(lis3mdl_ring_pop(&dev.ring, samples, 4) >= 2);
+    CHECK(samples[1].timestamp - samples[0].timestamp == 1000);
+    CHECK((uint16_t)(samples[1].sequence - samples[0].sequence) == 1);
+    CHECK(dev.overruns.missed_data_ready == 0);
+}
+
+/* Log sink that appends blocks to `log_bytes` */
+static uint8_t log_bytes[4 * LIS3MDL_LOG_MAX_BLOCK_BYTES];
+static size_t log_used;
+static size_t log_block_ends[8];
+static size_t log_blocks;
+
+static status_t log_to_buffer(
+    void *context,
+    const uint8_t *block,
+    size_t length)
+{
+    (void)context;
+    if (log_used + length > sizeof(log_bytes) || log_blocks == 8) {
+        return STATUS_ERROR;
+    }
+    memcpy(&log_bytes[log_used], block, length);
+    log_used += length;
+    log_block_ends[log_blocks++] = log_used;
+    return STATUS_OK;
+}
+
+/* Decode every block of `data` found by lis3mdl_log_find_block into `out` */
+static size_t log_decode_all(
+    const uint8_t *data,
+    size_t size,
+    lis3mdl_sample_t *out,
+    size_t capacity,
+    uint32_t *sequences)
+{
+    lis3mdl_log_header_t header;
+    size_t offset = 0;
+    size_t decoded = 0;
+    size_t blocks = 0;
+
+    while ((offset = lis3mdl_log_find_block(data, size, offset, &header)) < size) {
+        if (lis3mdl_log_decode(
+                data + offset,
+                size - offset,
+                &out[decoded],
+                capacity - decoded,
+                &header)
+            == STATUS_OK) {
+            decoded += header.count;
+            sequences[blocks++] = header.sequence;
+        }
+        offset += lis3mdl_log_block_size(&header);
+    }
+    return decoded;
+}
+
+/*
+ * Step `sample` to the next value of a sequence that swings each axis
+ * between the int16 extremes and runs the timestamp through its wrap.
+ */
+static void log_test_sample(
+    size_t i,
+    lis3mdl_sample_t *sample)
+{
+    static const int16_t swings[4] = {INT16_MAX, INT16_MIN, 0, -1};
+
+    sample->x = swings[i % 4];
+    sample->y = swings[(i + 1) % 4];
+    sample->z = (int16_t)(i * 7919);
+    sample->sequence = 0;
+    sample->timestamp = UINT32_MAX - 5000 + (uint32_t)i * 37;
+}
+
+/*
+ * Samples come back exactly across a flush mid-block, a full block and a
+ * configuration change, with the timestamp and block sequence wrapping.
+ */
+static void test_log_round_trip(void)
+{
+    static lis3mdl_sample_t written[LIS3MDL_LOG_BLOCK_SAMPLES + 200];
+    static lis3mdl_sample_t read[LIS3MDL_LOG_BLOCK_SAMPLES + 200];
+    static lis3mdl_log_writer_t writer;
+    const size_t n = LIS3MDL_LOG_BLOCK_SAMPLES + 200;
+    uint32_t sequences[8];
+
+    log_used = 0;
+    log_blocks = 0;
+    lis3mdl_log_init(&writer, log_to_buffer, NULL);
+    writer.sequence = UINT32_MAX;
+    for (size_t i = 0; i < n; ++i) {
+        if (i == 100) {
+            CHECK(lis3mdl_log_flush(&writer) == STATUS_OK);
+        }
+        if (i == 100 + LIS3MDL_LOG_BLOCK_SAMPLES + 50) {
+            CHECK(lis3mdl_log_set_config(&writer, 0x70, 0x20) == STATUS_OK);
+        }
+        log_test_sample(i, &written[i]);
+        CHECK(lis3mdl_log_append(&writer, &written[i]) == STATUS_OK);
+    }
+    CHECK(lis3mdl_log_flush(&writer) == STATUS_OK);
+    CHECK(log_blocks == 4);
+
+    CHECK(log_decode_all(log_bytes, log_used, read, n, sequences) == n);
+    CHECK(memcmp(read, written, sizeof(written)) == 0);
+    CHECK(sequences[0] == UINT32_MAX);
+    CHECK(sequences[1] == 0);
+    CHECK(sequences[3] == 2);
+}
+
+/* Write the round-trip samples as blocks of 100 into `log_bytes` */
+static void log_write_blocks(lis3mdl_sample_t *written, size_t n)
+{
+    static lis3mdl_log_writer_t writer;
+
+    log_used = 0;
+    log_blocks = 0;
+    lis3mdl_log_init(&writer, log_to_buffer, NULL);
+    for (size_t i = 0; i < n; ++i) {
+        log_test_sample(i, &written[i]);
+        lis3mdl_log_append(&writer, &written[i]);
+        if (i % 100 == 99) {
+            lis3mdl_log_flush(&writer);
+        }
+    }
+}
+
+/*
+ * A block with a bad CRC fails to decode and a block cut short is skipped
+ * over; either way the next block is found and decodes whole.
+ */
+static void test_log_damaged_blocks(void)
+{
+    static uint8_t damaged[sizeof(log_bytes)];
+    static lis3mdl_sample_t written[300];
+    static lis3mdl_sample_t read[300];
+    uint32_t sequences[8];
+    size_t size;
+
+    log_write_blocks(written, 300);
+    CHECK(log_blocks == 3);
+
+    /* Corrupt a payload byte of block 1 */
+    memcpy(damaged, log_bytes, log_used);
+    damaged[log_block_ends[0] + LIS3MDL_LOG_HEADER_SIZE + 10] ^= 0x01;
+    CHECK(log_decode_all(damaged, log_used, read, 300, sequences) == 200);
+    CHECK(sequences[0] == 0 && sequences[1] == 2);
+    CHECK(memcmp(&read[0], &written[0], 100 * sizeof(read[0])) == 0);
+    CHECK(memcmp(&read[100], &written[200], 100 * sizeof(read[0])) == 0);
+
+    /* Cut the last 40 bytes of block 1 and prefix some garbage */
+    size_t cut = log_block_ends[1] - 40;
+    damaged[0] = 'L';
+    damaged[1] = '3';
+    damaged[2] = 0xAA;
+    memcpy(&damaged[3], log_bytes, cut);
+    memcpy(&damaged[3 + cut], &log_bytes[log_block_ends[1]], log_used - log_block_ends[1]);
+    size = 3 + cut + log_used - log_block_ends[1];
+    CHECK(log_decode_all(damaged, size, read, 300, sequences) == 200);
+    CHECK(sequences[0] == 0 && sequences[1] == 2);
+    CHECK(memcmp(&read[0], &written[0], 100 * sizeof(read[0])) == 0);
+    CHECK(memcmp(&read[100], &written[200], 100 * sizeof(read[0])) == 0);
+
+    /* Cut block 1 inside its header */
+    memcpy(damaged, log_bytes, log_block_ends[0] + 20);
+    memcpy(&damaged[log_block_ends[0] + 20], &log_bytes[log_block_ends[1]],
+           log_used - log_block_ends[1]);
+    size = log_block_ends[0] + 20 + log_used - log_block_ends[1];
+    CHECK(log_decode_all(damaged, size, read, 300, sequences) == 200);
+    CHECK(memcmp(&read[100], &written[200], 100 * sizeof(read[0])) == 0);
+}
+
+/* Hard iron and symmetric soft iron of the synthetic installation, gauss */
+static const double test_center[3] = {0.30, -0.20, 0.12};
+static const double test_shape[3][3] = {
+    {1.20, 0.10, -0.05},
+    {0.10, 0.90, 0.08},
+    {-0.05, 0.08, 1.05},
+};
+#define TEST_FIELD 0.5 /* gauss */
+
+/* Point `i` of `n` spread over the distorted field sphere, in LSB */
+static void ellipsoid_point(
+    size_t i,
+    size_t n,
+    int16_t raw[3])
+{
+    double z = 1.0 - (2.0 * i + 1.0) / n;
+    double r = sqrt(1.0 - z * z);
+    double angle = 2.39996322972865332 * i;
+    const double u[3] = {r * cos(angle), r * sin(angle), z};
+
+    for (size_t row = 0; row < 3; ++row) {
+        double g = test_center[row];
+
+        for (size_t col = 0; col < 3; ++col) {
+            g += TEST_FIELD * test_shape[row][col] * u[col];
+        }
+        raw[row] = (int16_t)lrint(g * lis3mdl_lsb_per_gauss(LIS3MDL_FULL_SCALE_4_GAUSS));
+    }
+}
+
+static double shape_determinant(void)
+{
+    const double (*m)[3] = test_shape;
+
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+        - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+        + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+}
+
+/* Largest relative distance of the corrected points from `radius` */
+static double sphere_error(
+    const lis3mdl_calib_t *calib,
+    size_t n,
+    double radius)
+{
+    double worst = 0.0;
+
+    for (size_t i = 0; i < n; ++i) {
+        int16_t raw[3];
+        float out[3];
+
+        ellipsoid_point(i, n, raw);
+        lis3mdl_convert_sample(raw, out, calib);
+
+        double error = fabs(sqrt((double)out[0] * out[0]
+            + (double)out[1] * out[1] + (double)out[2] * out[2]) / radius - 1.0);
+        if (error > worst) {
+            worst = error;
+        }
+    }
+    return worst;
+}
+
+/*
+ * A fit of a known ellipsoid finds its centre and maps it onto a sphere of
+ * the same volume.
+ */
+static void test_calibrate_ellipsoid(void)
+{
+    static lis3mdl_calibrate_t calibrate;
+    lis3mdl_calibrate_config_t config;
+    lis3mdl_calibrate_fit_t fit;
+    lis3mdl_calib_t calib;
+    lis3mdl_sample_t sample = {0};
+    const size_t n = 400;
+    double radius = TEST_FIELD * cbrt(shape_determinant());
+
+    CHECK(attach_sim() == STATUS_OK);
+    lis3mdl_calibrate_default_config(&config);
+    CHECK(lis3mdl_calibrate_init(&calibrate, &dev, &config) == STATUS_OK);
+    for (size_t i = 0; i < n; ++i) {
+        int16_t raw[3];
+
+        ellipsoid_point(i, n, raw);
+        sample.x = raw[0];
+        sample.y = raw[1];
+        sample.z = raw[2];
+        sample.sequence = (uint16_t)i;
+        lis3mdl_calibrate_feed(&calibrate, &sample, 1);
+    }
+
+    lis3mdl_calibrate_get(&calibrate, &calib, &fit);
+    CHECK(fit.valid);
+    CHECK(fit.rejected == 0);
+    CHECK(fabs(fit.field_gauss - radius) < 1e-3 * radius);
+    for (size_t axis = 0; axis < 3; ++axis) {
+        CHECK(fabs(calib.hard_iron[axis] - test_center[axis]) < 1e-3);
+    }
+    CHECK(sphere_error(&calib, n, radius) < 2e-3);
+}
+
+/* Turning about one axis only leaves the fit underdetermined */
+static void test_calibrate_rejects_single_axis(void)
+{
+    static lis3mdl_calibrate_t calibrate;
+    lis3mdl_calibrate_config_t config;
+    lis3mdl_calibrate_fit_t fit;
+    lis3mdl_calib_t calib;
+    lis3mdl_sample_t sample = {0};
+
+    CHECK(attach_sim() == STATUS_OK);
+    lis3mdl_calibrate_default_config(&config);
+    CHECK(lis3mdl_calibrate_init(&calibrate, &dev, &config) == STATUS_OK);
+    for (size_t i = 0; i < 400; ++i) {
+        double angle = 0.05 * i;
+
+        sample.x = (int16_t)lrint(2000.0 + 3000.0 * cos(angle));
+        sample.y = (int16_t)lrint(-1000.0 + 3000.0 * sin(angle));
+        sample.z = 1500;
+        sample.sequence = (uint16_t)i;
+        CHECK(!lis3mdl_calibrate_feed(&calibrate, &sample, 1));
+    }
+
+    lis3mdl_calibrate_get(&calibrate, &calib, &fit);
+    CHECK(!fit.valid);
+    CHECK(fit.fits == (uint32_t)(400 - config.min_samples) / config.fit_interval + 1);
+    CHECK(fit.rejected == fit.fits);
+    CHECK(calib.hard_iron[0] == 0.0f && calib.soft_iron[0][0] == 1.0f);
+}
+
+/*
+ * Conversions up to the OFFSET write are fitted against the old offset and
+ * later ones against the new offset, except the one that straddles the
+ * write, which is dropped: the fit's equations match a fit of the same
+ * field with no offset at all.
+ */
+static void test_calibrate_offset_write(void)
+{
+    static lis3mdl_calibrate_t calibrate;
+    static lis3mdl_calibrate_t reference;
+    lis3mdl_calibrate_config_t config;
+    lis3mdl_calib_t calib;
+    lis3mdl_sample_t sample = {0};
+    const size_t n = 400;
+    double lsb = 1.0 / lis3mdl_lsb_per_gauss(LIS3MDL_FULL_SCALE_4_GAUSS);
+
+    CHECK(attach_sim() == STATUS_OK);
+    lis3mdl_calibrate_default_config(&config);
+    CHECK(lis3mdl_calibrate_init(&calibrate, &dev, &config) == STATUS_OK);
+    CHECK(lis3mdl_calibrate_init(&reference, &dev, &config) == STATUS_OK);
+
+    uint16_t sequence = (uint16_t)(dev.sequence - 250);
+    for (size_t i = 0; i < 300; ++i) {
+        int16_t raw[3];
+
+        ellipsoid_point(i % n, n, raw);
+        sample.x = raw[0];
+        sample.y = raw[1];
+        sample.z = raw[2];
+        sample.sequence = sequence++;
+        lis3mdl_calibrate_feed(&calibrate, &sample, 1);
+        lis3mdl_calibrate_feed(&reference, &sample, 1);
+    }
+    CHECK(lis3mdl_calibrate_write_offset(&calibrate) == STATUS_OK);
+    CHECK(calibrate.offset[0] != 0 && calibrate.offset[1] != 0);
+
+    /* Still queued from before the write: the old offset of zero */
+    sequence = (uint16_t)(dev.sequence - 2);
+    for (size_t i = 300; i < 310; ++i) {
+        int16_t raw[3];
+
+        ellipsoid_point(i % n, n, raw);
+        sample.x = raw[0];
+        sample.y = raw[1];
+        sample.z = raw[2];
+        sample.sequence = sequence++;
+
+        int16_t since = (int16_t)(uint16_t)(sample.sequence - dev.sequence);
+        if (since == 1) {
+            /* Straddles the write; nothing about it can be trusted */
+            sample.x = INT16_MAX;
+            sample.y = INT16_MIN;
+            lis3mdl_calibrate_feed(&calibrate, &sample, 1);
+            continue;
+        }
+        if (since > 1) {
+            sample.x = (int16_t)(raw[0] - calibrate.offset[0]);
+            sample.y = (int16_t)(raw[1] - calibrate.offset[1]);
+            sample.z = (int16_t)(raw[2] - calibrate.offset[2]);
+        }
+        lis3mdl_calibrate_feed(&calibrate, &sample, 1);
+        sample.x = raw[0];
+        sample.y = raw[1];
+        sample.z = raw[2];
+        lis3mdl_calibrate_feed(&reference, &sample, 1);
+    }
+
+    CHECK(calibrate.samples == reference.samples);
+    CHECK(memcmp(calibrate.moments, reference.moments, sizeof(reference.moments)) == 0);
+    CHECK(memcmp(calibrate.targets, reference.targets, sizeof(reference.targets)) == 0);
+
+    lis3mdl_calibrate_get(&calibrate, &calib, NULL);
+    for (size_t axis = 0; axis < 3; ++axis) {
+        CHECK(fabs(calib.hard_iron[axis]) <= 0.5 * lsb + 1e-6);
+    }
+}
+
+/* A full ring refuses the next slot, and indices wrap in slot and counter */
+static void test_ring_wrap(void)
+{
+    static lis3mdl_ring_t ring;
+    lis3mdl_sample_t out[7];
+    uint16_t written = 0;
+    uint16_t read = 0;
+
+    lis3mdl_ring_reset(&ring);
+    atomic_store(&ring.head, UINT32_MAX - 20);
+    atomic_store(&ring.tail, UINT32_MAX - 20);
+
+    for (int round = 0; round < 3; ++round) {
+        lis3mdl_sample_t *slot;
+
+        while ((slot = lis3mdl_ring_reserve(&ring)) != NULL) {
+            *slot = (lis3mdl_sample_t){.x = (int16_t)written, .sequence = written};
+            written++;
+            lis3mdl_ring_commit(&ring);
+        }
+        CHECK(lis3mdl_ring_count(&ring) == LIS3MDL_RING_CAPACITY);
+
+        /* Drain all but a few, in odd-sized pops */
+        while (lis3mdl_ring_count(&ring) > 5) {
+            size_t n = lis3mdl_ring_pop(&ring, out, 7);
+
+            for (size_t i = 0; i < n; ++i) {
+                CHECK(out[i].sequence == read && out[i].x == (int16_t)read);
+                read++;
+            }
+        }
+    }
+    CHECK(atomic_load(&ring.tail) < LIS3MDL_RING_CAPACITY * 3);
+    CHECK(written == read + lis3mdl_ring_count(&ring));
+}
+
+/*
+ * An acquisition nobody drains keeps the oldest LIS3MDL_RING_CAPACITY
+ * samples in order and counts every later one in ring_full.
+ */
+static void test_ring_full_counted(void)
+{
+    static const lis3mdl_config_t config = {
+        .odr = LIS3MDL_ODR_80_HZ,
+        .full_scale = LIS3MDL_FULL_SCALE_4_GAUSS,
+        .xy_mode = LIS3MDL_OP_MODE_LOW_POWER,
+        .z_mode = LIS3MDL_OP_MODE_LOW_POWER,
+        .measurement_mode = LIS3MDL_MEASUREMENT_CONTINUOUS,
+    };
+    lis3mdl_sample_t samples[LIS3MDL_RING_CAPACITY + 1];
+
+    CHECK(attach_sim() == STATUS_OK);
+    CHECK(lis3mdl_apply_config(&dev, &config) == STATUS_OK);
+    CHECK(lis3mdl_start_ring_acquisition(&dev, lis3mdl_sim_time_us)
+          == STATUS_OK);
+    lis3mdl_sim_set_drdy_callback(&sim, on_drdy, NULL);
+    lis3mdl_sim_advance(1500000000);
+    lis3mdl_sim_set_drdy_callback(&sim, NULL, NULL);
+    lis3mdl_stop_acquisition(&dev);
+
+    CHECK(lis3mdl_ring_count(&dev.ring) == LIS3MDL_RING_CAPACITY);
+    CHECK(lis3mdl_ring_pop(&dev.ring, samples, LIS3MDL_RING_CAPACITY + 1)
+          == LIS3MDL_RING_CAPACITY);
+    for (size_t i = 1; i < LIS3MDL_RING_CAPACITY; ++i) {
+        CHECK((uint16_t)(samples[i].sequence - samples[i - 1].sequence) == 1);
+        CHECK(samples[i].timestamp - samples[i - 1].timestamp == 12500);
+    }
+
+    /* Conversions after the last one kept were all dropped and counted */
+    uint16_t last = samples[LIS3MDL_RING_CAPACITY - 1].sequence;
+    CHECK(dev.overruns.ring_full > 0);
+    CHECK(dev.overruns.ring_full == (uint16_t)(dev.sequence - last));
+    CHECK(dev.samples == LIS3MDL_RING_CAPACITY);
+    CHECK(dev.overruns.missed_data_ready == 0);
+}
+
+/* Blocks are refused when all are waiting, and come back in order */
+static void test_soa_wrap(void)
+{
+    static lis3mdl_soa_buffer_t buffer;
+    const lis3mdl_soa_block_t *block;
+    uint16_t written = 0;
+    uint16_t read = 0;
+    size_t index;
+
+    lis3mdl_soa_reset(&buffer);
+    atomic_store(&buffer.head, UINT32_MAX - 1);
+    atomic_store(&buffer.tail, UINT32_MAX - 1);
+
+    for (int round = 0; round < 3; ++round) {
+        lis3mdl_soa_block_t *filling;
+
+        while ((filling = lis3mdl_soa_reserve(&buffer, &index)) != NULL) {
+            filling->x[index] = (int16_t)written;
+            filling->sequence[index] = written;
+            written++;
+            lis3mdl_soa_commit(&buffer);
+        }
+        CHECK(written == (round + 1) * 3 * LIS3MDL_SOA_BLOCK_SAMPLES
+              + LIS3MDL_SOA_BLOCK_SAMPLES);
+
+        /* Take all but one block */
+        for (int b = 0; b < 3; ++b) {
+            CHECK((block = lis3mdl_soa_take(&buffer)) != NULL);
+            for (uint32_t i = 0; block != NULL && i < block->count; ++i) {
+                CHECK(block->sequence[i] == read && block->x[i] == (int16_t)read);
+                read++;
+            }
+            lis3mdl_soa_release(&buffer);
+        }
+    }
+
+    /* A flushed partial block follows the full one still waiting */
+    lis3mdl_soa_block_t *partial = lis3mdl_soa_reserve(&buffer, &index);
+    CHECK(partial != NULL && index == 0);
+    if (partial != NULL) {
+        partial->sequence[index] = written++;
+        lis3mdl_soa_commit(&buffer);
+    }
+    lis3mdl_soa_flush(&buffer);
+    while ((block = lis3mdl_soa_take(&buffer)) != NULL) {
+        for (uint32_t i = 0; i < block->count; ++i) {
+            CHECK(block->sequence[i] == read);
+            read++;
+        }
+        lis3mdl_soa_release(&buffer);
+    }
+    CHECK(read == written);
+    CHECK(atomic_load(&buffer.tail) < LIS3MDL_SOA_BLOCK_COUNT * 3);
+}
+
+/* As for the ring: the oldest blocks are kept and the rest counted */
+static void test_soa_full_counted(void)
+{
+    static const lis3mdl_config_t config = {
+        .odr = LIS3MDL_ODR_80_HZ,
+        .full_scale = LIS3MDL_FULL_SCALE_4_GAUSS,
+        .xy_mode = LIS3MDL_OP_MODE_LOW_POWER,
+        .z_mode = LIS3MDL_OP_MODE_LOW_POWER,
+        .measurement_mode = LIS3MDL_MEASUREMENT_CONTINUOUS,
+    };
+    static lis3mdl_soa_buffer_t buffer;
+    const lis3mdl_soa_block_t *block;
+    uint32_t taken = 0;
+    uint16_t last = 0;
+
+    CHECK(attach_sim() == STATUS_OK);
+    CHECK(lis3mdl_apply_config(&dev, &config) == STATUS_OK);
+    CHECK(lis3mdl_start_soa_acquisition(&dev, &buffer, lis3mdl_sim_time_us)
+          == STATUS_OK);
+    lis3mdl_sim_set_drdy_callback(&sim, on_drdy, NULL);
+    lis3mdl_sim_advance(4000000000u);
+    lis3mdl_sim_set_drdy_callback(&sim, NULL, NULL);
+    lis3mdl_stop_acquisition(&dev);
+    lis3mdl_soa_flush(&buffer);
+
+    while ((block = lis3mdl_soa_take(&buffer)) != NULL) {
+        CHECK(block->count == LIS3MDL_SOA_BLOCK_SAMPLES);
+        for (uint32_t i = 0; i < block->count; ++i) {
+            CHECK(taken == 0 || (uint16_t)(block->sequence[i] - last) == 1);
+            last = block->sequence[i];
+            taken++;
+        }
+        lis3mdl_soa_release(&buffer);
+    }
+    CHECK(taken == LIS3MDL_SOA_BLOCK_COUNT * LIS3MDL_SOA_BLOCK_SAMPLES);
+    CHECK(dev.overruns.ring_full > 0);
+    CHECK(dev.overruns.ring_full == (uint16_t)(dev.sequence - last));
+    CHECK(dev.overruns.missed_data_ready == 0);
+}
+
+/* Every raw value on each axis, in a different order per axis */
+static int16_t convert_raw[3][65536 + 1];
+static float convert_out[3][65536 + 1];
+static float convert_reference[3][65536 + 1];
+
+/*
+ * The build's SIMD kernel and its scalar tail agree bit for bit with
+ * lis3mdl_convert_sample over the whole int16 range, at every length
+ * around the vector width and from unaligned starts.
+ */
+static void test_convert_kernels(void)
+{
+    static const size_t lengths[] = {1, 3, 4, 5, 7, 8, 9, 15, 17, 63, 65, 65535};
+    static const lis3mdl_calib_t calib = {
+        .gauss_per_lsb = 1.0f / 6842.0f,
+        .hard_iron = {0.1234f, -0.2718f, 3.1415f},
+        .soft_iron = {
+            {1.0312f, -0.0471f, 0.0203f},
+            {-0.0471f, 0.9687f, 0.0119f},
+            {0.0203f, 0.0119f, 1.0044f},
+        },
+    };
+    static int16_t interleaved[3 * 65536];
+    static float interleaved_out[3 * 65536];
+    const size_t n = 65536;
+
+    for (size_t i = 0; i < n; ++i) {
+        convert_raw[0][i] = (int16_t)(uint16_t)i;
+        convert_raw[1][i] = (int16_t)(uint16_t)(n - 1 - i);
+        convert_raw[2][i] = (int16_t)(uint16_t)(i * 40503u);
+
+        const int16_t sample[3] = {
+            convert_raw[0][i], convert_raw[1][i], convert_raw[2][i],
+        };
+        float result[3];
+
+        lis3mdl_convert_sample(sample, result, &calib);
+        for (size_t a = 0; a < 3; ++a) {
+            convert_reference[a][i] = result[a];
+            interleaved[3 * i + a] = sample[a];
+        }
+    }
+
+    const int16_t *const raw[3] = {convert_raw[0], convert_raw[1], convert_raw[2]};
+    float *const out[3] = {convert_out[0], convert_out[1], convert_out[2]};
+
+    lis3mdl_convert_batch_soa(raw, n, out, &calib);
+    for (size_t a = 0; a < 3; ++a) {
+        CHECK(memcmp(convert_out[a], convert_reference[a], n * sizeof(float)) == 0);
+    }
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+        const size_t length = lengths[l];
+        const int16_t *const shifted_raw[3] = {
+            convert_raw[0] + 1, convert_raw[1] + 1, convert_raw[2] + 1,
+        };
+        float *const shifted_out[3] = {
+            convert_out[0] + 1, convert_out[1] + 1, convert_out[2] + 1,
+        };
+
+        memset(convert_out, 0, sizeof(convert_out));
+        lis3mdl_convert_batch_soa(shifted_raw, length, shifted_out, &calib);
+        for (size_t a = 0; a < 3; ++a) {
+            CHECK(memcmp(shifted_out[a], &convert_reference[a][1], length * sizeof(float))
+                  == 0);
+            /* Nothing is written past the end */
+            CHECK(shifted_out[a][length] == 0.0f);
+        }
+    }
+
+    lis3mdl_convert_batch(interleaved, n - 3, interleaved_out, &calib);
+    for (size_t i = 0; i < n - 3; ++i) {
+        for (size_t a = 0; a < 3; ++a) {
+            if (memcmp(&interleaved_out[3 * i + a], &convert_reference[a][i], sizeof(float))
+                != 0) {
+                CHECK(!"interleaved batch matches the reference");
+                return;
+            }
+        }
+    }
+}
+
+/* Field noise per governor window, in mgauss RMS per axis */
+static const float governor_noise[] = {
+    0, 0, 0, 0,                   /* Quiet at the bottom level */
+    10, 10,                       /* Active: one level up per window */
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, /* Between the thresholds: hold */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* Level after each window for the noise above */
+static const uint8_t governor_levels[] = {
+    0, 0, 0, 0,
+    1, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+};
+
+#define GOVERNOR_WINDOWS (sizeof(governor_levels) / sizeof(governor_levels[0]))
+
+static uint32_t governor_first_conversion;
+static uint32_t noise_state;
+
+/* A 0.4 gauss field with uniform noise that steps each 16 conversions */
+static void noisy_field(
+    void *context,
+    uint64_t time_ns,
+    float gauss[3])
+{
+    const lis3mdl_sim_t *model = context;
+    size_t window = (model->conversions - governor_first_conversion) / 16;
+    float rms = window < GOVERNOR_WINDOWS ? governor_noise[window] : 0.0f;
+
+    (void)time_ns;
+    for (size_t axis = 0; axis < 3; ++axis) {
+        noise_state = noise_state * 1664525u + 1013904223u;
+        float uniform = (float)(noise_state >> 8) / (float)(1u << 24) * 2.0f - 1.0f;
+        gauss[axis] = 0.4f + uniform * rms * 1.7320508f * 0.001f;
+    }
+}
+
+/*
+ * The governor climbs a level on each active window, holds mid-ladder
+ * while the activity sits between its thresholds, and steps down only
+ * after lower_windows quiet windows, one level at a time.
+ */
+static void test_governor_hysteresis(void)
+{
+    static lis3mdl_governor_t governor;
+    lis3mdl_governor_config_t config;
+    lis3mdl_sample_t samples[LIS3MDL_RING_CAPACITY];
+    size_t windows = 0;
+    uint32_t fed = 0;
+
+    CHECK(attach_sim() == STATUS_OK);
+    lis3mdl_governor_default_config(&config);
+    CHECK(config.window_samples == 16);
+    noise_state = 1;
+    lis3mdl_sim_set_field(&sim, noisy_field, &sim);
+    CHECK(lis3mdl_governor_init(&governor, &dev, &config, 0) == STATUS_OK);
+    governor_first_conversion = sim.conversions;
+    CHECK(lis3mdl_start_ring_acquisition(&dev, lis3mdl_sim_time_us)
+          == STATUS_OK);
+    lis3mdl_sim_set_drdy_callback(&sim, on_drdy, NULL);
+
+    while (windows < GOVERNOR_WINDOWS && lis3mdl_sim_time_ns() < 200000000000ull) {
+        lis3mdl_sim_advance(1000000);
+
+        size_t n = lis3mdl_ring_pop(&dev.ring, samples, LIS3MDL_RING_CAPACITY);
+        for (size_t i = 0; i < n && windows < GOVERNOR_WINDOWS; ++i) {
+            const int16_t xyz[3] = {samples[i].x, samples[i].y, samples[i].z};
+
+            CHECK(lis3mdl_governor_feed(&governor, xyz) == STATUS_OK);
+            if (++fed % 16 == 0) {
+                CHECK(lis3mdl_governor_level(&governor) == governor_levels[windows]);
+                windows++;
+            }
+        }
+    }
+    lis3mdl_sim_set_drdy_callback(&sim, NULL, NULL);
+    lis3mdl_stop_acquisition(&dev);
+    lis3mdl_sim_set_field(&sim, NULL, NULL);
+
+    CHECK(windows == GOVERNOR_WINDOWS);
+    CHECK(governor.changes == 4);
+    CHECK(dev.overruns.ring_full == 0);
+}
+
+/* Lock operations for two pretend tasks, counting lock and unlock calls */
+static int task_a;
+static int task_b;
+static void *current_task;
+static uint32_t locks;
+static uint32_t unlocks;
+
+static void count_lock(void *mutex)
+{
+    (void)mutex;
+    locks++;
+}
+
+static void count_unlock(void *mutex)
+{
+    (void)mutex;
+    unlocks++;
+}
+
+static void *get_current_task(void)
+{
+    return current_task;
+}
+
+static const i2c_lock_ops_t counting_lock = {
+    .lock = count_lock,
+    .unlock = count_unlock,
+    .current_task = get_current_task,
+};
+
+/* Only the owning task's release counts, however often another calls it */
+static void test_release_by_other_task(void)
+{
+    i2c_set_bus_lock(0, &counting_lock, NULL);
+    locks = 0;
+    unlocks = 0;
+
+    current_task = &task_a;
+    CHECK(i2c_bus_acquire(0) == STATUS_OK);
+    CHECK(i2c_bus_acquire(0) == STATUS_OK);
+
+    current_task = &task_b;
+    i2c_bus_release(0);
+    i2c_bus_release(0);
+    CHECK(unlocks == 0);
+
+    current_task = &task_a;
+    i2c_bus_release(0);
+    CHECK(unlocks == 0);
+    i2c_bus_release(0);
+    CHECK(locks == 1 && unlocks == 1);
+    i2c_bus_release(0);
+    CHECK(unlocks == 1);
+
+    i2c_set_bus_lock(0, NULL, NULL);
+}
+
+/* Blocking calls from a callback inside dispatch() are refused, not hung */
+static status_t blocking_status[3];
+
+static void block_from_completion(i2c_transaction_t *transaction)
+{
+    (void)transaction;
+    blocking_status[0] = i2c_bus_read(0, LIS3MDL_ADDRESS_SA1_LOW,
+                                      LIS3MDL_REG_WHO_AM_I, 1, scratch);
+    blocking_status[1] = i2c_bus_read_deadline(
+        0, LIS3MDL_ADDRESS_SA1_LOW, LIS3MDL_REG_WHO_AM_I, 1, scratch,
+        i2c_deadline_in(100));
+    blocking_status[2] = i2c_bus_write(0, LIS3MDL_ADDRESS_SA1_LOW,
+                                       LIS3MDL_REG_CTRL_REG1, 1, scratch);
+    completed++;
+}
+
+static void test_blocking_inside_dispatch(void)
+{
+    i2c_transaction_t first = {
+        .bus_address = LIS3MDL_ADDRESS_SA1_LOW,
+        .register_address = LIS3MDL_REG_WHO_AM_I,
+        .length = 1,
+        .buffer = scratch,
+        .callback = block_from_completion,
+    };
+
+    i2c_set_bus_port(0, &inline_port);
+    start_depth = 0;
+    deepest_start = 0;
+    completed = 0;
+
+    CHECK(i2c_read_async(&first) == STATUS_OK);
+    CHECK(completed == 1);
+    CHECK(deepest_start == 1);
+    for (size_t i = 0; i < 3; ++i) {
+        CHECK(blocking_status[i] == STATUS_BUSY);
+    }
+
+    /* Outside a dispatch the same calls run */
+    CHECK(i2c_bus_read(0, LIS3MDL_ADDRESS_SA1_LOW, LIS3MDL_REG_WHO_AM_I, 1, scratch)
+          == STATUS_OK);
+    CHECK(deepest_start == 1);
+
+    i2c_set_bus_port(0, NULL);
+}
+
+int main(void)
+{
+    i2c_set_time_source(lis3mdl_sim_time_us);
+
+    test_batch_data_ready_during_chain();
+    test_batch_submit_refused();
+    test_recover_inside_dispatch();
+    test_deadline_recovers_own_read();
+    test_triggered_rejects_fast_odr();
+    test_timing_without_period();
+    test_sim_data_ready_during_read();
+    test_log_round_trip();
+    test_log_damaged_blocks();
+    test_calibrate_ellipsoid();
+    test_calibrate_rejects_single_axis();
+    test_calibrate_offset_write();
+    test_ring_wrap();
+    test_ring_full_counted();
+    test_soa_wrap();
+    test_soa_full_counted();
+    test_convert_kernels();
+    test_governor_hysteresis();
+    test_release_by_other_task();
+    test_blocking_inside_dispatch();
+
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}